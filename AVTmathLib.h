@@ -213,4 +213,12 @@
 
 		void shadow_matrix(float* mat, float* plane, float* light);   //for planar shadows
 
+		/** Inverse of a 4x4 matrix
+		  *
+		  * \param mat the matrix to invert
+		  * \param res the inverse, left untouched when mat is singular
+		  * \returns false if mat is singular
+		*/
+		bool invertMatrix(const float* mat, float* res);
+
 #endif
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 #include "VSShaderlib.h"
 #include "AVTmathLib.h"
+#include "glStateCache.h"
 
 using namespace std;
 
@@ -65,7 +66,7 @@ void freeType_init(const string font_name, int width, int height, float& char_wi
 			// generate texture
 			unsigned int texture;
 			glGenTextures(1, &texture);
-			glBindTexture(GL_TEXTURE_2D, texture);
+			stateBindTexture(GL_TEXTURE_2D, texture);
 			glTexImage2D(
 				GL_TEXTURE_2D,
 				0,
@@ -90,7 +91,7 @@ void freeType_init(const string font_name, int width, int height, float& char_wi
 			};
 			Characters.insert(std::pair<char, Character>(c, character));
 		}
-		glBindTexture(GL_TEXTURE_2D, 0);
+		stateBindTexture(GL_TEXTURE_2D, 0);
 
 		// Get the character size
 		char_width = face->glyph->bitmap.width;
@@ -105,13 +106,13 @@ void freeType_init(const string font_name, int width, int height, float& char_wi
 	// -----------------------------------
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
-	glBindVertexArray(VAO);
+	stateBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	stateBindVertexArray(0);
 }
 
 // render line of text
@@ -120,15 +121,26 @@ void RenderText(VSShaderLib& shaderText, std::string text, float x, float y, flo
 {
 	// activate corresponding render state	
 	GLuint programIndex = shaderText.getProgramIndex();
-	glUseProgram(programIndex);
+	stateUseProgram(programIndex);
+
+	// uniforms resolved again only if the shader changes
+	static GLuint textProgram = 0;
+	static UniformHandle<mat4> pvm_uniform;
+	static UniformHandle<vec3> textColor_uniform;
+	if (programIndex != textProgram) {
+		pvm_uniform = shaderText.getUniform<mat4>("m_pvm");
+		textColor_uniform = shaderText.getUniform<vec3>("textColor");
+		textProgram = programIndex;
+	}
 
 	computeDerivedMatrix(PROJ_VIEW_MODEL);
-	glUniformMatrix4fv(glGetUniformLocation(programIndex, "m_pvm"), 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
+	pvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
 
-	glUniform3f(glGetUniformLocation(programIndex, "textColor"), cR, cG, cB);
+	float color[3] = { cR, cG, cB };
+	textColor_uniform.set(color);
 
-	glActiveTexture(GL_TEXTURE0); //no frag shader o uniform sampler foi carregado com TU0
-	glBindVertexArray(VAO);
+	stateActiveTexture(GL_TEXTURE0); //no frag shader o uniform sampler foi carregado com TU0
+	stateBindVertexArray(VAO);
 
 	// iterate through all characters
 	std::string::const_iterator c;
@@ -152,7 +164,7 @@ void RenderText(VSShaderLib& shaderText, std::string text, float x, float y, flo
 			{ xpos + w, ypos + h,   1.0f, 0.0f }
 		};
 		// render glyph texture over quad
-		glBindTexture(GL_TEXTURE_2D, ch.TextureID);
+		stateBindTexture(GL_TEXTURE_2D, ch.TextureID);
 		// update content of VBO memory
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
 		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); // be sure to use glBufferSubData and not glBufferData
@@ -163,8 +175,6 @@ void RenderText(VSShaderLib& shaderText, std::string text, float x, float y, flo
 		// now advance cursors for next glyph (note that advance is number of 1/64 pixels)
 		x += (ch.Advance >> 6) * scale; // bitshift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
 	}
-	glBindVertexArray(0);
-	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 float TextWidth(const std::string& text, float scale, float char_width) {
@@ -6,6 +6,7 @@ Basic Revolution Geometry
  *
  João Madeiras Pereira
 ----------------------------------------------------*/
+#include <stdio.h>
 #include <string>
 #include <assert.h>
 #include <stdlib.h>
@@ -20,16 +21,19 @@ Basic Revolution Geometry
 #include "VertexAttrDef.h"
 #include "geometry.h"
 #include "cube.h"
+#include "meshArena.h"
 
 
-GLuint VboId[2];
-
 MyMesh createQuad(float size_x, float size_z) {
 	
 	int i;
 	float vert[16];
+	char key[64];
 	MyMesh amesh;
-	amesh.numIndexes = 2*3;
+
+	snprintf(key, sizeof(key), "quad %g %g", size_x, size_z);
+	if (meshRegistryFind(key, amesh))
+		return(amesh);
 
 	memcpy(vert, quad_vertices, sizeof(float) * 16);
 
@@ -38,90 +42,72 @@ MyMesh createQuad(float size_x, float size_z) {
 		vert[i*4+2] *= size_z;
 	}
 
-	glGenVertexArrays(1, &(amesh.vao));
-	glBindVertexArray(amesh.vao);
-
-	glGenBuffers(2, VboId);
-	glBindBuffer(GL_ARRAY_BUFFER, VboId[0]);
-
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices)+sizeof(quad_normals)+sizeof(quad_texCoords),NULL,GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(quad_vertices), vert);
-    glBufferSubData(GL_ARRAY_BUFFER, sizeof(quad_vertices), sizeof(quad_normals), quad_normals);
-    glBufferSubData(GL_ARRAY_BUFFER, sizeof(quad_vertices)+ sizeof(quad_normals), sizeof(quad_texCoords), quad_texCoords);
-    
-    glEnableVertexAttribArray(VERTEX_COORD_ATTRIB);
-    glVertexAttribPointer(VERTEX_COORD_ATTRIB, 4, GL_FLOAT, 0, 0, 0);
-    glEnableVertexAttribArray(NORMAL_ATTRIB);
-    glVertexAttribPointer(NORMAL_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)sizeof(quad_vertices));
-    glEnableVertexAttribArray(TEXTURE_COORD_ATTRIB);
-    glVertexAttribPointer(TEXTURE_COORD_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)(sizeof(quad_vertices)+ sizeof(quad_normals)));
-    
-    //index buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VboId[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * amesh.numIndexes, quad_faceIndex , GL_STATIC_DRAW);
-    
-    // unbind the VAO
-    glBindVertexArray(0);
+	const float* streams[ARENA_STREAMS] = { vert, quad_normals, quad_texCoords, NULL };
+	const int sizes[ARENA_STREAMS] = { 4, 4, 4, 4 };
+	meshArenaAdd(amesh, 4, streams, sizes, 2*3, quad_faceIndex);
   
 	amesh.type = GL_TRIANGLES;
+	meshRegistryAdd(key, amesh);
 	return(amesh);
 }
 
 MyMesh createCube() {
 
 	MyMesh amesh;
-	amesh.numIndexes = faceCount *3;
-
-	glGenVertexArrays(1, &(amesh.vao));
-	glBindVertexArray(amesh.vao);
-
-	glGenBuffers(2, VboId);
-	glBindBuffer(GL_ARRAY_BUFFER, VboId[0]);
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices)+sizeof(normals)+sizeof(texCoords)+sizeof(tangents),NULL,GL_STATIC_DRAW);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-		glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices), sizeof(normals), normals);
-		glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices)+ sizeof(normals), sizeof(texCoords), texCoords);
-		glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices)+sizeof(normals)+sizeof(texCoords), sizeof(tangents), tangents);
-
-	glEnableVertexAttribArray(VERTEX_COORD_ATTRIB);
-	glVertexAttribPointer(VERTEX_COORD_ATTRIB, 4, GL_FLOAT, 0, 0, 0);
-	glEnableVertexAttribArray(NORMAL_ATTRIB);
-	glVertexAttribPointer(NORMAL_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)sizeof(vertices));
-	glEnableVertexAttribArray(TEXTURE_COORD_ATTRIB);
-	glVertexAttribPointer(TEXTURE_COORD_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)(sizeof(vertices)+ sizeof(normals)));
-	glEnableVertexAttribArray(TANGENT_ATTRIB);
-	glVertexAttribPointer(TANGENT_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)(sizeof(vertices) + sizeof(normals) + sizeof(texCoords)));
-
-	//index buffer
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VboId[1]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * amesh.numIndexes, faceIndex , GL_STATIC_DRAW);
-
-// unbind the VAO
-	glBindVertexArray(0);
+	if (meshRegistryFind("cube", amesh))
+		return(amesh);
+
+	const float* streams[ARENA_STREAMS] = { vertices, normals, texCoords, tangents };
+	const int sizes[ARENA_STREAMS] = { 4, 4, 4, 4 };
+	meshArenaAdd(amesh, sizeof(vertices) / (4 * sizeof(float)), streams, sizes, faceCount * 3, faceIndex);
 	
 	amesh.type = GL_TRIANGLES;
+	meshRegistryAdd("cube", amesh);
 	return(amesh);
 }
 
 
 MyMesh createSphere(float radius, int divisions) {
 
+	char key[64];
+	MyMesh amesh;
+	snprintf(key, sizeof(key), "sphere %g %d", radius, divisions);
+	if (meshRegistryFind(key, amesh))
+		return(amesh);
+
 	float *p = circularProfile(-3.14159f/2.0f, 3.14159f/2.0f, radius, divisions);
-	return(computeVAO(divisions+1, p+2, p, divisions*2, 0.0f));
+	amesh = computeVAO(divisions+1, p+2, p, divisions*2, 0.0f);
+	free(p);
+	meshRegistryAdd(key, amesh);
+	return(amesh);
 }
 
 
 MyMesh createTorus(float innerRadius, float outerRadius, int rings, int sides) {
 
+	char key[64];
+	MyMesh amesh;
+	snprintf(key, sizeof(key), "torus %g %g %d %d", innerRadius, outerRadius, rings, sides);
+	if (meshRegistryFind(key, amesh))
+		return(amesh);
+
 	float tubeRadius = (outerRadius - innerRadius) * 0.5f;
 	float *p = circularProfile(-3.14159f, 3.14159f, tubeRadius, sides, innerRadius + tubeRadius);
-	return(computeVAO(sides+1, p+2, p, rings, 0.0f));
+	amesh = computeVAO(sides+1, p+2, p, rings, 0.0f);
+	free(p);
+	meshRegistryAdd(key, amesh);
+	return(amesh);
 }
 
 
 MyMesh createCylinder(float height, float radius, int sides) {
 
+	char key[64];
+	MyMesh amesh;
+	snprintf(key, sizeof(key), "cylinder %g %g %d", height, radius, sides);
+	if (meshRegistryFind(key, amesh))
+		return(amesh);
+
 	float p[] = {
 			-radius,	-height*0.5f, 
 			0.0f,		-height*0.5f, 
@@ -131,11 +117,19 @@ MyMesh createCylinder(float height, float radius, int sides) {
 			-radius,	 height*0.5f
 	};
 
-	return(computeVAO(4, p+2, p, sides, 0.0f));
+	amesh = computeVAO(4, p+2, p, sides, 0.0f);
+	meshRegistryAdd(key, amesh);
+	return(amesh);
 }
 
 MyMesh createCone(float height, float baseRadius, int sides) {
 
+	char key[64];
+	MyMesh amesh;
+	snprintf(key, sizeof(key), "cone %g %g %d", height, baseRadius, sides);
+	if (meshRegistryFind(key, amesh))
+		return(amesh);
+
 	float v[2];
 	v[0] = -baseRadius;
 	v[1] = height;
@@ -169,12 +163,18 @@ MyMesh createCone(float height, float baseRadius, int sides) {
 	//		-baseRadius,	height*2.0f,
 	//	};
 
-	return(computeVAO((p.size()-4)/2, &(p[2]), &(p[0]), sides, 0.0f));
+	amesh = computeVAO((p.size()-4)/2, &(p[2]), &(p[0]), sides, 0.0f);
+	meshRegistryAdd(key, amesh);
+	return(amesh);
 }
 
 
 MyMesh createPawn() {
 
+		MyMesh amesh;
+		if (meshRegistryFind("pawn", amesh))
+			return(amesh);
+
 		float p[] = {0.0f, 0.0f, 
 					  0.98f, 0.0f, 
 					  0.98f, 0.01f,
@@ -260,7 +260,10 @@ MyMesh createPawn() {
 											(points[(numPoints-2)*2 + 1] - points[(numPoints-3)*2 + 1]);
 	}
 
-	return(computeVAO(numP, p, points, sides, smoothCos));
+	amesh = computeVAO(numP, p, points, sides, smoothCos);
+	free(points);
+	meshRegistryAdd("pawn", amesh);
+	return(amesh);
 }
 
 MyMesh computeVAO(int numP, float *p, float *points, int sides, float smoothCos) {
@@ -365,32 +368,20 @@ MyMesh computeVAO(int numP, float *p, float *points, int sides, float smoothCos)
 	/* Calculate the tangent array*/
 	ComputeTangentArray(numVertices, vertex, normal, textco, amesh.numIndexes, faceIndex, tangent);
 
-	glGenVertexArrays(1, &(amesh.vao));
-	glBindVertexArray(amesh.vao);
-
-	glGenBuffers(2, VboId);
-	glBindBuffer(GL_ARRAY_BUFFER, VboId[0]);
-	glBufferData(GL_ARRAY_BUFFER, numVertices*sizeof(float)*4*4, NULL,GL_STATIC_DRAW);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices*sizeof(float)*4, vertex);
-		glBufferSubData(GL_ARRAY_BUFFER, numVertices*sizeof(float)*4, numVertices*sizeof(float)*4, normal);
-		glBufferSubData(GL_ARRAY_BUFFER, numVertices*sizeof(float)*4*2, numVertices*sizeof(float)*4, textco);
-		glBufferSubData(GL_ARRAY_BUFFER, numVertices * sizeof(float) * 4 * 3, numVertices * sizeof(float) * 4, tangent);
-
-	glEnableVertexAttribArray(VERTEX_COORD_ATTRIB);
-	glVertexAttribPointer(VERTEX_COORD_ATTRIB, 4, GL_FLOAT, 0, 0, 0);
-	glEnableVertexAttribArray(NORMAL_ATTRIB);
-	glVertexAttribPointer(NORMAL_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)(numVertices*sizeof(float)*4));
-	glEnableVertexAttribArray(TEXTURE_COORD_ATTRIB);
-	glVertexAttribPointer(TEXTURE_COORD_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)(numVertices*sizeof(float)*4*2));
-	glEnableVertexAttribArray(TANGENT_ATTRIB);
-	glVertexAttribPointer(TANGENT_ATTRIB, 4, GL_FLOAT, 0, 0, (void *)(numVertices * sizeof(float) * 4 * 3));
-
-	//index buffer
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VboId[1]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * amesh.numIndexes, faceIndex , GL_STATIC_DRAW);
-
-// unbind the VAO
-	glBindVertexArray(0);
+	// only the rows referenced by the faces go to the arena
+	GLuint usedVertices = 0;
+	for (unsigned int i = 0; i < count; i++)
+		if (faceIndex[i] >= usedVertices) usedVertices = faceIndex[i] + 1;
+
+	const float* streams[ARENA_STREAMS] = { vertex, normal, textco, tangent };
+	const int sizes[ARENA_STREAMS] = { 4, 4, 4, 4 };
+	meshArenaAdd(amesh, usedVertices, streams, sizes, count, faceIndex);
+
+	free(vertex);
+	free(normal);
+	free(textco);
+	free(tangent);
+	free(faceIndex);
 
 	amesh.type = GL_TRIANGLES;
 	return(amesh);
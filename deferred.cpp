@@ -0,0 +1,197 @@
+/* --------------------------------------------------
+Deferred shading
+ *
+ * G-buffer, single sampled at the size of the window:
+ *   0  albedo     RGBA8           diffuse color, a: 1 where a surface was drawn
+ *   1  normal     RGBA16F         eye space, octahedral encoding in xy,
+ *                                 z: reflectivity, w: floor factor of the albedo
+ *   2  specular   RGBA8           specular color, a: shininess / 256
+ *   3  ambient    R11F_G11F_B10F  light that does not depend on the lights of
+ *                                 the pass
+ *   depth         DEPTH24_STENCIL8 eye position comes back through the inverse
+ *                 texture         of the projection
+ *
+ * Depth and stencil start as a copy of the default framebuffer (resolved when
+ * it is multisampled), so what was drawn before hides the objects behind it.
+ * The lighting pass is one triangle over the window. Pixels no surface was
+ * drawn to are discarded, the others write the G-buffer depth with GL_LEQUAL:
+ * it is never behind the depth already there, and it fills every sample of a
+ * multisampled window (the opaque edges are not antialiased in this path).
+----------------------------------------------------*/
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "deferred.h"
+#include "glStateCache.h"
+
+extern float mMatrix[COUNT_MATRICES][16];
+
+#define GBUFFER_TARGETS 4
+
+static GLuint gbufferFBO = 0, targets[GBUFFER_TARGETS], depthTex = 0;
+static GLuint emptyVAO = 0;
+static int targetWidth = 0, targetHeight = 0;
+static bool active = false;
+
+static GLuint lightingProgram = 0;
+static UniformHandle<mat4> invProjection_uniform;
+static UniformHandle<int> target_uniforms[GBUFFER_TARGETS], depth_uniform;
+
+
+// the copy into the G-buffer needs the same depth/stencil format
+static bool defaultDepthStencilMatches() {
+
+	GLint depthBits = 0, stencilBits = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+	if (depthBits != 24 || stencilBits != 8) {
+		printf("Deferred: cannot copy the default depth/stencil buffer (%d/%d bits, 24/8 needed)\n", depthBits, stencilBits);
+		return false;
+	}
+	return true;
+}
+
+
+static bool createTargets(int width, int height) {
+
+	static const GLenum formats[GBUFFER_TARGETS] = { GL_RGBA8, GL_RGBA16F, GL_RGBA8, GL_R11F_G11F_B10F };
+	static const GLenum drawBuffers[GBUFFER_TARGETS] = {
+		GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+
+	if (!defaultDepthStencilMatches())
+		return false;
+
+	if (gbufferFBO) {
+		glDeleteTextures(GBUFFER_TARGETS, targets);
+		glDeleteTextures(1, &depthTex);
+		glDeleteFramebuffers(1, &gbufferFBO);
+		stateInvalidate();	// the deleted names may come back from glGenTextures
+	}
+
+	targetWidth = width;
+	targetHeight = height;
+
+	glGenFramebuffers(1, &gbufferFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbufferFBO);
+
+	glGenTextures(GBUFFER_TARGETS, targets);
+	for (int i = 0; i < GBUFFER_TARGETS; i++) {
+		stateBindTexture(GL_TEXTURE_2D, targets[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, targets[i], 0);
+	}
+
+	glGenTextures(1, &depthTex);
+	stateBindTexture(GL_TEXTURE_2D, depthTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+	stateBindTexture(GL_TEXTURE_2D, 0);
+
+	glDrawBuffers(GBUFFER_TARGETS, drawBuffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("G-buffer framebuffer incomplete (0x%x)\n", status);
+		glDeleteTextures(GBUFFER_TARGETS, targets);
+		glDeleteTextures(1, &depthTex);
+		glDeleteFramebuffers(1, &gbufferFBO);
+		stateInvalidate();
+		gbufferFBO = depthTex = 0;
+		return false;
+	}
+	return true;
+}
+
+
+void deferredInit(VSShaderLib& lighting) {
+
+	static const char* targetNames[GBUFFER_TARGETS] = { "gAlbedo", "gNormal", "gSpecular", "gAmbient" };
+
+	lightingProgram = lighting.getProgramIndex();
+	invProjection_uniform = lighting.getUniform<mat4>("m_invProjection");
+	for (int i = 0; i < GBUFFER_TARGETS; i++)
+		target_uniforms[i] = lighting.getUniform<int>(targetNames[i]);
+	depth_uniform = lighting.getUniform<int>("gDepth");
+
+	targetWidth = targetHeight = 0;
+	glGenVertexArrays(1, &emptyVAO);
+}
+
+
+bool deferredBegin(int width, int height) {
+
+	if (width != targetWidth || height != targetHeight || !gbufferFBO) {
+		if (!createTargets(width, height))
+			return false;
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbufferFBO);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbufferFBO);
+	stateViewport(0, 0, width, height);
+	stateDepthMask(GL_TRUE);
+
+	// only the albedo alpha tells the lighting pass a surface is there
+	const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearBufferfv(GL_COLOR, 0, zero);
+	active = true;
+	return true;
+}
+
+
+void deferredEnd() {
+
+	active = false;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	float invProjection[16];
+	if (!invertMatrix(mMatrix[PROJECTION], invProjection))
+		setIdentityMatrix(invProjection, 4);
+
+	stateUseProgram(lightingProgram);
+	invProjection_uniform.set(invProjection);
+	for (int i = 0; i < GBUFFER_TARGETS; i++) {
+		stateActiveTexture(GL_TEXTURE0 + i);
+		stateBindTexture(GL_TEXTURE_2D, targets[i]);
+		target_uniforms[i].set(i);
+	}
+	stateActiveTexture(GL_TEXTURE0 + GBUFFER_TARGETS);
+	stateBindTexture(GL_TEXTURE_2D, depthTex);
+	depth_uniform.set(GBUFFER_TARGETS);
+
+	GLboolean depthMaskWas = stateGetDepthMask();
+	GLenum depthFuncWas = stateGetDepthFunc();
+	bool cullWasEnabled = stateIsEnabled(GL_CULL_FACE);
+	stateDepthMask(GL_TRUE);
+	stateDisable(GL_CULL_FACE);
+	stateDisable(GL_BLEND);
+	stateDepthFunc(GL_LEQUAL);
+
+	stateBindVertexArray(emptyVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	stateDepthFunc(depthFuncWas);
+	stateDepthMask(depthMaskWas);
+	if (cullWasEnabled) stateEnable(GL_CULL_FACE);
+
+	for (int i = GBUFFER_TARGETS; i >= 0; i--) {
+		stateActiveTexture(GL_TEXTURE0 + i);
+		stateBindTexture(GL_TEXTURE_2D, 0);
+	}
+}
+
+
+bool deferredActive() {
+
+	return active;
+}
@@ -0,0 +1,26 @@
+#ifndef __DEFERRED_H
+#define __DEFERRED_H
+
+#include "VSShaderlib.h"
+
+/* --- Functions --- */
+
+// Deferred shading of the opaque objects of the main view.
+// Between deferredBegin and deferredEnd the G-buffer variant of the phong shader
+// stores the surface of every pixel; deferredEnd then shades each covered pixel
+// once with all the lights of the Lights block, fog included, into the default
+// framebuffer. The G-buffer is depth tested against what the default framebuffer
+// already holds (the water and the mirrored scene), and the lighting pass writes
+// depth as well, so the sky and the blended objects are drawn forward after it
+// as before.
+
+// `lighting` shades the G-buffer (shaders/deferred_light.*)
+void deferredInit(VSShaderLib& lighting);
+// binds and clears the G-buffer for a window of width x height; returns false (and
+// leaves the default framebuffer bound) if it cannot be created
+bool deferredBegin(int width, int height);
+// lighting pass for the current PROJECTION the G-buffer was drawn with
+void deferredEnd();
+bool deferredActive();
+
+#endif
@@ -0,0 +1,126 @@
+/* --------------------------------------------------
+Environment probe
+ *
+ * An RGBA8 cube map with a few mip levels and a shared depth renderbuffer.
+ * A face is attached to the framebuffer and rendered with a 90 degree
+ * perspective. The up vectors follow the cube map convention (faces are
+ * addressed from their upper left corner), so no image is flipped.
+ *
+ * glGenerateMipmap box filters the whole chain; seamless cube map filtering
+ * (enabled at init) blends across the face edges when the blurrier levels
+ * are sampled.
+----------------------------------------------------*/
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "envProbe.h"
+#include "glStateCache.h"
+
+static GLuint probeFBO = 0, cubeTex = 0, depthBuffer = 0, fallbackTex = 0;
+static int probeSize = 0, probeLevels = 1;
+static int nextFace = 0, facesDone = 0;
+
+static const float faceDir[6][3] = {
+	{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+static const float faceUp[6][3] = {
+	{ 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+
+
+bool envProbeInit(int size, int levels, GLuint fallback) {
+
+	probeSize = size;
+	probeLevels = levels;
+	fallbackTex = fallback;
+
+	glGenTextures(1, &cubeTex);
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, cubeTex);
+	glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, GL_RGBA8, size, size);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &probeFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, probeFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, cubeTex, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Environment probe framebuffer incomplete (0x%x)\n", status);
+		return false;
+	}
+	return true;
+}
+
+
+int envProbeLevels() {
+
+	return probeLevels;
+}
+
+
+int envProbeBeginFace(const float centre[3]) {
+
+	int face = nextFace;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, probeFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubeTex, 0);
+	stateViewport(0, 0, probeSize, probeSize);
+	stateDepthMask(GL_TRUE);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	pushMatrix(PROJECTION);
+	loadIdentity(PROJECTION);
+	perspective(90.0f, 1.0f, 0.1f, 1000.0f);
+
+	pushMatrix(VIEW);
+	loadIdentity(VIEW);
+	lookAt(centre[0], centre[1], centre[2],
+		centre[0] + faceDir[face][0], centre[1] + faceDir[face][1], centre[2] + faceDir[face][2],
+		faceUp[face][0], faceUp[face][1], faceUp[face][2]);
+	return face;
+}
+
+
+void envProbeEndFace() {
+
+	popMatrix(VIEW);
+	popMatrix(PROJECTION);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, cubeTex);
+	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	nextFace = (nextFace + 1) % 6;
+	if (facesDone < 6)
+		facesDone++;
+}
+
+
+void envProbeBindTexture() {
+
+	stateActiveTexture(GL_TEXTURE0 + ENV_PROBE_TEXTURE_UNIT);
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, facesDone < 6 ? fallbackTex : cubeTex);
+	stateActiveTexture(GL_TEXTURE0);
+}
+
+
+void envProbeUnbindTexture() {
+
+	stateActiveTexture(GL_TEXTURE0 + ENV_PROBE_TEXTURE_UNIT);
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	stateActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,34 @@
+#ifndef __ENV_PROBE_H
+#define __ENV_PROBE_H
+
+#include <GL/glew.h>
+
+/* --- Defines --- */
+
+// texture unit of the environment cube map (the planar reflection takes 14)
+#define ENV_PROBE_TEXTURE_UNIT 15
+
+/* --- Functions --- */
+
+// Dynamic environment cube map around a point (the boat). Each frame renders
+// one face only, round robin, so the probe costs a bounded part of a frame
+// and is fully refreshed every 6 frames. The mip chain is rebuilt after each
+// face and sampled by roughness. Until the six faces have been rendered once,
+// the fallback cube map (the skybox) stands in for it.
+
+// size x size faces with `levels` mip levels; false if the framebuffer cannot be made
+bool envProbeInit(int size, int levels, GLuint fallback);
+int  envProbeLevels();
+
+// binds the next face as render target, with PROJECTION and VIEW (both pushed)
+// looking out of it from `centre`; returns the face, 0..5
+int  envProbeBeginFace(const float centre[3]);
+// restores the matrices and the default framebuffer and filters the mip levels
+void envProbeEndFace();
+
+// the probe, or the fallback while incomplete, on ENV_PROBE_TEXTURE_UNIT
+void envProbeBindTexture();
+// nothing on ENV_PROBE_TEXTURE_UNIT, while a face is being rendered
+void envProbeUnbindTexture();
+
+#endif
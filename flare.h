@@ -14,6 +14,7 @@ typedef struct FLARE_ELEMENT_DEF {
     float           fSize;            // Size relative to flare envelope (0.0-1.0)
 	float			matDiffuse[4];  // color
 	int				textureId;	
+	int				materialId;	// matDiffuse in the material table
 } FLARE_ELEMENT_DEF;
 
 typedef struct FLARE_DEF {
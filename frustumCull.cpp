@@ -0,0 +1,119 @@
+/* --------------------------------------------------
+View frustum culling
+ *
+ * The six planes are extracted from the rows of PROJECTION * VIEW (Gribb and
+ * Hartmann) and normalized, so the signed distance of a world space point is
+ * one dot product. The centre of a sphere goes through MODEL and its radius
+ * is scaled by the longest MODEL axis, which keeps the test conservative for
+ * non uniform scales and mirrors.
+----------------------------------------------------*/
+#include <math.h>
+#include <string.h>
+
+#include "AVTmathLib.h"
+#include "geometry.h"
+#include "frustumCull.h"
+
+extern float mMatrix[COUNT_MATRICES][16];
+
+static float planes[6][4];
+static bool enabled = true;
+static CULL_PASS current = CULL_PASS_MAIN;
+static CULL_STATS counting[CULL_PASSES], counted[CULL_PASSES];
+
+
+void cullBeginFrame() {
+
+	memcpy(counted, counting, sizeof(counting));
+	memset(counting, 0, sizeof(counting));
+}
+
+
+void cullBeginPass(CULL_PASS pass) {
+
+	float pv[16];
+	memcpy(pv, mMatrix[PROJECTION], sizeof(pv));
+	multMatrix(pv, mMatrix[VIEW]);
+
+	// clip = pv * p; row i of the column major matrix is pv[i], pv[4 + i], ...
+	for (int p = 0; p < 6; p++) {
+		int row = p / 2;
+		float sign = (p & 1) ? -1.0f : 1.0f;
+		for (int c = 0; c < 4; c++)
+			planes[p][c] = pv[c * 4 + 3] + sign * pv[c * 4 + row];
+		float len = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+		if (len > 0.0f)
+			for (int c = 0; c < 4; c++)
+				planes[p][c] /= len;
+	}
+	current = pass;
+}
+
+
+void cullSetEnabled(bool on) {
+
+	enabled = on;
+}
+
+
+bool cullEnabled() {
+
+	return enabled;
+}
+
+
+static bool inside(const float centre[3], float radius) {
+
+	if (!enabled)
+		return true;
+
+	const float* m = mMatrix[MODEL];
+	float world[3], scale = 0.0f;
+	for (int r = 0; r < 3; r++)
+		world[r] = m[r] * centre[0] + m[4 + r] * centre[1] + m[8 + r] * centre[2] + m[12 + r];
+	for (int c = 0; c < 3; c++) {
+		float axis = m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2];
+		if (axis > scale)
+			scale = axis;
+	}
+	radius *= sqrtf(scale);
+
+	for (int p = 0; p < 6; p++)
+		if (planes[p][0] * world[0] + planes[p][1] * world[1] + planes[p][2] * world[2] + planes[p][3] < -radius)
+			return false;
+	return true;
+}
+
+
+bool cullSphere(const float centre[3], float radius) {
+
+	bool visible = inside(centre, radius);
+	if (visible)
+		counting[current].visible++;
+	else
+		counting[current].culled++;
+	return visible;
+}
+
+
+bool cullMesh(const struct MyMesh& mesh) {
+
+	return cullSphere(mesh.bounds, mesh.bounds[3]);
+}
+
+
+bool cullParticles(const float centre[3], float radius, int count) {
+
+	bool visible = inside(centre, radius);
+	if (visible)
+		counting[current].particlesVisible += count;
+	else
+		counting[current].particlesCulled += count;
+	return visible;
+}
+
+
+const CULL_STATS& cullStats(CULL_PASS pass) {
+
+	return counted[pass];
+}
@@ -0,0 +1,43 @@
+#ifndef __FRUSTUM_CULL_H
+#define __FRUSTUM_CULL_H
+
+struct MyMesh;	// geometry.h
+
+/* --- Defines --- */
+
+// render passes of a frame, counted apart
+#define CULL_PASSES 5
+
+/* --- Types --- */
+
+typedef enum { CULL_PASS_MIRRORED, CULL_PASS_MAIN, CULL_PASS_REAR_MIRRORED, CULL_PASS_REAR, CULL_PASS_PROBE } CULL_PASS;
+
+typedef struct {
+	int		visible, culled;						// objects
+	int		particlesVisible, particlesCulled;
+} CULL_STATS;
+
+/* --- Functions --- */
+
+// View frustum culling of bounding spheres, tested before anything is sent to GL.
+// The planes come from PROJECTION * VIEW when a pass starts; a sphere is moved to
+// world space with the current MODEL, which may scale and mirror it.
+
+// statistics of the frame just drawn become those returned by cullStats
+void cullBeginFrame();
+// call once PROJECTION and VIEW hold the camera of the pass
+void cullBeginPass(CULL_PASS pass);
+// disabled, every test passes, but it is still counted
+void cullSetEnabled(bool on);
+bool cullEnabled();
+
+// false if the sphere, in MODEL coordinates, is outside the frustum
+bool cullSphere(const float centre[3], float radius);
+bool cullMesh(const struct MyMesh& mesh);
+// `count` particles inside a sphere in MODEL coordinates
+bool cullParticles(const float centre[3], float radius, int count);
+
+// counts of the last complete frame
+const CULL_STATS& cullStats(CULL_PASS pass);
+
+#endif
@@ -14,12 +14,16 @@ struct Material{
 // A model can be made of many meshes. Each is stored  in the following structure
 struct MyMesh {
 		GLuint vao;
+		GLuint firstIndex;	// range in the mesh arena (meshArena.h)
+		GLint baseVertex;
 		GLuint texUnits[MAX_TEXTURES];
 		texType texTypes[4];
 		float transform[16];
 		GLuint numIndexes;
 		unsigned int type;
 		struct Material mat;
+		int materialId;		// index in the material table (materials.h)
+		float bounds[4];	// bounding sphere in model space: centre, radius
 	};
 
 MyMesh createCube();
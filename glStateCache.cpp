@@ -0,0 +1,341 @@
+/* --------------------------------------------------
+GL state cache
+ *
+ * Every value starts unknown (-1 or UNKNOWN) after stateInvalidate, so the
+ * first call always reaches GL and later identical calls are dropped.
+----------------------------------------------------*/
+#include <string.h>
+
+#include "glStateCache.h"
+
+#define UNKNOWN 0xFFFFFFFFu
+
+enum { CAP_BLEND, CAP_DEPTH_TEST, CAP_CULL_FACE, CAP_STENCIL_TEST, CAP_MULTISAMPLE, COUNT_CAPS };
+enum { TEX_2D, TEX_2D_MULTISAMPLE, TEX_CUBE_MAP, COUNT_TEXTURE_TARGETS };
+
+static struct {
+	int		caps[COUNT_CAPS];		// -1 unknown, 0, 1
+	GLenum	blendSrc, blendDst;
+	int		depthMask;
+	GLenum	depthFunc;
+	GLenum	cullFace;
+	GLenum	stencilFunc;
+	GLint	stencilRef;
+	GLuint	stencilMask;
+	GLenum	stencilOp[3];
+	GLenum	activeTexture;
+	GLuint	textures[STATE_TEXTURE_UNITS][COUNT_TEXTURE_TARGETS];
+	GLuint	vao;
+	GLuint	program;
+	GLint	viewport[4];
+	bool	viewportKnown;
+} s;
+
+static int avoided = 0;
+static bool initialized = false;
+
+
+static int capIndex(GLenum cap) {
+
+	switch (cap) {
+		case GL_BLEND: return CAP_BLEND;
+		case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+		case GL_CULL_FACE: return CAP_CULL_FACE;
+		case GL_STENCIL_TEST: return CAP_STENCIL_TEST;
+		case GL_MULTISAMPLE: return CAP_MULTISAMPLE;
+		default: return -1;
+	}
+}
+
+
+static int targetIndex(GLenum target) {
+
+	switch (target) {
+		case GL_TEXTURE_2D: return TEX_2D;
+		case GL_TEXTURE_2D_MULTISAMPLE: return TEX_2D_MULTISAMPLE;
+		case GL_TEXTURE_CUBE_MAP: return TEX_CUBE_MAP;
+		default: return -1;
+	}
+}
+
+
+void stateInvalidate() {
+
+	for (int i = 0; i < COUNT_CAPS; i++)
+		s.caps[i] = -1;
+	s.blendSrc = s.blendDst = UNKNOWN;
+	s.depthMask = -1;
+	s.depthFunc = UNKNOWN;
+	s.cullFace = UNKNOWN;
+	s.stencilFunc = UNKNOWN;
+	s.stencilOp[0] = s.stencilOp[1] = s.stencilOp[2] = UNKNOWN;
+	s.activeTexture = UNKNOWN;
+	memset(s.textures, 0xFF, sizeof(s.textures));
+	s.vao = UNKNOWN;
+	s.program = UNKNOWN;
+	s.viewportKnown = false;
+	initialized = true;
+}
+
+
+static void setCap(GLenum cap, int on) {
+
+	if (!initialized) stateInvalidate();
+
+	int i = capIndex(cap);
+	if (i >= 0 && s.caps[i] == on) {
+		avoided++;
+		return;
+	}
+	if (on) glEnable(cap);
+	else glDisable(cap);
+	if (i >= 0) s.caps[i] = on;
+}
+
+
+void stateEnable(GLenum cap) {
+
+	setCap(cap, 1);
+}
+
+
+void stateDisable(GLenum cap) {
+
+	setCap(cap, 0);
+}
+
+
+bool stateIsEnabled(GLenum cap) {
+
+	if (!initialized) stateInvalidate();
+
+	int i = capIndex(cap);
+	if (i >= 0 && s.caps[i] != -1) {
+		avoided++;
+		return s.caps[i] == 1;
+	}
+	bool on = glIsEnabled(cap) == GL_TRUE;
+	if (i >= 0) s.caps[i] = on;
+	return on;
+}
+
+
+void stateBlendFunc(GLenum src, GLenum dst) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.blendSrc == src && s.blendDst == dst) {
+		avoided++;
+		return;
+	}
+	glBlendFunc(src, dst);
+	s.blendSrc = src;
+	s.blendDst = dst;
+}
+
+
+void stateBlendFunci(GLuint buf, GLenum src, GLenum dst) {
+
+	if (!initialized) stateInvalidate();
+
+	glBlendFunci(buf, src, dst);
+	s.blendSrc = s.blendDst = UNKNOWN;
+}
+
+
+void stateDepthMask(GLboolean flag) {
+
+	if (!initialized) stateInvalidate();
+
+	int on = flag ? 1 : 0;
+	if (s.depthMask == on) {
+		avoided++;
+		return;
+	}
+	glDepthMask(flag);
+	s.depthMask = on;
+}
+
+
+GLboolean stateGetDepthMask() {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.depthMask == -1) {
+		GLboolean flag;
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &flag);
+		s.depthMask = flag ? 1 : 0;
+	}
+	else
+		avoided++;
+	return s.depthMask ? GL_TRUE : GL_FALSE;
+}
+
+
+void stateDepthFunc(GLenum func) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.depthFunc == func) {
+		avoided++;
+		return;
+	}
+	glDepthFunc(func);
+	s.depthFunc = func;
+}
+
+
+GLenum stateGetDepthFunc() {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.depthFunc == UNKNOWN) {
+		GLint func;
+		glGetIntegerv(GL_DEPTH_FUNC, &func);
+		s.depthFunc = (GLenum)func;
+	}
+	else
+		avoided++;
+	return s.depthFunc;
+}
+
+
+void stateCullFace(GLenum mode) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.cullFace == mode) {
+		avoided++;
+		return;
+	}
+	glCullFace(mode);
+	s.cullFace = mode;
+}
+
+
+void stateStencilFunc(GLenum func, GLint ref, GLuint mask) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.stencilFunc == func && s.stencilRef == ref && s.stencilMask == mask) {
+		avoided++;
+		return;
+	}
+	glStencilFunc(func, ref, mask);
+	s.stencilFunc = func;
+	s.stencilRef = ref;
+	s.stencilMask = mask;
+}
+
+
+void stateStencilOp(GLenum sfail, GLenum dpfail, GLenum dppass) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.stencilOp[0] == sfail && s.stencilOp[1] == dpfail && s.stencilOp[2] == dppass) {
+		avoided++;
+		return;
+	}
+	glStencilOp(sfail, dpfail, dppass);
+	s.stencilOp[0] = sfail;
+	s.stencilOp[1] = dpfail;
+	s.stencilOp[2] = dppass;
+}
+
+
+void stateActiveTexture(GLenum unit) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.activeTexture == unit) {
+		avoided++;
+		return;
+	}
+	glActiveTexture(unit);
+	s.activeTexture = unit;
+}
+
+
+void stateBindTexture(GLenum target, GLuint texture) {
+
+	if (!initialized) stateInvalidate();
+
+	int t = targetIndex(target);
+	int unit = s.activeTexture == UNKNOWN ? -1 : (int)(s.activeTexture - GL_TEXTURE0);
+	if (t < 0 || unit < 0 || unit >= STATE_TEXTURE_UNITS) {
+		glBindTexture(target, texture);
+		return;
+	}
+	if (s.textures[unit][t] == texture) {
+		avoided++;
+		return;
+	}
+	glBindTexture(target, texture);
+	s.textures[unit][t] = texture;
+}
+
+
+void stateBindVertexArray(GLuint vao) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.vao == vao) {
+		avoided++;
+		return;
+	}
+	glBindVertexArray(vao);
+	s.vao = vao;
+}
+
+
+void stateUseProgram(GLuint program) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.program == program) {
+		avoided++;
+		return;
+	}
+	glUseProgram(program);
+	s.program = program;
+}
+
+
+void stateViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+
+	if (!initialized) stateInvalidate();
+
+	if (s.viewportKnown && s.viewport[0] == x && s.viewport[1] == y &&
+		s.viewport[2] == width && s.viewport[3] == height) {
+		avoided++;
+		return;
+	}
+	glViewport(x, y, width, height);
+	s.viewport[0] = x;
+	s.viewport[1] = y;
+	s.viewport[2] = width;
+	s.viewport[3] = height;
+	s.viewportKnown = true;
+}
+
+
+void stateGetViewport(GLint viewport[4]) {
+
+	if (!initialized) stateInvalidate();
+
+	if (!s.viewportKnown) {
+		glGetIntegerv(GL_VIEWPORT, s.viewport);
+		s.viewportKnown = true;
+	}
+	else
+		avoided++;
+	memcpy(viewport, s.viewport, 4 * sizeof(GLint));
+}
+
+
+int stateResetAvoided() {
+
+	int n = avoided;
+	avoided = 0;
+	return n;
+}
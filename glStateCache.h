@@ -0,0 +1,46 @@
+#ifndef __GL_STATE_CACHE_H
+#define __GL_STATE_CACHE_H
+
+#include <GL/glew.h>
+
+/* --- Defines --- */
+
+#define STATE_TEXTURE_UNITS 16
+
+/* --- Functions --- */
+
+// Shadow copy of the GL state changed while drawing. Calls that would not change
+// anything are skipped (and counted), queries are answered from the copy.
+// Anything not known yet goes to GL once; code changing this state behind the
+// cache (loaders, deletes) must call stateInvalidate afterwards.
+
+void stateInvalidate();
+
+void stateEnable(GLenum cap);
+void stateDisable(GLenum cap);
+bool stateIsEnabled(GLenum cap);
+
+void stateBlendFunc(GLenum src, GLenum dst);
+// per draw buffer blending; the state of stateBlendFunc is unknown afterwards
+void stateBlendFunci(GLuint buf, GLenum src, GLenum dst);
+void stateDepthMask(GLboolean flag);
+GLboolean stateGetDepthMask();
+void stateDepthFunc(GLenum func);
+GLenum stateGetDepthFunc();
+void stateCullFace(GLenum mode);
+void stateStencilFunc(GLenum func, GLint ref, GLuint mask);
+void stateStencilOp(GLenum sfail, GLenum dpfail, GLenum dppass);
+
+void stateActiveTexture(GLenum unit);
+// on the active unit
+void stateBindTexture(GLenum target, GLuint texture);
+void stateBindVertexArray(GLuint vao);
+void stateUseProgram(GLuint program);
+
+void stateViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void stateGetViewport(GLint viewport[4]);
+
+// GL calls skipped since the last call
+int  stateResetAvoided();
+
+#endif
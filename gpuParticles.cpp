@@ -0,0 +1,227 @@
+/* --------------------------------------------------
+Compute shader particle simulation
+ *
+ * Particle state lives in two SSBOs used ping-pong: shaders/particles.comp
+ * reads the live particles of one, integrates and ages them, spawns the queued
+ * bursts and appends the survivors to the other. The append counter is the
+ * instanceCount of a DrawArraysIndirect command, so the number of particles
+ * drawn never goes through the CPU.
+ *
+ * Spawns come from the ParticleSystem in deferred mode, which applies the
+ * emitter caps and spawn budgets and estimates live counts from the fade.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "gpuParticles.h"
+#include "particleRenderer.h"
+#include "glStateCache.h"
+
+typedef struct {
+	float	origin[4];
+	float	velocity[4];	// xyz + spread
+	float	speed[2];
+	int		emitter;
+	int		count;
+} GPU_SPAWN_REQUEST;		// std430 SpawnRequest
+
+typedef struct {
+	GLuint	count;
+	GLuint	instanceCount;
+	GLuint	first;
+	GLuint	baseInstance;
+} GPU_DRAW_COMMAND;
+
+static GLuint simProgram = 0;
+static UniformHandle<int> srcCmd_uniform, dstCmd_uniform, capacity_uniform, spawnRequests_uniform, steps_uniform;
+static UniformHandle<float> h_uniform;
+static UniformHandle<unsigned int> seed_uniform;
+
+static GLuint stateBuffer[2], instanceBuffer, emitterBuffer, spawnBuffer, cmdBuffer;
+static GLuint gpuVAO = 0;
+static int gpuCapacity = 0;
+static int current = 0;			// state buffer and command holding the live particles
+
+static std::vector<GPU_SPAWN_REQUEST> pendingSpawns;
+static unsigned int frameSeed = 1;
+
+
+bool gpuParticlesInit(VSShaderLib& simShader, int maxParticles, const std::vector<PARTICLE_EMITTER>& emitters) {
+
+	if (!GLEW_VERSION_4_3 && !GLEW_ARB_compute_shader) {
+		printf("Particles: compute shaders not available, using the CPU simulation\n");
+		return false;
+	}
+	if (!simShader.isProgramLinked()) {
+		printf("Particles: simulation shader did not link, using the CPU simulation\n%s\n", simShader.getAllInfoLogs().c_str());
+		return false;
+	}
+
+	simProgram = simShader.getProgramIndex();
+	srcCmd_uniform = simShader.getUniform<int>("srcCmd");
+	dstCmd_uniform = simShader.getUniform<int>("dstCmd");
+	capacity_uniform = simShader.getUniform<int>("capacity");
+	spawnRequests_uniform = simShader.getUniform<int>("spawnRequests");
+	h_uniform = simShader.getUniform<float>("h");
+	steps_uniform = simShader.getUniform<int>("steps");
+	seed_uniform = simShader.getUniform<unsigned int>("seed");
+
+	gpuCapacity = maxParticles;
+	GLsizeiptr particleBytes = (GLsizeiptr)maxParticles * PARTICLE_INSTANCE_FLOATS * sizeof(float);
+
+	glGenBuffers(2, stateBuffer);
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateBuffer[i]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, particleBytes, NULL, GL_DYNAMIC_COPY);
+	}
+
+	glGenBuffers(1, &emitterBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, emitterBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, GPU_PARTICLE_MAX_EMITTERS * 8 * sizeof(float), NULL, GL_STATIC_DRAW);
+	gpuParticlesSetEmitters(emitters);
+
+	glGenBuffers(1, &spawnBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, spawnBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, GPU_PARTICLE_MAX_SPAWNS * sizeof(GPU_SPAWN_REQUEST), NULL, GL_STREAM_DRAW);
+
+	GPU_DRAW_COMMAND cmd[2] = { { 4, 0, 0, 0 }, { 4, 0, 0, 0 } };
+	glGenBuffers(1, &cmdBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cmdBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(cmd), cmd, GL_DYNAMIC_COPY);
+
+	// instances written by the compute shader, read by particle.vert with the same layout as the CPU ring
+	glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, particleBytes, NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glGenVertexArrays(1, &gpuVAO);
+	stateBindVertexArray(gpuVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	GLsizei stride = PARTICLE_INSTANCE_FLOATS * sizeof(float);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, 0);
+	glVertexAttribDivisor(0, 1);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)(4 * sizeof(float)));
+	glVertexAttribDivisor(1, 1);
+	stateBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return true;
+}
+
+
+void gpuParticlesSetEmitters(const std::vector<PARTICLE_EMITTER>& emitters) {
+
+	float data[GPU_PARTICLE_MAX_EMITTERS][8];
+	int n = (int)emitters.size();
+	if (n > GPU_PARTICLE_MAX_EMITTERS) n = GPU_PARTICLE_MAX_EMITTERS;
+
+	for (int i = 0; i < n; i++) {
+		const PARTICLE_EMITTER& e = emitters[i];
+		memcpy(data[i], e.color, 3 * sizeof(float));
+		data[i][3] = e.size;
+		memcpy(data[i] + 4, e.accel, 3 * sizeof(float));
+		data[i][7] = e.fade;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, emitterBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, n * sizeof(data[0]), data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+
+void gpuParticlesSpawn(const std::vector<PARTICLE_SPAWN>& spawns) {
+
+	for (const PARTICLE_SPAWN& s : spawns) {
+		if (pendingSpawns.size() >= GPU_PARTICLE_MAX_SPAWNS) {
+			printf("Particles: more than %d spawns in one step, dropping the rest\n", GPU_PARTICLE_MAX_SPAWNS);
+			return;
+		}
+
+		GPU_SPAWN_REQUEST r;
+		memcpy(r.origin, s.origin, 3 * sizeof(float));
+		r.origin[3] = 1.0f;
+		memcpy(r.velocity, s.velocity, 3 * sizeof(float));
+		r.velocity[3] = s.spread;
+		r.speed[0] = s.minSpeed;
+		r.speed[1] = s.maxSpeed;
+		r.emitter = s.emitter;
+		r.count = s.count;
+		pendingSpawns.push_back(r);
+	}
+}
+
+
+void gpuParticlesClear() {
+
+	GLuint zero[2] = { 0, 0 };
+
+	// instanceCount of both commands
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cmdBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(GPU_DRAW_COMMAND, instanceCount), sizeof(GLuint), &zero[0]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GPU_DRAW_COMMAND) + offsetof(GPU_DRAW_COMMAND, instanceCount), sizeof(GLuint), &zero[1]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	pendingSpawns.clear();
+}
+
+
+void gpuParticlesSimulate(float h, int steps) {
+
+	int dst = 1 - current;
+	int spawnTotal = 0;
+	GLuint zero = 0;
+
+	for (const GPU_SPAWN_REQUEST& r : pendingSpawns)
+		spawnTotal += r.count;
+
+	// the survivors are appended from zero
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cmdBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, dst * sizeof(GPU_DRAW_COMMAND) + offsetof(GPU_DRAW_COMMAND, instanceCount), sizeof(GLuint), &zero);
+	if (!pendingSpawns.empty()) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, spawnBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, pendingSpawns.size() * sizeof(GPU_SPAWN_REQUEST), pendingSpawns.data());
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, stateBuffer[current]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, stateBuffer[dst]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, emitterBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, spawnBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, cmdBuffer);
+
+	stateUseProgram(simProgram);
+	srcCmd_uniform.set(current);
+	dstCmd_uniform.set(dst);
+	capacity_uniform.set(gpuCapacity);
+	spawnRequests_uniform.set((GLint)pendingSpawns.size());
+	h_uniform.set(h);
+	steps_uniform.set(steps);
+	seed_uniform.set(frameSeed++ * 2654435761u);
+
+	// the live count is only known on the GPU, so cover the whole pool plus the spawns
+	int invocations = gpuCapacity + spawnTotal;
+	glDispatchCompute((invocations + GPU_PARTICLE_GROUP_SIZE - 1) / GPU_PARTICLE_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+		GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	pendingSpawns.clear();
+	current = dst;
+}
+
+
+void gpuParticlesDraw(GLuint texture) {
+
+	particleRendererBegin(texture);
+	stateBindVertexArray(gpuVAO);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cmdBuffer);
+	glDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)(current * sizeof(GPU_DRAW_COMMAND)));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	particleRendererEnd();
+}
+
@@ -0,0 +1,28 @@
+#ifndef __GPU_PARTICLES_H
+#define __GPU_PARTICLES_H
+
+#include <vector>
+
+#include "VSShaderlib.h"
+#include "particles.h"
+
+/* --- Defines --- */
+
+#define GPU_PARTICLE_GROUP_SIZE 64		// local_size_x of shaders/particles.comp
+#define GPU_PARTICLE_MAX_EMITTERS 16
+#define GPU_PARTICLE_MAX_SPAWNS 64		// spawn requests consumed per simulation step
+
+/* --- Functions --- */
+
+// returns false when compute shaders are not available; the CPU ParticleSystem is then used
+bool gpuParticlesInit(VSShaderLib& simShader, int maxParticles, const std::vector<PARTICLE_EMITTER>& emitters);
+void gpuParticlesSetEmitters(const std::vector<PARTICLE_EMITTER>& emitters);
+// spawns queued by a deferred ParticleSystem, created by the next gpuParticlesSimulate
+void gpuParticlesSpawn(const std::vector<PARTICLE_SPAWN>& spawns);
+void gpuParticlesClear();
+// integrates `steps` Euler steps of size h; spawns, aging and the draw count stay on the GPU
+void gpuParticlesSimulate(float h, int steps);
+// with the shader of particleRendererInit
+void gpuParticlesDraw(GLuint texture);
+
+#endif
@@ -0,0 +1,105 @@
+/* --------------------------------------------------
+GPU timers
+ *
+ * Each timer owns GPU_TIMER_LATENCY pairs of timestamp queries, used in turn
+ * frame after frame. A pair is read at gpuTimerEndFrame when its end query is
+ * available; one still pending when its turn comes again is dropped, never
+ * waited for.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "gpuTimer.h"
+
+typedef struct {
+	char	name[32];
+	GLuint	queries[GPU_TIMER_LATENCY][2];	// begin, end
+	bool	pending[GPU_TIMER_LATENCY];
+	int		current;
+	double	ms;
+	bool	measured;
+} GPU_TIMER;
+
+static GPU_TIMER timers[GPU_TIMERS];
+static int timerCount = 0;
+
+
+int gpuTimerCreate(const char* name) {
+
+	if (timerCount == GPU_TIMERS)
+		return -1;
+
+	GLint bits = 0;
+	glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+	if (bits == 0) {
+		printf("GPU timers: timestamp queries not supported\n");
+		return -1;
+	}
+
+	GPU_TIMER& t = timers[timerCount];
+	memset(&t, 0, sizeof(t));
+	strncpy(t.name, name, sizeof(t.name) - 1);
+	glGenQueries(2 * GPU_TIMER_LATENCY, &t.queries[0][0]);
+	return timerCount++;
+}
+
+
+void gpuTimerBegin(int timer) {
+
+	if (timer < 0)
+		return;
+
+	GPU_TIMER& t = timers[timer];
+	t.pending[t.current] = false;	// its result did not come back in time
+	glQueryCounter(t.queries[t.current][0], GL_TIMESTAMP);
+}
+
+
+void gpuTimerEnd(int timer) {
+
+	if (timer < 0)
+		return;
+
+	GPU_TIMER& t = timers[timer];
+	glQueryCounter(t.queries[t.current][1], GL_TIMESTAMP);
+	t.pending[t.current] = true;
+	t.current = (t.current + 1) % GPU_TIMER_LATENCY;
+}
+
+
+void gpuTimerEndFrame() {
+
+	for (int i = 0; i < timerCount; i++) {
+		GPU_TIMER& t = timers[i];
+		for (int k = 0; k < GPU_TIMER_LATENCY; k++) {
+			if (!t.pending[k])
+				continue;
+			GLint available = 0;
+			glGetQueryObjectiv(t.queries[k][1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+
+			GLuint64 begin, end;
+			glGetQueryObjectui64v(t.queries[k][0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(t.queries[k][1], GL_QUERY_RESULT, &end);
+			double ms = (end - begin) / 1.0e6;
+			t.ms = t.measured ? t.ms * 0.9 + ms * 0.1 : ms;
+			t.measured = true;
+			t.pending[k] = false;
+		}
+	}
+}
+
+
+double gpuTimerMs(int timer) {
+
+	return timer < 0 ? 0.0 : timers[timer].ms;
+}
+
+
+const char* gpuTimerName(int timer) {
+
+	return timer < 0 ? "" : timers[timer].name;
+}
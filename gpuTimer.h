@@ -0,0 +1,26 @@
+#ifndef __GPU_TIMER_H
+#define __GPU_TIMER_H
+
+/* --- Defines --- */
+
+#define GPU_TIMERS			8
+// frames a result may take to come back before its query is reused
+#define GPU_TIMER_LATENCY	4
+
+/* --- Functions --- */
+
+// GPU time of a section of the frame, from GL_TIMESTAMP queries, so sections may
+// nest. Results are read only once available, a few frames later, and smoothed;
+// the CPU never waits for the GPU.
+
+// returns the timer id, -1 when all are taken or timer queries are not supported
+int    gpuTimerCreate(const char* name);
+void   gpuTimerBegin(int timer);
+void   gpuTimerEnd(int timer);
+// collects the results that came back; once per frame
+void   gpuTimerEndFrame();
+// smoothed milliseconds, 0 until a result is available
+double gpuTimerMs(int timer);
+const char* gpuTimerName(int timer);
+
+#endif
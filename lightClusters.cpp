@@ -0,0 +1,281 @@
+/* --------------------------------------------------
+Light clusters
+ *
+ * The view frustum is cut into LIGHT_CLUSTERS_X x LIGHT_CLUSTERS_Y tiles of the
+ * viewport and LIGHT_CLUSTERS_Z slices of view depth. A light goes into every
+ * cluster of a conservative box: the slices of its depth range, and the tiles
+ * of the screen rectangle of the cube around its sphere. A grid entry per
+ * cluster (offset, count) points into one list of light indices.
+ *
+ * The three buffers get new storage every pass, so the draws of the previous
+ * pass keep their own data.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "lightClusters.h"
+
+extern float mMatrix[COUNT_MATRICES][16];
+
+#define CLUSTER_COUNT (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+
+// clusters covered by a light, inclusive
+typedef struct {
+	int		x0, x1, y0, y1, z0, z1;
+} CLUSTER_RANGE;
+
+static std::vector<LIGHT_CLUSTERS_LIGHT> lights;
+static std::vector<CLUSTER_RANGE> ranges;	// per light, empty when x0 > x1
+static std::vector<unsigned int> grid;		// offset, count per cluster
+static std::vector<unsigned int> counts;
+static std::vector<unsigned int> indices;
+
+static GLuint lightBuffer = 0, gridBuffer = 0, indexBuffer = 0;
+static float viewportParams[4];
+static LIGHT_CLUSTERS_STATS stats;
+
+static const float sliceScale = LIGHT_CLUSTERS_Z / logf(LIGHT_CLUSTERS_FAR / LIGHT_CLUSTERS_NEAR);
+static const float sliceBias = -logf(LIGHT_CLUSTERS_NEAR) * sliceScale;
+
+
+static int sliceOf(float depth) {
+
+	if (depth < LIGHT_CLUSTERS_NEAR)
+		return 0;
+	int slice = (int)floorf(logf(depth) * sliceScale + sliceBias);
+	return std::min(std::max(slice, 0), LIGHT_CLUSTERS_Z - 1);
+}
+
+
+static int tileOf(float ndc, int tiles) {
+
+	int tile = (int)floorf((ndc * 0.5f + 0.5f) * tiles);
+	return std::min(std::max(tile, 0), tiles - 1);
+}
+
+
+// false when the light cannot touch anything inside the frustum
+static bool clusterRange(const LIGHT_CLUSTERS_LIGHT& light, const float projection[16], CLUSTER_RANGE& range) {
+
+	const float* c = light.position;
+	float r = light.position[3];
+
+	// view depth is -z
+	float nearDepth = -c[2] - r, farDepth = -c[2] + r;
+	if (farDepth <= 0.0f)
+		return false;
+	range.z0 = sliceOf(nearDepth);
+	range.z1 = sliceOf(farDepth);
+
+	// screen rectangle of the 8 corners; all screen when a corner is behind the eye
+	float ndcMin[2] = { 1.0f, 1.0f }, ndcMax[2] = { -1.0f, -1.0f };
+	bool whole = false;
+	for (int k = 0; k < 8 && !whole; k++) {
+		float p[4] = { c[0] + (k & 1 ? r : -r), c[1] + (k & 2 ? r : -r), c[2] + (k & 4 ? r : -r), 1.0f };
+		float clip[4];
+		for (int i = 0; i < 4; i++)
+			clip[i] = projection[i] * p[0] + projection[4 + i] * p[1] + projection[8 + i] * p[2] + projection[12 + i];
+		if (clip[3] <= 1e-5f) {
+			whole = true;
+			break;
+		}
+		for (int i = 0; i < 2; i++) {
+			float ndc = clip[i] / clip[3];
+			ndcMin[i] = std::min(ndcMin[i], ndc);
+			ndcMax[i] = std::max(ndcMax[i], ndc);
+		}
+	}
+	if (whole) {
+		ndcMin[0] = ndcMin[1] = -1.0f;
+		ndcMax[0] = ndcMax[1] = 1.0f;
+	}
+	if (ndcMax[0] < -1.0f || ndcMin[0] > 1.0f || ndcMax[1] < -1.0f || ndcMin[1] > 1.0f)
+		return false;
+
+	range.x0 = tileOf(ndcMin[0], LIGHT_CLUSTERS_X);
+	range.x1 = tileOf(ndcMax[0], LIGHT_CLUSTERS_X);
+	range.y0 = tileOf(ndcMin[1], LIGHT_CLUSTERS_Y);
+	range.y1 = tileOf(ndcMax[1], LIGHT_CLUSTERS_Y);
+	return true;
+}
+
+
+void lightClustersInit() {
+
+	lights.reserve(LIGHT_CLUSTERS_MAX_LIGHTS);
+	grid.resize(2 * CLUSTER_COUNT);
+	counts.resize(CLUSTER_COUNT);
+	indices.resize(LIGHT_CLUSTERS_MAX_INDICES);
+
+	glGenBuffers(1, &lightBuffer);
+	glGenBuffers(1, &gridBuffer);
+	glGenBuffers(1, &indexBuffer);
+
+	// an empty pass until the first build
+	lightClustersBegin();
+	int viewport[4] = { 0, 0, 1, 1 };
+	float projection[16];
+	setIdentityMatrix(projection, 4);
+	lightClustersBuild(projection, viewport);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_CLUSTERS_LIGHT_BINDING, lightBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_CLUSTERS_GRID_BINDING, gridBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_CLUSTERS_INDEX_BINDING, indexBuffer);
+}
+
+
+void lightClustersBegin() {
+
+	lights.clear();
+}
+
+
+void lightClustersAdd(const float viewPosition[3], float radius, const float color[3]) {
+
+	if ((int)lights.size() == LIGHT_CLUSTERS_MAX_LIGHTS)
+		return;
+
+	LIGHT_CLUSTERS_LIGHT light;
+	memcpy(light.position, viewPosition, 3 * sizeof(float));
+	light.position[3] = radius;
+	memcpy(light.color, color, 3 * sizeof(float));
+	light.color[3] = 1.0f;
+	lights.push_back(light);
+}
+
+
+void lightClustersBin(const float projection[16], const int viewport[4]) {
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point t0 = Clock::now();
+
+	if (grid.empty()) {		// binning without lightClustersInit, as the benchmark does
+		grid.resize(2 * CLUSTER_COUNT);
+		counts.resize(CLUSTER_COUNT);
+		indices.resize(LIGHT_CLUSTERS_MAX_INDICES);
+	}
+
+	viewportParams[0] = (float)viewport[0];
+	viewportParams[1] = (float)viewport[1];
+	viewportParams[2] = (float)LIGHT_CLUSTERS_X / viewport[2];
+	viewportParams[3] = (float)LIGHT_CLUSTERS_Y / viewport[3];
+
+	int n = (int)lights.size();
+	ranges.resize(n);
+	std::fill(counts.begin(), counts.end(), 0);
+
+	for (int i = 0; i < n; i++) {
+		CLUSTER_RANGE& r = ranges[i];
+		if (!clusterRange(lights[i], projection, r)) {
+			r.x0 = 1; r.x1 = 0;
+			continue;
+		}
+		for (int z = r.z0; z <= r.z1; z++)
+			for (int y = r.y0; y <= r.y1; y++)
+				for (int x = r.x0; x <= r.x1; x++)
+					counts[(z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x]++;
+	}
+
+	// offsets; a cluster that does not fit any more keeps what does
+	unsigned int total = 0, wanted = 0, maxPerCluster = 0;
+	for (int c = 0; c < CLUSTER_COUNT; c++) {
+		unsigned int count = std::min(counts[c], (unsigned int)LIGHT_CLUSTERS_MAX_INDICES - total);
+		grid[2 * c] = total;
+		grid[2 * c + 1] = count;
+		total += count;
+		wanted += counts[c];
+		maxPerCluster = std::max(maxPerCluster, count);
+		counts[c] = 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		const CLUSTER_RANGE& r = ranges[i];
+		for (int z = r.z0; z <= r.z1 && r.x0 <= r.x1; z++)
+			for (int y = r.y0; y <= r.y1; y++)
+				for (int x = r.x0; x <= r.x1; x++) {
+					int c = (z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x;
+					if (counts[c] < grid[2 * c + 1])
+						indices[grid[2 * c] + counts[c]++] = i;
+				}
+	}
+
+	stats.lights = n;
+	stats.indices = (int)total;
+	stats.maxPerCluster = (int)maxPerCluster;
+	stats.dropped = (int)(wanted - total);
+	stats.binMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+
+void lightClustersBuild(const float projection[16], const int viewport[4]) {
+
+	lightClustersBin(projection, viewport);
+
+	// new storage, never smaller than one element
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(stats.lights, 1) * sizeof(LIGHT_CLUSTERS_LIGHT),
+		stats.lights ? lights.data() : NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, grid.size() * sizeof(unsigned int), grid.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(stats.indices, 1) * sizeof(unsigned int), indices.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+
+void lightClustersParams(float viewport[4], float depth[2]) {
+
+	memcpy(viewport, viewportParams, sizeof(viewportParams));
+	depth[0] = sliceScale;
+	depth[1] = sliceBias;
+}
+
+
+const LIGHT_CLUSTERS_STATS& lightClustersStats() {
+
+	return stats;
+}
+
+
+void lightClustersBenchmark(int count, int passes) {
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	// lights scattered over a field in front of the camera, as many buoys and boats
+	loadIdentity(PROJECTION);
+	perspective(53.13f, 16.0f / 9.0f, 0.1f, 1000.0f);
+	int viewport[4] = { 0, 0, 1280, 720 };
+
+	srand(1);
+	std::vector<float> positions(3 * count);
+	for (int i = 0; i < count; i++) {
+		positions[3 * i] = 200.0f * rand() / RAND_MAX - 100.0f;
+		positions[3 * i + 1] = -2.0f + 2.0f * rand() / RAND_MAX;
+		positions[3 * i + 2] = -150.0f * rand() / RAND_MAX;
+	}
+	const float color[3] = { 1.0f, 0.9f, 0.7f };
+
+	double binMs = 0.0;
+	Clock::time_point t0 = Clock::now();
+	for (int p = 0; p < passes; p++) {
+		lightClustersBegin();
+		for (int i = 0; i < count; i++)
+			lightClustersAdd(&positions[3 * i], 4.0f, color);
+		lightClustersBin(mMatrix[PROJECTION], viewport);
+		binMs += stats.binMs;
+	}
+	double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+	printf("Light cluster benchmark: %dx%dx%d clusters, %d lights, %d passes\n",
+		LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z, count, passes);
+	printf("  bin %.3f ms, total %.3f ms/pass; %d references, at most %d per cluster, %d dropped\n",
+		binMs / passes, totalMs / passes, stats.indices, stats.maxPerCluster, stats.dropped);
+}
@@ -0,0 +1,67 @@
+#ifndef __LIGHT_CLUSTERS_H
+#define __LIGHT_CLUSTERS_H
+
+/* --- Defines --- */
+
+// clusters: tiles of the viewport by slices of view depth; as in shaders/pointlight_phong.frag
+#define LIGHT_CLUSTERS_X		16
+#define LIGHT_CLUSTERS_Y		9
+#define LIGHT_CLUSTERS_Z		24
+// depth range of the slices, exponentially spaced; nearer or farther falls in the first or last
+#define LIGHT_CLUSTERS_NEAR		0.1f
+#define LIGHT_CLUSTERS_FAR		1000.0f
+
+#define LIGHT_CLUSTERS_MAX_LIGHTS	1024
+// entries of the index list, for all clusters; lights that do not fit are left out
+#define LIGHT_CLUSTERS_MAX_INDICES	(LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z * 16)
+
+// shader storage bindings of the lights, the grid and the index list (6 and 7 are
+// the materials and the static batch)
+#define LIGHT_CLUSTERS_LIGHT_BINDING	8
+#define LIGHT_CLUSTERS_GRID_BINDING		9
+#define LIGHT_CLUSTERS_INDEX_BINDING	10
+
+/* --- Types --- */
+
+// std430 layout of a light in the shader
+typedef struct {
+	float	position[4];	// view space xyz, radius
+	float	color[4];
+} LIGHT_CLUSTERS_LIGHT;
+
+typedef struct {
+	int		lights;
+	int		indices;		// light references in the index list
+	int		maxPerCluster;
+	int		dropped;		// references left out, the list was full
+	double	binMs;
+} LIGHT_CLUSTERS_STATS;
+
+/* --- Functions --- */
+
+// Clustered forward lighting: point lights are binned on the CPU into clusters of
+// the view frustum, so a fragment only goes through the lights of its own cluster.
+// Lights have a radius, past which they add nothing.
+
+// creates the buffers and binds them to their shader storage bindings
+void lightClustersInit();
+
+// lights of the next pass, in view space
+void lightClustersBegin();
+void lightClustersAdd(const float viewPosition[3], float radius, const float color[3]);
+// bins the lights for a projection (column major, perspective or ortho) and viewport
+void lightClustersBin(const float projection[16], const int viewport[4]);
+// bins and uploads everything for the draws of the pass
+void lightClustersBuild(const float projection[16], const int viewport[4]);
+
+// for the shader, from the last lightClustersBin:
+//   viewport: x, y and clusters per pixel in x and y
+//   depth: slice = log(view depth) * depth[0] + depth[1]
+void lightClustersParams(float viewport[4], float depth[2]);
+
+const LIGHT_CLUSTERS_STATS& lightClustersStats();
+
+// binning only, no window or GL context needed
+void lightClustersBenchmark(int lights, int passes);
+
+#endif
@@ -17,6 +17,7 @@
 #include <string>
 #include <random>
 #include <vector>
+#include <thread>
 #include <cstdlib>  // for random numbers
 
 // include GLEW to access OpenGL 3.3 
@@ -38,6 +39,26 @@
 #include "flare.h"
 #include "avtFreeType.h"
 #include "l3dBillboard.h"
+#include "particles.h"
+#include "particleRenderer.h"
+#include "gpuParticles.h"
+#include "oit.h"
+#include "materials.h"
+#include "renderQueue.h"
+#include "glStateCache.h"
+#include "meshArena.h"
+#include "staticBatch.h"
+#include "frustumCull.h"
+#include "occlusion.h"
+#include "softOcclusion.h"
+#include "rearMirror.h"
+#include "reflection.h"
+#include "envProbe.h"
+#include "skybox.h"
+#include "gpuTimer.h"
+#include "lightClusters.h"
+#include "deferred.h"
+#include "shadowMap.h"
 
 #include "assimp/Importer.hpp"	//OO version Header!
 #include "assimp/scene.h"
@@ -51,7 +72,9 @@
 
 #define frand()			((float)rand()/RAND_MAX)
 #define M_PI			3.14159265
-#define MAX_PARTICULAS  1500
+#define MAX_PARTICULAS  1500	// por explosão de fogo de artifício
+#define PARTICLE_POOL   6144	// partilhado por todos os emissores
+#define PARTICLE_STEPS_PER_FRAME 4
 
 using namespace std;
 
@@ -64,6 +87,14 @@ unsigned int FrameCount = 0;
 //shaders
 VSShaderLib shader;  //geometry
 VSShaderLib shaderText;  //render bitmap text
+VSShaderLib shaderParticles;  //instanced particle billboards
+VSShaderLib shaderParticleSim;  //compute shader particle simulation
+VSShaderLib shaderOITComposite;  //resolve of the transparency pass
+VSShaderLib shaderOcclusion;  //bounding boxes of the occlusion queries
+VSShaderLib shaderMirror;  //pastes the rear-view mirror texture
+VSShaderLib shaderSkybox;  //sky cube at the far plane
+VSShaderLib shaderDeferredLight;  //lighting pass of the deferred path
+VSShaderLib shaderShadow;  //depth of the shadow casters
 
 //File with the font
 const string font_name = "fonts/arial.ttf";
@@ -99,17 +130,91 @@ extern float mCompMatrix[COUNT_COMPUTED_MATRICES][16];
 /// The normal matrix
 extern float mNormal3x3[9];
 
-GLint pvm_uniformId;
-GLint vm_uniformId;
-GLint normal_uniformId;
-GLint lPos_uniformId[8];
 GLint lightEnabledId;
 GLuint TextureArray[4];
-GLint texMode_uniformId, shadowMode_uniformId;
 GLint flareEffectOnId;
-GLint ldirpos;
-GLint tex_loc, tex_loc1, tex_loc2, tex_flare;
-GLint normalMap_loc, specularMap_loc, diffMapCount_loc;
+GLuint skyboxTexture;
+
+// uniforms set while drawing, resolved once in setupShaders
+UniformHandle<mat4> pvm_uniform, vm_uniform;
+UniformHandle<mat3> normal_uniform;
+UniformHandle<int> texMode_uniform, shadowMode_uniform;
+UniformHandle<int> tex_uniform, tex1_uniform;
+UniformHandle<int> oitPass_uniform, batched_uniform, reflectionOn_uniform;
+UniformHandle<float> envLevels_uniform;
+UniformHandle<int> normalMap_uniform, specularMap_uniform;
+UniformHandle<unsigned int> diffMapCount_uniform;
+UniformHandle<int> matIndex_uniform;
+UniformHandle<int> texUnitDiff_uniform, texUnitDiff1_uniform, texUnitSpec_uniform, texUnitNormalMap_uniform;
+
+// std140 layout of the Lights block of shaders/pointlight_phong.*
+typedef struct {
+	float dir_pos[4];
+	float spot_pos[2][4];
+	float coneDir[4];
+	float spotCosCutOff;
+	int isDay, pointLightsOn, spotLightsOn, fogEffectOn;
+	int envProbeOn;
+	float pad[2];
+	float viewToWorld[3][4];	// mat3: a vec4 per column
+	float clusterViewport[4], clusterDepth[2];	// lightClustersParams
+	float pad1[2];
+	float shadowMatrix[SHADOW_CASCADES][16];	// shadowMapMatrices
+	float shadowSplits[4];
+	int shadowsOn, shadowFilter;
+	float pad2[2];
+} LIGHTS_BLOCK;
+LIGHTS_BLOCK lightsBlock;
+
+// features of the phong shader variants (VSShaderLib::getVariant), one bit per define
+// of phongVariantDefines
+#define PHONG_DAY			(1 << 0)
+#define PHONG_POINT_LIGHTS	(1 << 1)
+#define PHONG_SPOT_LIGHTS	(1 << 2)
+#define PHONG_FOG			(1 << 3)
+#define PHONG_SHADOW		(1 << 4)
+#define PHONG_OIT_PASS		(1 << 5)
+#define PHONG_TEX_MODE_1	(1 << 6)	// water
+#define PHONG_TEX_MODE_2	(1 << 7)	// flare
+#define PHONG_TEX_MODE_3	(1 << 8)	// tree billboard
+#define PHONG_SPECULAR_MAP	(1 << 9)
+#define PHONG_DIFF_MAPS_1	(1 << 10)
+#define PHONG_DIFF_MAPS_2	(1 << 11)
+#define PHONG_GBUFFER		(1 << 12)	// deferred path, always a variant
+
+const std::vector<std::string> phongVariantDefines = { "DAY", "POINT_LIGHTS", "SPOT_LIGHTS", "FOG",
+	"SHADOW", "OIT_PASS", "TEX_MODE_1", "TEX_MODE_2", "TEX_MODE_3", "SPECULAR_MAP", "DIFF_MAPS_1", "DIFF_MAPS_2",
+	"GBUFFER" };
+
+bool variantsOn = true;	// a specialized phong program per state instead of the generic one
+unsigned int phongPassFeatures = 0;	// of the pass being drawn: lights (sendLights), OIT and G-buffer
+bool deferredOn = false;	// opaque objects of the main view shaded from a G-buffer (deferred.h)
+bool shadowsOn = true;	// cascaded shadow maps of the sun (shadowMap.h), in the main view
+UniformHandle<mat4> shadowPvm_uniform;
+
+// The phong program for the next draws: the variant for the state of the pass and
+// drawFeatures, or the generic shader. Per draw uniforms are set after it.
+void usePhong(unsigned int drawFeatures) {
+	unsigned int features = phongPassFeatures | drawFeatures;
+	// the generic shader has no G-buffer outputs
+	bool variant = variantsOn || (features & PHONG_GBUFFER);
+	stateUseProgram(variant ? shader.getVariant(features) : shader.getProgramIndex());
+}
+
+// texMode of a render queue packet
+void usePhongTexMode(int texMode) {
+	static const unsigned int features[4] = { 0, PHONG_TEX_MODE_1, PHONG_TEX_MODE_2, PHONG_TEX_MODE_3 };
+	usePhong(features[texMode & 3]);
+}
+
+void setOitPass(bool on) {
+	glProgramUniform1i(shader.getProgramIndex(), oitPass_uniform.location(), on);
+	phongPassFeatures = on ? phongPassFeatures | PHONG_OIT_PASS : phongPassFeatures & ~PHONG_OIT_PASS;
+}
+
+void setGBufferPass(bool on) {
+	phongPassFeatures = on ? phongPassFeatures | PHONG_GBUFFER : phongPassFeatures & ~PHONG_GBUFFER;
+}
 
 
 class AABB {
@@ -154,20 +259,31 @@ public:
 Boat boat;
 int play_time = 0;
 
-typedef struct {
-	float	life;		// vida
-	float	fade;		// fade
-	float	r, g, b;    // color
-	GLfloat x, y, z;    // posi‹o
-	GLfloat vx, vy, vz; // velocidade 
-	GLfloat ax, ay, az; // acelera‹o
-} Particle;
-
-Particle particula[MAX_PARTICULAS];
-int dead_num_particles = 0;
+ParticleSystem particles;
+int fireworksEmitter = -1, wakeEmitter = -1, splashEmitter = -1;
+bool gpuParticlesAvailable = false;
+bool gpuParticlesOn = false;	// simulate in shaders/particles.comp instead of ParticleSystem
+bool oitOn = false;	// weighted blended OIT for the transparent objects of the main view
+bool batchAvailable = false;
+bool batchOn = false;	// static meshes in one glMultiDrawElementsIndirect per pass
+bool boatBatched = false;	// the assimp boat meshes share their textures, so they join the batch
+int buoyOcclusion, fishOcclusion;	// first occlusion slots (occlusion.h) of the buoys and the fish
+bool softOcclusionOn = false;	// CPU occlusion culling (softOcclusion.h) of the buoys and fish in the main view
+bool softOcclusionPass = false;	// the current pass uses its results
+bool reflectionOn = true;	// water reflection from its own target (reflection.h) instead of a stencil pass
+bool reflectionPass = false;	// rendering into it: the reduced object set
+bool envProbeAvailable = false;
+bool envProbeOn = false;	// environment probe (envProbe.h) around the boat, sampled by the water and the boat
+bool probePass = false;	// rendering one of its faces
+bool skyboxOn = true;	// sky cube (skybox.h) drawn after the opaque objects, instead of clearing the color
+int frameTimer = -1, mainTimer = -1, skyTimer = -1, shadowTimer = -1;	// GPU timers (gpuTimer.h) shown in the HUD
+int islandOccluder = -1, houseOccluder = -1, roofOccluder = -1;
+vector<int> boatOccluders;	// per assimp mesh
 
 const int maxFish = 10; //Numero Maximo de Peixes
+int fishMesh = 0;	// of fishMeshes, drawn for every fish this frame, shadows included
 const float maxDistance = 20.0f; //Distancia a que podem tar do barco
+bool buoySoftVisible[6], fishSoftVisible[maxFish];
 
 float deltaT = 0.05;
 float speed_decay = 0.01;
@@ -177,7 +293,6 @@ float x = 0.0f, y = 1.75f, z = 10.0f;
 float lx = 0.0f, ly = 0.0f, lz = -1.0f;
 
 int deltaMove = 0, deltaUp = 0, type = 0;
-int fireworks = 0;
 
 class Fish {
 public:
@@ -414,7 +529,9 @@ void setupReversePointLightPos() {
 void timer(int value)
 {
 	std::ostringstream oss;
-	oss << CAPTION << ": " << FrameCount << " FPS @ (" << WinX << "x" << WinY << ")";
+	int avoided = stateResetAvoided();
+	oss << CAPTION << ": " << FrameCount << " FPS @ (" << WinX << "x" << WinY << "), "
+		<< (FrameCount ? avoided / FrameCount : 0) << " GL calls skipped/frame";
 	std::string s = oss.str();
 
 	if (!isPaused) play_time++;
@@ -433,58 +550,78 @@ void updateFishSpeed(int value) {
 }
 
 void updateParticles() {
-	int i;
 	float h;
 
 	/* Método de Euler de integração de eq. diferenciais ordinárias
-	h representa o step de tempo; dv/dt = a; dx/dt = v; e conhecem-se os valores iniciais de x e v */
+	h representa o step de tempo; dv/dt = a; dx/dt = v; e conhecem-se os valores iniciais de x e v.
+	Só as partículas vivas são integradas; as mortas são compactadas pelo ParticleSystem */
 
 	//h = 0.125f;
 	h = 0.033;
-	if (fireworks) {
 
-		for (i = 0; i < MAX_PARTICULAS; i++)
-		{
-			particula[i].x += (h * particula[i].vx);
-			particula[i].y += (h * particula[i].vy);
-			particula[i].z += (h * particula[i].vz);
-			particula[i].vx += (h * particula[i].ax);
-			particula[i].vy += (h * particula[i].ay);
-			particula[i].vz += (h * particula[i].az);
-			particula[i].life -= particula[i].fade;
-		}
+	/* a simulação corria uma vez por passagem de render (quatro por frame);
+	agora corre uma vez por frame com os mesmos quatro passos, para manter a velocidade */
+	if (!isPaused) {
+		for (int k = 0; k < PARTICLE_STEPS_PER_FRAME; k++)
+			particles.update(h);
+	}
+
+	if (particles.isDeferred()) {
+		// o ParticleSystem só decide o que nasce; a simulação corre no compute shader
+		gpuParticlesSpawn(particles.spawns);
+		particles.spawns.clear();
+		if (!isPaused)
+			gpuParticlesSimulate(h, PARTICLE_STEPS_PER_FRAME);
 	}
+	else
+		particleRendererUpload(particles);
+}
+
+void initParticleEmitters() {
+	/* tom amarelado que vai ser multiplicado pela textura que varia entre branco e preto */
+	float color[3] = { 0.882f, 0.552f, 0.211f };
+	/* simular um pouco de vento e a aceleração da gravidade */
+	float accel[3] = { 0.1f, -0.15f, 0.0f };
+	/* step de decréscimo da vida para cada iteração */
+	float fade = 0.0025f;
+
+	float wakeColor[3] = { 0.8f, 0.85f, 0.9f };
+	float wakeAccel[3] = { 0.0f, -0.6f, 0.0f };
+	float splashColor[3] = { 0.55f, 0.75f, 0.95f };
+	float splashAccel[3] = { 0.0f, -1.2f, 0.0f };
+
+	particles.init(PARTICLE_POOL);
+	particles.setSpawnBudget(128);
+	// até duas explosões em simultâneo
+	fireworksEmitter = particles.addEmitter(color, accel, fade, 2.0f, 2 * MAX_PARTICULAS);
+	wakeEmitter = particles.addEmitter(wakeColor, wakeAccel, 0.02f, 0.5f, 1024);
+	splashEmitter = particles.addEmitter(splashColor, splashAccel, 0.025f, 0.4f, 768);
+
+	particleRendererInit(PARTICLE_POOL, shaderParticles);
+	gpuParticlesAvailable = gpuParticlesInit(shaderParticleSim, PARTICLE_POOL, particles.emitters);
 }
 
+/* nova explosão num ponto aleatório por cima da ilha; as anteriores continuam */
 void iniParticles(void)
 {
-	GLfloat v, theta, phi;
-	int i;
+	float origin[3] = { 16.0f * frand() - 8.0f, 9.0f + 3.0f * frand(), 16.0f * frand() - 8.0f };
 
-	for (i = 0; i < MAX_PARTICULAS; i++)
-	{
-		v = 0.8 * frand() + 0.2;
-		phi = frand() * M_PI;
-		theta = 2.0 * frand() * M_PI;
+	particles.emitBurst(fireworksEmitter, origin, MAX_PARTICULAS, 0.2f, 1.0f);
+}
+
+/* rasto do barco: emissor contínuo na popa, com taxa proporcional à velocidade */
+void updateWake(float angle_rad) {
+	float dir[3] = { sin(angle_rad), 0.0f, cos(angle_rad) };
+	float origin[3] = { boat.position[0] - dir[0], 0.1f, boat.position[2] - dir[2] };
+	float velocity[3] = { -0.5f * boat.speed * dir[0], 0.6f, -0.5f * boat.speed * dir[2] };
 
-		particula[i].x = 0.0f;
-		particula[i].y = 10.0f;
-		particula[i].z = 0.0f;
-		particula[i].vx = v * cos(theta) * sin(phi);
-		particula[i].vy = v * cos(phi);
-		particula[i].vz = v * sin(theta) * sin(phi);
-		particula[i].ax = 0.1f; /* simular um pouco de vento */
-		particula[i].ay = -0.15f; /* simular a aceleração da gravidade */
-		particula[i].az = 0.0f;
+	particles.setStream(wakeEmitter, 250.0f * fabs(boat.speed), origin, velocity, 0.25f);
+}
 
-		/* tom amarelado que vai ser multiplicado pela textura que varia entre branco e preto */
-		particula[i].r = 0.882f;
-		particula[i].g = 0.552f;
-		particula[i].b = 0.211f;
+void splashBuoy(int buoy, int count) {
+	float origin[3] = { buoy_positions[buoy][0], 0.2f, buoy_positions[buoy][1] };
 
-		particula[i].life = 1.0f;		/* vida inicial */
-		particula[i].fade = 0.0025f;	    /* step de decréscimo da vida para cada iteração */
-	}
+	particles.emitBurst(splashEmitter, origin, count, 0.4f, 1.2f);
 }
 
 // ------------------------------------------------------------
@@ -602,6 +739,11 @@ void refresh(int value)
 	boat.boatOBB = createOBB(boat.position, boat.position);
 
 	updateFish(boat.position);
+	updateWake(angle_rad);
+
+	// ondas a bater nas boias
+	if (rand() % 45 == 0)
+		splashBuoy(rand() % 6, 12);
 
 	if (boat.speed > 0) boat.speed -= speed_decay;
 	else if (boat.speed < 0) boat.speed += speed_decay;
@@ -638,6 +780,7 @@ void refresh(int value)
 		else {	
 			for (int i = 0; i < 6; i++) {
 				if (isCollidingWithBuoy(boatAABB, i)) {
+					splashBuoy(i, 60);
 					boat.speed = 0.0;
 				}
 			}
@@ -661,7 +804,7 @@ void changeSize(int w, int h) {
 	if(h == 0)
 		h = 1;
 	// set the viewport to be the entire window
-	glViewport(0, 0, w, h);
+	stateViewport(0, 0, w, h);
 
 	/* create a diamond shaped stencil area */
 	loadIdentity(PROJECTION);
@@ -675,7 +818,7 @@ void changeSize(int w, int h) {
 	loadIdentity(VIEW);
 	loadIdentity(MODEL);
 
-	glUseProgram(shader.getProgramIndex());
+	stateUseProgram(shader.getProgramIndex());
 
 	//não vai ser preciso enviar o material pois o cubo não é desenhado
 
@@ -686,20 +829,18 @@ void changeSize(int w, int h) {
 	scale(MODEL, 2, 1, 1.0);
 	// send matrices to OGL
 	computeDerivedMatrix(PROJ_VIEW_MODEL);
-	//glUniformMatrix4fv(vm_uniformId, 1, GL_FALSE, mCompMatrix[VIEW_MODEL]);
-	glUniformMatrix4fv(pvm_uniformId, 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
+	//vm_uniform.set(mCompMatrix[VIEW_MODEL]);
+	pvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
 	computeNormalMatrix3x3();
-	glUniformMatrix3fv(normal_uniformId, 1, GL_FALSE, mNormal3x3);
+	normal_uniform.set(mNormal3x3);
 
 	glClear(GL_STENCIL_BUFFER_BIT);
-	glEnable(GL_STENCIL_TEST);
+	stateEnable(GL_STENCIL_TEST);
 
-	glStencilFunc(GL_NEVER, 0x2, 0x2);
-	glStencilOp(GL_REPLACE, GL_KEEP, GL_KEEP);
+	stateStencilFunc(GL_NEVER, 0x2, 0x2);
+	stateStencilOp(GL_REPLACE, GL_KEEP, GL_KEEP);
 
-	glBindVertexArray(myMeshes[13].vao);
-	glDrawElements(myMeshes[13].type, myMeshes[13].numIndexes, GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+	meshDraw(myMeshes[13]);
 
 	// set the projection matrix
 	ratio = (1.0f * w) / h;
@@ -708,49 +849,45 @@ void changeSize(int w, int h) {
 }
 
 
+// packet drawing a whole mesh with the phong shader; texture 0 keeps the bound textures
+RENDER_PACKET meshPacket(const MyMesh& mesh, int texMode, GLuint texture = 0, int texUnit = 0) {
+	RENDER_PACKET p;
+	p.vao = mesh.vao;
+	p.mode = mesh.type;
+	p.count = mesh.numIndexes;
+	p.firstIndex = mesh.firstIndex;
+	p.baseVertex = mesh.baseVertex;
+	p.materialId = mesh.materialId;
+	p.texMode = texMode;
+	p.texture = texture;
+	p.texUnit = texUnit;
+	p.query = 0;
+	return p;
+}
+
 // Render the fish
 void renderFish() {
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	GLint loc;
-	int randomFish = rand() % 3;
-
 	while (fishList.size() < maxFish) {
 		spawnFish(boat.position);
 	}
 
+	RENDER_PACKET p = meshPacket(fishMeshes[fishMesh], 0);
+
 	for (int i = 0; i < fishList.size(); i++) {
-		// Send the material of the fish
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.ambient");
-		glUniform4fv(loc, 1, fishMeshes[randomFish].mat.ambient);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.diffuse");
-		glUniform4fv(loc, 1, fishMeshes[randomFish].mat.diffuse);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.specular");
-		glUniform4fv(loc, 1, fishMeshes[randomFish].mat.specular);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.shininess");
-		glUniform1f(loc, fishMeshes[randomFish].mat.shininess);
+		if (softOcclusionPass && i < maxFish && !fishSoftVisible[i]) continue;
 
 		// Set the fish position
 		pushMatrix(MODEL);
 		translate(MODEL, fishList[i].position[0], fishList[i].position[1], fishList[i].position[2]);
 		scale(MODEL, 0.2f, 0.2f, 0.2f); // Adjust size of fish if needed
 
-		// Send matrices to OpenGL
-		computeDerivedMatrix(PROJ_VIEW_MODEL);
-		glUniformMatrix4fv(vm_uniformId, 1, GL_FALSE, mCompMatrix[VIEW_MODEL]);
-		glUniformMatrix4fv(pvm_uniformId, 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
-		computeNormalMatrix3x3();
-		glUniformMatrix3fv(normal_uniformId, 1, GL_FALSE, mNormal3x3);
-
-		// Render the fish mesh
-		glBindVertexArray(fishMeshes[randomFish].vao);
-		glDrawElements(fishMeshes[randomFish].type, fishMeshes[randomFish].numIndexes, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		if (cullMesh(fishMeshes[fishMesh])) {
+			p.query = occlusionQueryOf(fishOcclusion + i);
+			renderQueueSubmit(p, true);
+		}
 
 		popMatrix(MODEL);
 	}
-	glDisable(GL_BLEND);
 }
 
 // ------------------------------------------------------------
@@ -758,10 +895,67 @@ void renderFish() {
 // Render stufff
 //
 
-void aiRecursive_render(const aiNode* nd, vector<struct MyMesh>& myMeshes, GLuint*& textureIds)
+// variant features for the maps of an assimp mesh
+unsigned int assimpFeatures(const MyMesh& mesh) {
+	unsigned int features = 0;
+	int diffMapCount = 0;
+	for (unsigned int i = 0; i < mesh.mat.texCount; ++i) {
+		if (mesh.texTypes[i] == DIFFUSE) diffMapCount++;
+		else if (mesh.texTypes[i] == SPECULAR) features |= PHONG_SPECULAR_MAP;
+	}
+	if (diffMapCount == 1) features |= PHONG_DIFF_MAPS_1;
+	else if (diffMapCount >= 2) features |= PHONG_DIFF_MAPS_2;
+	return features;
+}
+
+// binds the textures of an assimp mesh and sets the shader (usePhong) to sample them
+void setAssimpTextures(const MyMesh& mesh)
 {
-	GLint loc;
+	unsigned int  diffMapCount = 0;  //read 2 diffuse textures
+
+	//devido ao fragment shader suporta 2 texturas difusas simultaneas, 1 especular e 1 normal map
+
+	normalMap_uniform.set(false);   //GLSL normalMap variable initialized to 0
+	specularMap_uniform.set(false);
+	diffMapCount_uniform.set(0u);
+
+	if (mesh.mat.texCount != 0)
+		for (unsigned int i = 0; i < mesh.mat.texCount; ++i) {
+
+			//Activate a TU with a Texture Object
+			GLuint TU = mesh.texUnits[i];
+			stateActiveTexture(GL_TEXTURE3 + TU);
+			stateBindTexture(GL_TEXTURE_2D, textureIds[TU]);
+
+			if (mesh.texTypes[i] == DIFFUSE) {
+				if (diffMapCount == 0) {
+					diffMapCount++;
+					texUnitDiff_uniform.set(TU + 3);
+					diffMapCount_uniform.set(diffMapCount);
+					printf("diffMapCount %d\n", diffMapCount);
+				}
+				else if (diffMapCount == 1) {
+					diffMapCount++;
+					texUnitDiff1_uniform.set(TU + 3);
+					diffMapCount_uniform.set(diffMapCount);
+					printf("diffMapCount %d\n", diffMapCount);
+				}
+				else printf("Only supports a Material with a maximum of 2 diffuse textures\n");
+			}
+			else if (mesh.texTypes[i] == SPECULAR) {
+				texUnitSpec_uniform.set(TU + 3);
+				specularMap_uniform.set(true);
+			}
+			else if (mesh.texTypes[i] == NORMALS) { //Normal map
+				texUnitNormalMap_uniform.set(TU + 3);
+
+			}
+			else printf("Texture Map not supported\n");
+		}
+}
 
+void aiRecursive_render(const aiNode* nd, vector<struct MyMesh>& myMeshes, GLuint*& textureIds)
+{
 	// Get node transformation matrix
 	aiMatrix4x4 m = nd->mTransformation;
 	// OpenGL matrices are column major
@@ -778,83 +972,28 @@ void aiRecursive_render(const aiNode* nd, vector<struct MyMesh>& myMeshes, GLuin
 	// draw all meshes assigned to this node
 	for (unsigned int n = 0; n < nd->mNumMeshes; ++n) {
 
+		if (!cullMesh(assimpMeshes[nd->mMeshes[n]]))
+			continue;
+
 		// send the material
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.ambient");
-		glUniform4fv(loc, 1, assimpMeshes[nd->mMeshes[n]].mat.ambient);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.diffuse");
-		glUniform4fv(loc, 1, assimpMeshes[nd->mMeshes[n]].mat.diffuse);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.specular");
-		glUniform4fv(loc, 1, assimpMeshes[nd->mMeshes[n]].mat.specular);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.emissive");
-		glUniform4fv(loc, 1, assimpMeshes[nd->mMeshes[n]].mat.emissive);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.shininess");
-		glUniform1f(loc, assimpMeshes[nd->mMeshes[n]].mat.shininess);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.texCount");
-		glUniform1i(loc, assimpMeshes[nd->mMeshes[n]].mat.texCount);
-
-		unsigned int  diffMapCount = 0;  //read 2 diffuse textures
-
-		//devido ao fragment shader suporta 2 texturas difusas simultaneas, 1 especular e 1 normal map
-
-		glUniform1i(normalMap_loc, false);   //GLSL normalMap variable initialized to 0
-		glUniform1i(specularMap_loc, false);
-		glUniform1ui(diffMapCount_loc, 0);
-
-		if (assimpMeshes[nd->mMeshes[n]].mat.texCount != 0)
-			for (unsigned int i = 0; i < assimpMeshes[nd->mMeshes[n]].mat.texCount; ++i) {
-
-				//Activate a TU with a Texture Object
-				GLuint TU = assimpMeshes[nd->mMeshes[n]].texUnits[i];
-				glActiveTexture(GL_TEXTURE3 + TU);
-				glBindTexture(GL_TEXTURE_2D, textureIds[TU]);
-
-				if (assimpMeshes[nd->mMeshes[n]].texTypes[i] == DIFFUSE) {
-					if (diffMapCount == 0) {
-						diffMapCount++;
-						loc = glGetUniformLocation(shader.getProgramIndex(), "texUnitDiff");
-						glUniform1i(loc, TU + 3);
-						glUniform1ui(diffMapCount_loc, diffMapCount);
-						printf("diffMapCount %d\n", diffMapCount);
-					}
-					else if (diffMapCount == 1) {
-						diffMapCount++;
-						loc = glGetUniformLocation(shader.getProgramIndex(), "texUnitDiff1");
-						glUniform1i(loc, TU + 3);
-						glUniform1ui(diffMapCount_loc, diffMapCount);
-						printf("diffMapCount %d\n", diffMapCount);
-					}
-					else printf("Only supports a Material with a maximum of 2 diffuse textures\n");
-				}
-				else if (assimpMeshes[nd->mMeshes[n]].texTypes[i] == SPECULAR) {
-					loc = glGetUniformLocation(shader.getProgramIndex(), "texUnitSpec");
-					glUniform1i(loc, TU + 3);
-					glUniform1i(specularMap_loc, true);
-				}
-				else if (assimpMeshes[nd->mMeshes[n]].texTypes[i] == NORMALS) { //Normal map
-					loc = glGetUniformLocation(shader.getProgramIndex(), "texUnitNormalMap");
-					glUniform1i(loc, TU + 3);
+		usePhong(assimpFeatures(assimpMeshes[nd->mMeshes[n]]));
+		matIndex_uniform.set(assimpMeshes[nd->mMeshes[n]].materialId);
 
-				}
-				else printf("Texture Map not supported\n");
-			}
+		setAssimpTextures(assimpMeshes[nd->mMeshes[n]]);
 
 		// send matrices to OGL
 		computeDerivedMatrix(PROJ_VIEW_MODEL);
-		glUniformMatrix4fv(vm_uniformId, 1, GL_FALSE, mCompMatrix[VIEW_MODEL]);
-		glUniformMatrix4fv(pvm_uniformId, 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
+		vm_uniform.set(mCompMatrix[VIEW_MODEL]);
+		pvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
 		computeNormalMatrix3x3();
-		glUniformMatrix3fv(normal_uniformId, 1, GL_FALSE, mNormal3x3);
-
-		// bind VAO
-		glBindVertexArray(assimpMeshes[nd->mMeshes[n]].vao);
+		normal_uniform.set(mNormal3x3);
 
 		if (!shader.isProgramValid()) {
 			printf("Program Not Valid!\n");
 			exit(1);
 		}
 		// draw
-		glDrawElements(assimpMeshes[nd->mMeshes[n]].type, assimpMeshes[nd->mMeshes[n]].numIndexes, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		meshDraw(assimpMeshes[nd->mMeshes[n]]);
 	}
 
 	// draw all children
@@ -864,6 +1003,49 @@ void aiRecursive_render(const aiNode* nd, vector<struct MyMesh>& myMeshes, GLuin
 	popMatrix(MODEL);
 }
 
+// same walk as aiRecursive_render, queueing the meshes in the static batch;
+// the textures are set once by the caller
+void aiRecursive_batch(const aiNode* nd)
+{
+	aiMatrix4x4 m = nd->mTransformation;
+	m.Transpose();
+
+	pushMatrix(MODEL);
+
+	float aux[16];
+	memcpy(aux, &m, sizeof(float) * 16);
+	multMatrix(MODEL, aux);
+
+	for (unsigned int n = 0; n < nd->mNumMeshes; ++n)
+		if (cullMesh(assimpMeshes[nd->mMeshes[n]]))
+			batchSubmit(assimpMeshes[nd->mMeshes[n]], assimpMeshes[nd->mMeshes[n]].materialId);
+
+	for (unsigned int n = 0; n < nd->mNumChildren; ++n)
+		aiRecursive_batch(nd->mChildren[n]);
+	popMatrix(MODEL);
+}
+
+// same walk as aiRecursive_render, queueing the meshes as software occluders
+void aiRecursive_occluders(const aiNode* nd)
+{
+	aiMatrix4x4 m = nd->mTransformation;
+	m.Transpose();
+
+	pushMatrix(MODEL);
+
+	float aux[16];
+	memcpy(aux, &m, sizeof(float) * 16);
+	multMatrix(MODEL, aux);
+
+	for (unsigned int n = 0; n < nd->mNumMeshes; ++n)
+		if (boatOccluders[nd->mMeshes[n]] >= 0)
+			softOcclusionOccluder(boatOccluders[nd->mMeshes[n]], mMatrix[MODEL]);
+
+	for (unsigned int n = 0; n < nd->mNumChildren; ++n)
+		aiRecursive_occluders(nd->mChildren[n]);
+	popMatrix(MODEL);
+}
+
 void renderFlare(FLARE_DEF* flare, int lX, int lY, int* m_viewport, bool rearView) {  //lX, lY represent the projected position of light on viewport
 
 	int     dx, dy;          // Screen coordinates of "destination"
@@ -872,14 +1054,10 @@ void renderFlare(FLARE_DEF* flare, int lX, int lY, int* m_viewport, bool rearVie
 	float    maxflaredist, flaredist, flaremaxsize, flarescale, scaleDistance;
 	int     width, height, alpha;    // Piece parameters;
 	int     i;
-	float	diffuse[4];
 
-	GLint loc;
-
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	stateDisable(GL_DEPTH_TEST);
+	stateDisable(GL_CULL_FACE);
+	setTransparentBlend();
 
 	int screenMaxCoordX = m_viewport[0] + m_viewport[2] - 1;
 	int screenMaxCoordY = m_viewport[1] + m_viewport[3] - 1;
@@ -901,8 +1079,9 @@ void renderFlare(FLARE_DEF* flare, int lX, int lY, int* m_viewport, bool rearVie
 
 	// Render each element. To be used Texture Unit 0
 
-	glUniform1i(texMode_uniformId, 2); // draw modulated textured particles 
-	glUniform1i(tex_loc, 0);  //use TU 0
+	usePhong(PHONG_TEX_MODE_2);
+	texMode_uniform.set(2); // draw modulated textured particles 
+	tex_uniform.set(0);  //use TU 0
 
 	int camID;
 	if (rearView) camID = 3;
@@ -930,50 +1109,80 @@ void renderFlare(FLARE_DEF* flare, int lX, int lY, int* m_viewport, bool rearVie
 			if (width > flaremaxsize)  width = flaremaxsize;
 
 			height = (int)((float)m_viewport[3] / (float)m_viewport[2] * (float)width);
-			memcpy(diffuse, flare->element[i].matDiffuse, 4 * sizeof(float));
-			diffuse[3] *= scaleDistance;   //scale the alpha channel
 
 			if (width > 1)
 			{
 				// send the material - diffuse color modulated with texture
-				loc = glGetUniformLocation(shader.getProgramIndex(), "mat.diffuse");
-				glUniform4fv(loc, 1, diffuse);
+				matIndex_uniform.set(flare->element[i].materialId);
 
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, FlareTextureArray[flare->element[i].textureId]);
+				stateActiveTexture(GL_TEXTURE0);
+				stateBindTexture(GL_TEXTURE_2D, FlareTextureArray[flare->element[i].textureId]);
 
 				pushMatrix(MODEL);
 				translate(MODEL, (float)(px - width * 0.0f), (float)(py - height * 0.0f), 0.0f);
 				scale(MODEL, (float)width, (float)height, 1);
 				computeDerivedMatrix(PROJ_VIEW_MODEL);
-				glUniformMatrix4fv(vm_uniformId, 1, GL_FALSE, mCompMatrix[VIEW_MODEL]);
-				glUniformMatrix4fv(pvm_uniformId, 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
+				vm_uniform.set(mCompMatrix[VIEW_MODEL]);
+				pvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
 				computeNormalMatrix3x3();
-				glUniformMatrix3fv(normal_uniformId, 1, GL_FALSE, mNormal3x3);
+				normal_uniform.set(mNormal3x3);
 
-				glBindVertexArray(myMeshes[13].vao);
-				glDrawElements(myMeshes[13].type, myMeshes[13].numIndexes, GL_UNSIGNED_INT, 0);
-				glBindVertexArray(0);
+				meshDraw(myMeshes[13]);
 				popMatrix(MODEL);
 			}
 		}
 	}
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glDisable(GL_BLEND);
+	stateEnable(GL_DEPTH_TEST);
+	stateEnable(GL_CULL_FACE);
+	stateDisable(GL_BLEND);
+}
+
+
+// objects drawn of those tested in each pass of the last frame, and the particles drawn
+std::string cullText() {
+	static const char* names[CULL_PASSES] = { "MIRROR", "MAIN", "REAR MIRROR", "REAR", "PROBE" };
+	std::string text = cullEnabled() ? "CULLING" : "NO CULLING";
+	if (occlusionEnabled()) text += " + OCCLUSION";
+	if (softOcclusionOn) {
+		const SOFT_OCCLUSION_STATS& soft = softOcclusionStats();
+		text += " + SOFT " + std::to_string(soft.hidden) + "/" + std::to_string(soft.tested) + " HIDDEN";
+	}
+	int particlesVisible = 0, particles = 0;
+
+	for (int p = 0; p < CULL_PASSES; p++) {
+		const CULL_STATS& stats = cullStats((CULL_PASS)p);
+		text += std::string(" ") + names[p] + ": " + std::to_string(stats.visible) + "/" + std::to_string(stats.visible + stats.culled);
+		particlesVisible += stats.particlesVisible;
+		particles += stats.particlesVisible + stats.particlesCulled;
+	}
+	return text + " PARTICLES: " + std::to_string(particlesVisible) + "/" + std::to_string(particles);
 }
 
+// GPU time of the frame and of its main view, a few frames late
+std::string gpuTimerText() {
+	char ms[32];
+	std::string text = "GPU";
+	const int timers[] = { frameTimer, mainTimer, skyTimer, shadowTimer };
+	for (int t : timers) {
+		if (t < 0) continue;
+		snprintf(ms, sizeof(ms), " %s: %.2f MS", gpuTimerName(t), gpuTimerMs(t));
+		text += ms;
+	}
+	if (shadowsOn && isDay)
+		text += " CACHED CASCADES: " + std::to_string(SHADOW_CASCADES - shadowMapStaticRedraws()) + "/" + std::to_string(SHADOW_CASCADES);
+	return text;
+}
 
 void renderHUD() {
 
 	//Render text (bitmap fonts) in screen coordinates. So use ortoghonal projection with viewport coordinates.
-	glDisable(GL_DEPTH_TEST);
+	stateDisable(GL_DEPTH_TEST);
 	//the glyph contains transparent background colors and non-transparent for the actual character pixels. So we use the blending
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	stateEnable(GL_BLEND);
+	stateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	int m_viewport[4];
-	glGetIntegerv(GL_VIEWPORT, m_viewport);
+	stateGetViewport(m_viewport);
 	int windowWidth = glutGet(GLUT_WINDOW_WIDTH);
 	int windowHeight = glutGet(GLUT_WINDOW_HEIGHT);
 	float char_width = 0.0f;
@@ -983,7 +1192,7 @@ void renderHUD() {
 	pushMatrix(MODEL);
 	loadIdentity(MODEL);
 	pushMatrix(PROJECTION);
-	glGetIntegerv(GL_VIEWPORT, m_viewport);
+	stateGetViewport(m_viewport);
 	// switch to orthogonal projection
 	loadIdentity(PROJECTION);
 	pushMatrix(VIEW);
@@ -992,6 +1201,8 @@ void renderHUD() {
 	RenderText(shaderText, "TIME: " + std::to_string(play_time), 0.0f, windowHeight - char_height / 2.0f, 0.5f, 1.0f, 1.0f, 1.0f);
 	float xPos = windowWidth - TextWidth("LIVES: ", 0.5f, char_width);
 	RenderText(shaderText, "LIVES: " + std::to_string(boat.lives), xPos, windowHeight - char_height / 2.0f, 0.5f, 1.0f, 1.0f, 1.0f);
+	RenderText(shaderText, cullText(), 0.0f, char_height / 4.0f, 0.25f, 1.0f, 1.0f, 1.0f);
+	RenderText(shaderText, gpuTimerText(), 0.0f, char_height / 2.0f, 0.25f, 1.0f, 1.0f, 1.0f);
 	if (isPaused) {
 		xPos = windowWidth / 2.0f - (TextWidth("PAUSED", 0.5f, char_width) / 2.0f);
 		float yPos = windowHeight / 2.0f;
@@ -1000,8 +1211,8 @@ void renderHUD() {
 	popMatrix(PROJECTION);
 	popMatrix(VIEW);
 	popMatrix(MODEL);
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
+	stateEnable(GL_DEPTH_TEST);
+	stateDisable(GL_BLEND);
 }
 
 void orientMe(float ang) {
@@ -1018,231 +1229,467 @@ void Lookup(int i) {
 	ly += 0.01 * i;
 }
 
-void draw_water() {
+// reflective: mixed with the reflection target, which makes it opaque
+void draw_water(bool reflective = false) {
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, TextureArray[0]);
+	usePhong(PHONG_TEX_MODE_1);
+	if (reflective)
+		reflectionBindTexture();
+	reflectionOn_uniform.set(reflective);
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, TextureArray[1]);
+	stateActiveTexture(GL_TEXTURE0);
+	stateBindTexture(GL_TEXTURE_2D, TextureArray[0]);
 
-	glUniform1i(tex_loc, 0);
-	glUniform1i(tex_loc1, 1);
+	stateActiveTexture(GL_TEXTURE1);
+	stateBindTexture(GL_TEXTURE_2D, TextureArray[1]);
 
-	GLint loc;
-	loc = glGetUniformLocation(shader.getProgramIndex(), "mat.ambient");
-	glUniform4fv(loc, 1, myMeshes[0].mat.ambient);
-	loc = glGetUniformLocation(shader.getProgramIndex(), "mat.diffuse");
-	glUniform4fv(loc, 1, myMeshes[0].mat.diffuse);
-	loc = glGetUniformLocation(shader.getProgramIndex(), "mat.specular");
-	glUniform4fv(loc, 1, myMeshes[0].mat.specular);
-	loc = glGetUniformLocation(shader.getProgramIndex(), "mat.shininess");
-	glUniform1f(loc, myMeshes[0].mat.shininess);
+	tex_uniform.set(0);
+	tex1_uniform.set(1);
+
+	matIndex_uniform.set(myMeshes[0].materialId);
 
 	pushMatrix(MODEL);
-	translate(MODEL, 0.0f, -25.0f, 0.0f);
-	scale(MODEL, 100.0f, 50.0f, 100.0f);
+	scale(MODEL, 100.0f, 1.0f, 100.0f);
 
 	computeDerivedMatrix(PROJ_VIEW_MODEL);
-	glUniformMatrix4fv(vm_uniformId, 1, GL_FALSE, mCompMatrix[VIEW_MODEL]);
-	glUniformMatrix4fv(pvm_uniformId, 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
+	vm_uniform.set(mCompMatrix[VIEW_MODEL]);
+	pvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
 	computeNormalMatrix3x3();
-	glUniformMatrix3fv(normal_uniformId, 1, GL_FALSE, mNormal3x3);
+	normal_uniform.set(mNormal3x3);
 
 	// Render mesh
-	glBindVertexArray(myMeshes[0].vao);
-	glUniform1i(texMode_uniformId, 1);
-	glDrawElements(myMeshes[0].type, myMeshes[0].numIndexes, GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+	texMode_uniform.set(1);
+	meshDraw(myMeshes[0]);
 	popMatrix(MODEL);
 }
 
-void renderMainScene(bool rearView, bool mirrored) {
-	GLint loc;
+// sky where nothing opaque was drawn in the pass, with the current MODEL (mirrored or not)
+void drawSky() {
+	if (!skyboxOn)
+		return;
+	skyboxDraw(skyboxTexture);
+	stateUseProgram(shader.getProgramIndex());
+}
 
-	//Send the directional light position
-	int buoy = 0;
+// tree billboard: alpha tested and blended, so it is drawn with the transparent objects
+void renderTree(bool rearView) {
+	pushMatrix(MODEL);
 
-	// Associar os Texture Units aos Objects Texture
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, TextureArray[2]);
+	if (rearView) scale(MODEL, 1.0, 1.0, -1.0);
 
-	//Indicar aos tres samplers do GLSL quais os Texture Units a serem usados
-	glUniform1i(tex_loc2, 2);
+	translate(MODEL, -9.0f, 0.25f, 2.0f);
 
-	for (int i = 1; i < 18; ++i) {
-		if (rearView && i >= 6 && i <= 11) continue; //don't render boat
-		if (mirrored && i == 1) continue; //don't render island
-		if (i == 6 || i == 7) continue; //don't render boat
+	int camID;
+	if (rearView) camID = 4;
+	else camID = active;
 
-		// send the material
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.ambient");
-		glUniform4fv(loc, 1, myMeshes[i-buoy].mat.ambient);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.diffuse");
-		glUniform4fv(loc, 1, myMeshes[i-buoy].mat.diffuse);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.specular");
-		glUniform4fv(loc, 1, myMeshes[i-buoy].mat.specular);
-		loc = glGetUniformLocation(shader.getProgramIndex(), "mat.shininess");
-		glUniform1f(loc, myMeshes[i-buoy].mat.shininess);
+	float cam[3] = { cams[camID].camPos[0], cams[camID].camPos[1], cams[camID].camPos[2] };
+	float pos[3] = { -9.0f, 0.25f, 2.0f };
 
+	l3dBillboardCylindricalBegin(cam, pos);
 
-		pushMatrix(MODEL);
+	pushMatrix(MODEL);
+	translate(MODEL, 0.0, 3.0, 0.0f);
+	rotate(MODEL, 90, 1, 0, 0);
 
-		if (rearView) scale(MODEL, 1.0, 1.0, -1.0);
+	// tree texture on TU2, sampled by texmap2 (texMode 3)
+	if (cullMesh(myMeshes[5]))
+		renderQueueSubmit(meshPacket(myMeshes[5], 3, TextureArray[2], 2), true);
 
-		if (i == 1) {
-			translate(MODEL, -10.0f, -4.99f, 0.0f); //island
-			scale(MODEL, 10.0f, 10.0f, 10.0f);
-		}
+	popMatrix(MODEL);
+	popMatrix(MODEL);
+}
 
-		// fix house base offset
-		if (i == 2) translate(MODEL, -12.5f, 0.5f, -0.5f);
+void renderTransparentObjects(bool rearView);
 
-		if (i == 3) { //house roof
-			translate(MODEL, -12.5f, 1.0f, -0.5f);
-			rotate(MODEL, 45, 0, 1, 0);
-		}
+// any of the fish meshes may be drawn, so their boxes fit the largest
+int largestFishMesh() {
+	int largest = 0;
+	for (int f = 1; f < fishMeshes.size(); f++)
+		if (fishMeshes[f].bounds[3] > fishMeshes[largest].bounds[3]) largest = f;
+	return largest;
+}
 
-		if (i == 4) translate(MODEL, -7.0f, 0.3f, 0.5f);
+// boxes of what may hide behind the island and the house: buoys (used next frame),
+// fish and particles (used by the transparent draws of this pass)
+void queryOcclusion(bool rearView) {
+	int largestFish = largestFishMesh();
 
-		if (i == 5) { // tree
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	for (int b = 0; b < 6; b++) {
+		pushMatrix(MODEL);
+		if (rearView) scale(MODEL, 1.0, 1.0, -1.0);
+		translate(MODEL, buoy_positions[b][0], 0.0f, buoy_positions[b][1]);
+		occlusionQuery(buoyOcclusion + b, myMeshes[12].bounds, myMeshes[12].bounds[3]);
+		popMatrix(MODEL);
+	}
+	for (int i = 0; i < fishList.size(); i++) {
+		pushMatrix(MODEL);
+		translate(MODEL, fishList[i].position[0], fishList[i].position[1], fishList[i].position[2]);
+		scale(MODEL, 0.2f, 0.2f, 0.2f);
+		occlusionQuery(fishOcclusion + i, fishMeshes[largestFish].bounds, fishMeshes[largestFish].bounds[3]);
+		popMatrix(MODEL);
+	}
+	if (!gpuParticlesOn)
+		particleRendererQueryOcclusion();
+}
 
-			translate(MODEL, -9.0f, 0.25f, 2.0f);
+// world box around a sphere in the current MODEL coordinates
+SOFT_OCCLUSION_BOUNDS softBounds(const float centre[3], float radius) {
+	const float* m = mMatrix[MODEL];
+	float axis2 = 0.0f;
+	for (int c = 0; c < 3; c++)
+		axis2 = fmaxf(axis2, m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2]);
+	radius *= sqrtf(axis2);
+
+	SOFT_OCCLUSION_BOUNDS b;
+	for (int r = 0; r < 3; r++) {
+		float world = m[r] * centre[0] + m[4 + r] * centre[1] + m[8 + r] * centre[2] + m[12 + r];
+		b.min[r] = world - radius;
+		b.max[r] = world + radius;
+	}
+	return b;
+}
 
-			int camID;
-			if (rearView) camID = 4;
-			else camID = active;
-			
-			float cam[3] = { cams[camID].camPos[0], cams[camID].camPos[1], cams[camID].camPos[2] };
-			float pos[3] = { -9.0f, 0.25f, 2.0f };
+// the island, the house and the boat rasterized on the CPU, then the buoys and the
+// fish tested against them, so the hidden ones are never submitted in this pass
+void softOcclusionCull() {
+	float pv[16];
+	memcpy(pv, mMatrix[PROJECTION], sizeof(pv));
+	multMatrix(pv, mMatrix[VIEW]);
+	softOcclusionBegin(pv);
 
-			l3dBillboardCylindricalBegin(cam, pos);
+	pushMatrix(MODEL);
+	translate(MODEL, -10.0f, -4.99f, 0.0f);
+	scale(MODEL, 10.0f, 10.0f, 10.0f);
+	softOcclusionOccluder(islandOccluder, mMatrix[MODEL]);
+	popMatrix(MODEL);
 
-			loc = glGetUniformLocation(shader.getProgramIndex(), "mat.specular");
-			glUniform4fv(loc, 1, myMeshes[i].mat.specular);
-			loc = glGetUniformLocation(shader.getProgramIndex(), "mat.shininess");
-			glUniform1f(loc, myMeshes[i].mat.shininess);
+	pushMatrix(MODEL);
+	translate(MODEL, -12.5f, 0.5f, -0.5f);
+	softOcclusionOccluder(houseOccluder, mMatrix[MODEL]);
+	popMatrix(MODEL);
 
-			pushMatrix(MODEL);
-			translate(MODEL, 0.0, 3.0, 0.0f);
-			rotate(MODEL, 90, 1, 0, 0);
+	pushMatrix(MODEL);
+	translate(MODEL, -12.5f, 1.0f, -0.5f);
+	rotate(MODEL, 45, 0, 1, 0);
+	softOcclusionOccluder(roofOccluder, mMatrix[MODEL]);
+	popMatrix(MODEL);
 
-			computeDerivedMatrix(PROJ_VIEW_MODEL);
-		}
+	pushMatrix(MODEL);
+	translate(MODEL, boat.position[0], 0, boat.position[2]);
+	rotate(MODEL, boat.angle - 90, 0, 1, 0);
+	scale(MODEL, scaleFactor, scaleFactor, scaleFactor);
+	rotate(MODEL, -90, 1, 0, 0);
+	aiRecursive_occluders(scene->mRootNode);
+	popMatrix(MODEL);
 
-		if (i == 6) { // boat base
-			translate(MODEL, boat.position[0], 0.1, boat.position[2]);
-			rotate(MODEL, boat.angle, 0, 1, 0);
-			scale(MODEL, 0.4f, 0.2f, 0.7f);
-		}
+	softOcclusionEnd();
 
-		if (i == 7) { // boat front
-			translate(MODEL, boat.position[0], 0.1, boat.position[2]);
-			rotate(MODEL, boat.angle, 0, 1, 0);
-			translate(MODEL, 0.0f, 0.0f, 0.35f);
-			rotate(MODEL, 90, 1, 0, 0);
-			scale(MODEL, 1, 1, 0.5);
-			rotate(MODEL, 45, 0, 1, 0);
-		}
-		if (i == 9) { // left row handle
-			translate(MODEL, boat.position[0], 0.15f, boat.position[2]);
-			rotate(MODEL, boat.angle, 0, 1, 0);
-			if (boat.left_paddle_working && boat.paddle_direction == 1)
-				rotate(MODEL, boat.paddle_angle, 1, 0, 0);
-			else if (boat.left_paddle_working && boat.paddle_direction == 0)
-				rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
-			translate(MODEL, -0.3f, 0.0f, 0.0f);
-			rotate(MODEL, -45, 0, 0, 1);
-		}
-		if (i == 8) { // right row handle
-			translate(MODEL, boat.position[0], 0.15f, boat.position[2]);
-			rotate(MODEL, boat.angle, 0, 1, 0);
-			if (boat.right_paddle_working && boat.paddle_direction == 1)
-				rotate(MODEL, boat.paddle_angle, 1, 0, 0);
-			else if (boat.right_paddle_working && boat.paddle_direction == 0)
-				rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
-			translate(MODEL, 0.3f, 0.0f, 0.0f);
-			rotate(MODEL, 45, 0, 0, 1);
-		}
-		if (i == 10) { //left row paddle
-			translate(MODEL, boat.position[0], 0.0f, boat.position[2]);
-			rotate(MODEL, boat.angle, 0, 1, 0);
-			translate(MODEL, 0.0f, 0.15f, 0.0f);
-			if (boat.left_paddle_working && boat.paddle_direction == 1)
-				rotate(MODEL, boat.paddle_angle, 1, 0, 0);
-			else if (boat.left_paddle_working && boat.paddle_direction == 0)
-				rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
-			rotate(MODEL, 180, 1, 0, 0);
-			translate(MODEL, -0.4f, 0.15f, 0.0f);
-			rotate(MODEL, 45, 0, 0, 1);
-			scale(MODEL, 0.1f, 0.15f, 0.05f);
-		}
-		if (i == 11) { //right3 row paddle
-			translate(MODEL, boat.position[0], 0.0f, boat.position[2]);
-			rotate(MODEL, boat.angle, 0, 1, 0);
-			translate(MODEL, 0.0f, 0.15f, 0.0f);
-			if (boat.right_paddle_working && boat.paddle_direction == 1)
-				rotate(MODEL, boat.paddle_angle, 1, 0, 0);
-			else if (boat.right_paddle_working && boat.paddle_direction == 0)
-				rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
-			rotate(MODEL, 180, 1, 0, 0);
-			translate(MODEL, 0.4f, 0.15f, 0.0f);
-			rotate(MODEL, -45, 0, 0, 1);
-			scale(MODEL, 0.1f, 0.15f, 0.05f);
-		}
+	SOFT_OCCLUSION_BOUNDS bounds[6 + maxFish];
+	bool visible[6 + maxFish];
+	int count = 0, largestFish = largestFishMesh();
+	for (int b = 0; b < 6; b++) {
+		pushMatrix(MODEL);
+		translate(MODEL, buoy_positions[b][0], 0.0f, buoy_positions[b][1]);
+		bounds[count++] = softBounds(myMeshes[12].bounds, myMeshes[12].bounds[3]);
+		popMatrix(MODEL);
+	}
+	for (int i = 0; i < fishList.size() && i < maxFish; i++) {
+		pushMatrix(MODEL);
+		translate(MODEL, fishList[i].position[0], fishList[i].position[1], fishList[i].position[2]);
+		scale(MODEL, 0.2f, 0.2f, 0.2f);
+		bounds[count++] = softBounds(fishMeshes[largestFish].bounds, fishMeshes[largestFish].bounds[3]);
+		popMatrix(MODEL);
+	}
+	softOcclusionTest(bounds, count, visible);
 
-		if (i >= 12) {
-			translate(MODEL, buoy_positions[buoy][0], 0.0f, buoy_positions[buoy][1]);
-		}
-		if (i == 18) {
-			// draw sphere where the stencil is 1 
-			scale(MODEL, 10, 10, 10);
-			glBindVertexArray(myMeshes[4].vao);
-			glDrawElements(myMeshes[4].type, myMeshes[4].numIndexes, GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
-		}
+	memcpy(buoySoftVisible, visible, sizeof(buoySoftVisible));
+	for (int i = 0; i < maxFish; i++)
+		fishSoftVisible[i] = 6 + i >= count || visible[6 + i];	// fish spawned later are drawn
+}
 
-		// send matrices to OGL
+// same walk as aiRecursive_render, depth only for the shadow maps
+void aiRecursive_shadow(const aiNode* nd)
+{
+	aiMatrix4x4 m = nd->mTransformation;
+	m.Transpose();
+
+	pushMatrix(MODEL);
+
+	float aux[16];
+	memcpy(aux, &m, sizeof(float) * 16);
+	multMatrix(MODEL, aux);
+
+	for (unsigned int n = 0; n < nd->mNumMeshes; ++n) {
 		computeDerivedMatrix(PROJ_VIEW_MODEL);
-		glUniformMatrix4fv(vm_uniformId, 1, GL_FALSE, mCompMatrix[VIEW_MODEL]);
-		glUniformMatrix4fv(pvm_uniformId, 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
-		computeNormalMatrix3x3();
-		glUniformMatrix3fv(normal_uniformId, 1, GL_FALSE, mNormal3x3);
+		shadowPvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
+		meshDraw(assimpMeshes[nd->mMeshes[n]]);
+	}
 
-		// Render mesh
-		glBindVertexArray(myMeshes[i-buoy].vao);
-		if (i == 5) {
-			glUniform1i(texMode_uniformId, 3);
-		}
-		else  {
-			glUniform1i(texMode_uniformId, 0);
-		}
-		
-		glDrawElements(myMeshes[i - buoy].type, myMeshes[i - buoy].numIndexes, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	for (unsigned int n = 0; n < nd->mNumChildren; ++n)
+		aiRecursive_shadow(nd->mChildren[n]);
+	popMatrix(MODEL);
+}
 
-		if (i >= 12) buoy++;
-		if (i == 5) {
-			popMatrix(MODEL);
-			glDisable(GL_BLEND);
+void sceneObjectModel(int i, int buoy);
+
+// shadow casters with shaderShadow: the static ones (island, house and buoys) for
+// the cached layers, or those that move (the boat, its oars and the fish)
+void renderShadowCasters(bool statics) {
+	int buoy = 0;
+	for (int i = 1; i < 18; ++i) {
+		bool oar = i >= 8 && i <= 11;
+		if (i == 5 || i == 6 || i == 7 || oar != !statics) {	// tree billboard, boat drawn as a model
+			if (i >= 12) buoy++;
+			continue;
 		}
+		pushMatrix(MODEL);
+		sceneObjectModel(i, buoy);
+		computeDerivedMatrix(PROJ_VIEW_MODEL);
+		shadowPvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
+		meshDraw(myMeshes[i - buoy]);
 		popMatrix(MODEL);
+		if (i >= 12) buoy++;
 	}
+	if (statics)
+		return;
+
 	pushMatrix(MODEL);
 	translate(MODEL, boat.position[0], 0, boat.position[2]);
 	rotate(MODEL, boat.angle - 90, 0, 1, 0);
 	scale(MODEL, scaleFactor, scaleFactor, scaleFactor);
 	rotate(MODEL, -90, 1, 0, 0);
-	aiRecursive_render(scene->mRootNode, assimpMeshes, textureIds);
+	aiRecursive_shadow(scene->mRootNode);
+	popMatrix(MODEL);
+
+	for (int i = 0; i < fishList.size(); i++) {
+		pushMatrix(MODEL);
+		translate(MODEL, fishList[i].position[0], fishList[i].position[1], fishList[i].position[2]);
+		scale(MODEL, 0.2f, 0.2f, 0.2f);
+		computeDerivedMatrix(PROJ_VIEW_MODEL);
+		shadowPvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
+		meshDraw(fishMeshes[fishMesh]);
+		popMatrix(MODEL);
+	}
+}
+
+// the cascades of the sun for the camera in VIEW and PROJECTION; static casters only
+// where a cascade moved, the boat and the fish every frame
+void renderShadowMaps(int width, int height) {
+	shadowMapUpdate(directionalLightDir, mMatrix[VIEW], mMatrix[PROJECTION]);
+
+	stateUseProgram(shaderShadow.getProgramIndex());
+	stateDisable(GL_CULL_FACE);	// the roof and the oars are open
+	pushMatrix(MODEL);
+	loadIdentity(MODEL);
+	for (int c = 0; c < SHADOW_CASCADES; c++) {
+		if (shadowMapBeginStatic(c)) {
+			renderShadowCasters(true);
+			shadowMapEnd();
+		}
+		shadowMapBeginDynamic(c);
+		renderShadowCasters(false);
+		shadowMapEnd();
+	}
 	popMatrix(MODEL);
+	stateEnable(GL_CULL_FACE);
+
+	stateViewport(0, 0, width, height);
+	shadowMapBindTexture();
+	stateUseProgram(shader.getProgramIndex());
+}
+
+// places object i of myMeshes, buoy the index of the buoy when it is one, into MODEL
+void sceneObjectModel(int i, int buoy) {
+	if (i == 1) {
+		translate(MODEL, -10.0f, -4.99f, 0.0f); //island
+		scale(MODEL, 10.0f, 10.0f, 10.0f);
+	}
+
+	// fix house base offset
+	if (i == 2) translate(MODEL, -12.5f, 0.5f, -0.5f);
+
+	if (i == 3) { //house roof
+		translate(MODEL, -12.5f, 1.0f, -0.5f);
+		rotate(MODEL, 45, 0, 1, 0);
+	}
+
+	if (i == 4) translate(MODEL, -7.0f, 0.3f, 0.5f);
+
+	if (i == 6) { // boat base
+		translate(MODEL, boat.position[0], 0.1, boat.position[2]);
+		rotate(MODEL, boat.angle, 0, 1, 0);
+		scale(MODEL, 0.4f, 0.2f, 0.7f);
+	}
+
+	if (i == 7) { // boat front
+		translate(MODEL, boat.position[0], 0.1, boat.position[2]);
+		rotate(MODEL, boat.angle, 0, 1, 0);
+		translate(MODEL, 0.0f, 0.0f, 0.35f);
+		rotate(MODEL, 90, 1, 0, 0);
+		scale(MODEL, 1, 1, 0.5);
+		rotate(MODEL, 45, 0, 1, 0);
+	}
+	if (i == 9) { // left row handle
+		translate(MODEL, boat.position[0], 0.15f, boat.position[2]);
+		rotate(MODEL, boat.angle, 0, 1, 0);
+		if (boat.left_paddle_working && boat.paddle_direction == 1)
+			rotate(MODEL, boat.paddle_angle, 1, 0, 0);
+		else if (boat.left_paddle_working && boat.paddle_direction == 0)
+			rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
+		translate(MODEL, -0.3f, 0.0f, 0.0f);
+		rotate(MODEL, -45, 0, 0, 1);
+	}
+	if (i == 8) { // right row handle
+		translate(MODEL, boat.position[0], 0.15f, boat.position[2]);
+		rotate(MODEL, boat.angle, 0, 1, 0);
+		if (boat.right_paddle_working && boat.paddle_direction == 1)
+			rotate(MODEL, boat.paddle_angle, 1, 0, 0);
+		else if (boat.right_paddle_working && boat.paddle_direction == 0)
+			rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
+		translate(MODEL, 0.3f, 0.0f, 0.0f);
+		rotate(MODEL, 45, 0, 0, 1);
+	}
+	if (i == 10) { //left row paddle
+		translate(MODEL, boat.position[0], 0.0f, boat.position[2]);
+		rotate(MODEL, boat.angle, 0, 1, 0);
+		translate(MODEL, 0.0f, 0.15f, 0.0f);
+		if (boat.left_paddle_working && boat.paddle_direction == 1)
+			rotate(MODEL, boat.paddle_angle, 1, 0, 0);
+		else if (boat.left_paddle_working && boat.paddle_direction == 0)
+			rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
+		rotate(MODEL, 180, 1, 0, 0);
+		translate(MODEL, -0.4f, 0.15f, 0.0f);
+		rotate(MODEL, 45, 0, 0, 1);
+		scale(MODEL, 0.1f, 0.15f, 0.05f);
+	}
+	if (i == 11) { //right3 row paddle
+		translate(MODEL, boat.position[0], 0.0f, boat.position[2]);
+		rotate(MODEL, boat.angle, 0, 1, 0);
+		translate(MODEL, 0.0f, 0.15f, 0.0f);
+		if (boat.right_paddle_working && boat.paddle_direction == 1)
+			rotate(MODEL, boat.paddle_angle, 1, 0, 0);
+		else if (boat.right_paddle_working && boat.paddle_direction == 0)
+			rotate(MODEL, -boat.paddle_angle, 1, 0, 0);
+		rotate(MODEL, 180, 1, 0, 0);
+		translate(MODEL, 0.4f, 0.15f, 0.0f);
+		rotate(MODEL, -45, 0, 0, 1);
+		scale(MODEL, 0.1f, 0.15f, 0.05f);
+	}
+
+	if (i >= 12) {
+		translate(MODEL, buoy_positions[buoy][0], 0.0f, buoy_positions[buoy][1]);
+	}
+}
+
+void renderMainScene(bool rearView, bool mirrored, bool transparent = true) {
+	//Send the directional light position
+	int buoy = 0;
+
+	CULL_PASS pass;
+	if (probePass)
+		pass = CULL_PASS_PROBE;
+	else if (rearView)
+		pass = mirrored ? CULL_PASS_REAR_MIRRORED : CULL_PASS_REAR;
+	else
+		pass = mirrored ? CULL_PASS_MIRRORED : CULL_PASS_MAIN;
+	cullBeginPass(pass);
+	occlusionBeginPass(pass);
+	softOcclusionPass = softOcclusionOn && pass == CULL_PASS_MAIN;
+	if (softOcclusionPass)
+		softOcclusionCull();
+
+	for (int i = 1; i < 18; ++i) {
+		if (rearView && i >= 6 && i <= 11) continue; //don't render boat
+		if (mirrored && i == 1) continue; //don't render island
+		if (i == 6 || i == 7) continue; //don't render boat
+		if (i == 5) continue; //tree is drawn by renderTree
+		if ((reflectionPass || probePass) && i >= 8 && i <= 11) continue; //oars are too small to show in reflections
+
+		pushMatrix(MODEL);
+
+		if (rearView) scale(MODEL, 1.0, 1.0, -1.0);
+
+		sceneObjectModel(i, buoy);
+
+		// nothing reaches GL for an object outside the frustum of the pass; buoys
+		// hidden in the last frame are skipped by the multi draw, or by the GPU
+		if (i >= 12 && softOcclusionPass && !buoySoftVisible[buoy]) {
+			buoy++;
+			popMatrix(MODEL);
+			continue;
+		}
+
+		if (cullMesh(myMeshes[i - buoy])) {
+			int slot = i >= 12 && !probePass ? buoyOcclusion + buoy : -1;	// probe faces look different ways
+			if (batchOn) {
+				if (slot < 0 || !occlusionHidden(slot))
+					batchSubmit(myMeshes[i - buoy], myMeshes[i - buoy].materialId);
+			}
+			else {
+				RENDER_PACKET p = meshPacket(myMeshes[i - buoy], 0);
+				if (slot >= 0)
+					p.query = occlusionQueryOf(slot);
+				renderQueueSubmit(p, false);
+			}
+		}
+
+		if (i >= 12) buoy++;
+		popMatrix(MODEL);
+	}
+	if (!batchOn)
+		renderQueueFlush();	// opaque objects sorted by state and front to back
+
+	texMode_uniform.set(0);
+	unsigned int batchFeatures = 0;	// the batched boat meshes sample their maps
+	if (!probePass) {	// the probe sits inside the boat
+		pushMatrix(MODEL);
+		translate(MODEL, boat.position[0], 0, boat.position[2]);
+		rotate(MODEL, boat.angle - 90, 0, 1, 0);
+		scale(MODEL, scaleFactor, scaleFactor, scaleFactor);
+		rotate(MODEL, -90, 1, 0, 0);
+		if (batchOn && boatBatched) {
+			batchFeatures = assimpFeatures(assimpMeshes[0]);
+			usePhong(batchFeatures);
+			setAssimpTextures(assimpMeshes[0]);
+			aiRecursive_batch(scene->mRootNode);
+		}
+		else
+			aiRecursive_render(scene->mRootNode, assimpMeshes, textureIds);
+		popMatrix(MODEL);
+	}
+
+	// the whole static set in one multi draw
+	if (batchOn) {
+		usePhong(batchFeatures);
+		batchFlush();
+	}
+
+	// the occluders are in the depth buffer now
+	if (!probePass) {
+		occlusionBeginQueries();
+		queryOcclusion(rearView);
+		occlusionEndQueries();
+		stateUseProgram(shader.getProgramIndex());
+	}
+
+	if (transparent)
+		renderTransparentObjects(rearView);
+
+	stateDisable(GL_BLEND);
+}
+
+// everything blended: drawn after the opaque objects, or into the OIT targets
+void renderTransparentObjects(bool rearView) {
+	renderTree(rearView);
 	renderFish();
+	// back to front
+	renderQueueFlush();
 
 	if (flareEffectOn) {
 		int flarePos[2];
 		int m_viewport[4];
-		glGetIntegerv(GL_VIEWPORT, m_viewport);
+		stateGetViewport(m_viewport);
 
 		pushMatrix(MODEL);
 		loadIdentity(MODEL);
@@ -1265,76 +1712,154 @@ void renderMainScene(bool rearView, bool mirrored) {
 		popMatrix(VIEW);
 	}
 
-	if (fireworks) {
-		float particle_color[4];
-		updateParticles();
+	if (particles.liveCount() > 0) {
+		// draw all particles: one instanced draw of the data uploaded this frame
+		if (gpuParticlesOn)
+			gpuParticlesDraw(TextureArray[3]); //particle.tga associated to TU0
+		else
+			particleRendererDraw(TextureArray[3]);
+		stateUseProgram(shader.getProgramIndex());
+	}
+}
 
-		// draw fireworks particles
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, TextureArray[3]); //particle.tga associated to TU0 
+// Fills the Lights block for one pass, with the lights in eye space of the current VIEW.
+// Mirrored passes use the lights reflected on the water (directionalLightDir is already
+// negated in place there, since the flare also needs it).
+void sendLights(bool mirrored, bool rearView) {
+	float aux[4];
+	float m = mirrored ? -1.0f : 1.0f;
+
+	multMatrixPoint(VIEW, directionalLightDir, lightsBlock.dir_pos);
+
+	// point lights go to the clusters of this pass: the buoys and the lantern of the boat
+	lightClustersBegin();
+	if (pointLightsOn) {
+		const float white[3] = { 1.0f, 1.0f, 1.0f };
+		const float lantern[3] = { 1.0f, 0.7f, 0.35f };
+		float view[4];
+		for (int i = 0; i < 6; i++) {
+			memcpy(aux, rearView ? r_pointLightPos[i] : pointLightPos[i], 4 * sizeof(float));
+			aux[1] *= m;
+			multMatrixPoint(VIEW, aux, view);
+			lightClustersAdd(view, 12.0f, white);
+		}
+		aux[0] = boat.position[0];
+		aux[1] = 0.8f * m;
+		aux[2] = rearView ? -boat.position[2] : boat.position[2];
+		aux[3] = 1.0f;
+		multMatrixPoint(VIEW, aux, view);
+		lightClustersAdd(view, 6.0f, lantern);
+	}
+	int viewport[4];
+	stateGetViewport(viewport);
+	lightClustersBuild(mMatrix[PROJECTION], viewport);
+	lightClustersParams(lightsBlock.clusterViewport, lightsBlock.clusterDepth);
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// the maps are of the unmirrored world, seen by the main camera
+	lightsBlock.shadowsOn = shadowsOn && isDay && !mirrored && !rearView && !probePass;
+	if (lightsBlock.shadowsOn)
+		shadowMapMatrices(mMatrix[VIEW], lightsBlock.shadowMatrix, lightsBlock.shadowSplits);
+	lightsBlock.shadowFilter = shadowMapFilter();
 
-		glDepthMask(GL_FALSE);  //Depth Buffer Read Only
+	for (int i = 0; i < 2; i++) {
+		memcpy(aux, spotLightPos[i], 4 * sizeof(float));
+		aux[1] *= m;
+		multMatrixPoint(VIEW, aux, lightsBlock.spot_pos[i]);
+	}
+	multMatrixPoint(VIEW, coneDir, lightsBlock.coneDir);
+	lightsBlock.spotCosCutOff = 0.93f;
+
+	lightsBlock.isDay = isDay;
+	lightsBlock.pointLightsOn = pointLightsOn;
+	lightsBlock.spotLightsOn = spotLightsOn && !rearView;
+	lightsBlock.fogEffectOn = fogEffectOn;
+
+	// the probe is in world directions; VIEW is rigid, its inverse rotation the transpose
+	lightsBlock.envProbeOn = envProbeOn && !probePass;
+	for (int r = 0; r < 3; r++)
+		for (int c = 0; c < 3; c++)
+			lightsBlock.viewToWorld[c][r] = mMatrix[VIEW][r * 4 + c];
+
+	VSShaderLib::setBlock("Lights", &lightsBlock);
+
+	// the same state selects the shader variants of the pass
+	phongPassFeatures &= PHONG_OIT_PASS | PHONG_GBUFFER;
+	if (lightsBlock.isDay) phongPassFeatures |= PHONG_DAY;
+	if (lightsBlock.pointLightsOn) phongPassFeatures |= PHONG_POINT_LIGHTS;
+	if (lightsBlock.spotLightsOn) phongPassFeatures |= PHONG_SPOT_LIGHTS;
+	if (lightsBlock.fogEffectOn) phongPassFeatures |= PHONG_FOG;
+}
 
-		glUniform1i(texMode_uniformId, 2); // draw modulated textured particles 
-		glUniform1i(tex_loc, 0);
 
-		for (int i = 0; i < MAX_PARTICULAS; i++)
-		{
-			if (particula[i].life > 0.0f) /* só desenha as que ainda estão vivas */
-			{
+// one face of the environment probe, from the middle of the boat: opaque objects and
+// the water, without the boat itself and the oars
+void renderProbe(int width, int height) {
+	const float centre[3] = { boat.position[0], 1.0f, boat.position[2] };
 
-				/* A vida da partícula representa o canal alpha da cor. Como o blend está activo a cor final é a soma da cor rgb do fragmento multiplicada pelo
-				alpha com a cor do pixel destino */
+	envProbeUnbindTexture();	// it is being rendered to
+	envProbeBeginFace(centre);
+	stateDisable(GL_STENCIL_TEST);
 
-				particle_color[0] = particula[i].r;
-				particle_color[1] = particula[i].g;
-				particle_color[2] = particula[i].b;
-				particle_color[3] = particula[i].life;
+	probePass = true;
+	sendLights(false, false);
+	renderMainScene(false, false, false);
+	draw_water();
+	drawSky();
+	probePass = false;
 
-				// send the material - diffuse color modulated with texture
-				loc = glGetUniformLocation(shader.getProgramIndex(), "mat.diffuse");
-				glUniform4fv(loc, 1, particle_color);
+	envProbeEndFace();
+	envProbeBindTexture();
+	stateViewport(0, 0, width, height);
+}
 
-				pushMatrix(MODEL);
-				translate(MODEL, particula[i].x, particula[i].y, particula[i].z);
+// the mirrored scene into the reflection target, cut at the water by an oblique near
+// plane; only opaque objects without the oars, so no flare, particles or HUD
+void renderReflection(int width, int height) {
+	if (!reflectionBegin(width, height)) {
+		reflectionOn = false;
+		return;
+	}
+	stateDisable(GL_STENCIL_TEST);
 
-				// send matrices to OGL
-				computeDerivedMatrix(PROJ_VIEW_MODEL);
-				glUniformMatrix4fv(vm_uniformId, 1, GL_FALSE, mCompMatrix[VIEW_MODEL]);
-				glUniformMatrix4fv(pvm_uniformId, 1, GL_FALSE, mCompMatrix[PROJ_VIEW_MODEL]);
-				computeNormalMatrix3x3();
-				glUniformMatrix3fv(normal_uniformId, 1, GL_FALSE, mNormal3x3);
+	// keeps y <= 0.05 of the mirrored scene, what was above the water
+	const float waterPlane[4] = { 0.0f, -1.0f, 0.0f, 0.05f };
+	pushMatrix(PROJECTION);
+	reflectionClipProjection(waterPlane);
 
-				glBindVertexArray(myMeshes[14].vao);
-				glDrawElements(myMeshes[14].type, myMeshes[14].numIndexes, GL_UNSIGNED_INT, 0);
-				popMatrix(MODEL);
-			}
-			else dead_num_particles++;
-		}
+	shadowMode_uniform.set(0);
 
-		glDepthMask(GL_TRUE); //make depth buffer again writeable
+	lightPos[1] *= (-1.0f);
+	directionalLightDir[1] *= (-1.0f);
+	sendLights(true, false);
 
-		if (dead_num_particles == MAX_PARTICULAS) {
-			fireworks = 0;
-			dead_num_particles = 0;
-			printf("All particles dead\n");
-		}
+	pushMatrix(MODEL);
+	scale(MODEL, 1.0f, -1.0f, 1.0f);
+	stateCullFace(GL_FRONT);
+	reflectionPass = true;
+	renderMainScene(false, true, false);
+	drawSky();
+	reflectionPass = false;
+	stateCullFace(GL_BACK);
+	popMatrix(MODEL);
 
-	}
-	glBindVertexArray(0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glDisable(GL_BLEND);
-}
+	lightPos[1] *= (-1.0f);
+	directionalLightDir[1] *= (-1.0f);
 
+	popMatrix(PROJECTION);
+	reflectionEnd();
+	stateViewport(0, 0, width, height);
+	stateEnable(GL_STENCIL_TEST);
+}
 
 void renderScene(void) {
 	FrameCount++;
+	gpuTimerBegin(frameTimer);
+	cullBeginFrame();
+	occlusionBeginFrame();
+
+	updateParticles();
+	fishMesh = rand() % 3;
 
-	GLint loc;
-	float res[4];
 	float mat[16];
 	GLfloat plano_chao[4] = { 0,1,0,0 };
 	GLint m_view[4];
@@ -1342,9 +1867,10 @@ void renderScene(void) {
 	int windowWidth = glutGet(GLUT_WINDOW_WIDTH);
 	int windowHeight = glutGet(GLUT_WINDOW_HEIGHT);
 
-	glViewport(0, 0, windowWidth, windowHeight);
+	stateViewport(0, 0, windowWidth, windowHeight);
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// the sky covers every pixel left by the scene, the HUD and the rear mirror
+	glClear(skyboxOn ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	// load identity matrices
 	loadIdentity(VIEW);
 	loadIdentity(MODEL);
@@ -1352,7 +1878,7 @@ void renderScene(void) {
 	lookAt(cams[active].camPos[0], cams[active].camPos[1], cams[active].camPos[2],
 		cams[active].camTarget[0], cams[active].camTarget[1], cams[active].camTarget[2],
 		0.0f, 1.0f, 0.0f);
-	glGetIntegerv(GL_VIEWPORT, m_view);
+	stateGetViewport(m_view);
 	float ratio = (float)(m_view[2] - m_view[0]) / (float)(m_view[3] - m_view[1]);
 
 	loadIdentity(PROJECTION);
@@ -1363,222 +1889,180 @@ void renderScene(void) {
 	else if (cams[active].type == ORTHOGONAL) {
 		ortho(ratio * (-25), ratio * 25, -25, 25, 0.1f, 1000.0f);
 	}
-	glUseProgram(shader.getProgramIndex());
+	stateUseProgram(shader.getProgramIndex());
 
-	glEnable(GL_STENCIL_TEST);        // reset outer shader
-	glStencilFunc(GL_NOTEQUAL, 0x2, 0x0);
-	glStencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE);
-
-	glStencilFunc(GL_EQUAL, 0x0, 0x2);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-
-	glStencilFunc(GL_GREATER, 0x1, 0x3);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-
-	draw_water();
-
-	glStencilFunc(GL_EQUAL, 0x1, 0x1);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-
-	loc = glGetUniformLocation(shader.getProgramIndex(), "isDay");
-	if (isDay == true)
-		glUniform1i(loc, 1);
-	else
-		glUniform1i(loc, 0);
+	if (shadowsOn && isDay) {
+		gpuTimerBegin(shadowTimer);
+		renderShadowMaps(windowWidth, windowHeight);
+		gpuTimerEnd(shadowTimer);
+	}
 
-	loc = glGetUniformLocation(shader.getProgramIndex(), "pointLightsOn");
-	if (pointLightsOn == true)
-		glUniform1i(loc, 1);
-	else
-		glUniform1i(loc, 0);
+	if (envProbeOn)
+		renderProbe(windowWidth, windowHeight);
 
-	loc = glGetUniformLocation(shader.getProgramIndex(), "spotLightsOn");
-	if (spotLightsOn == true)
-		glUniform1i(loc, 1);
-	else
-		glUniform1i(loc, 0);
+	stateEnable(GL_STENCIL_TEST);
+	if (reflectionOn)
+		renderReflection(windowWidth, windowHeight);
+	gpuTimerBegin(mainTimer);
+	if (!reflectionOn) {
+		// reflection drawn in place, where the stencil marks the water
+		stateStencilFunc(GL_GREATER, 0x1, 0x3);
+		stateStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 
+		draw_water();
 
-	loc = glGetUniformLocation(shader.getProgramIndex(), "fogEffectOn");
-	if (fogEffectOn == true)
-		glUniform1i(loc, 1);
-	else
-		glUniform1i(loc, 0);
+		stateStencilFunc(GL_EQUAL, 0x1, 0x1);
+		stateStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
-	loc = glGetUniformLocation(shader.getProgramIndex(), "spotCosCutOff");
-	glUniform1f(loc, 0.93f);
+		shadowMode_uniform.set(0);
 
-	glUniform1i(shadowMode_uniformId, 0);
+		lightPos[1] *= (-1.0f);
+		directionalLightDir[1] *= (-1.0f);
+		sendLights(true, false);
 
-	lightPos[1] *= (-1.0f);
-	directionalLightDir[1] *= (-1.0f);
-	multMatrixPoint(VIEW, directionalLightDir, res);
-	glUniform4fv(ldirpos, 1, res);
+		pushMatrix(MODEL);
+		scale(MODEL, 1.0f, -1.0f, 1.0f);
+		stateCullFace(GL_FRONT);
+		renderMainScene(false, true);
+		stateCullFace(GL_BACK);
+		popMatrix(MODEL);
 
-	//send the point light positions
-	for (int i = 0; i < 6; i++) {
-		pointLightPos[i][1] *= (-1.0f);
-		multMatrixPoint(VIEW, pointLightPos[i], res);
-		glUniform4fv(lPos_uniformId[i], 1, res);
+		lightPos[1] *= (-1.0f);
+		directionalLightDir[1] *= (-1.0f);
 	}
 
-	for (int i = 0; i < 2; i++) {
-		spotLightPos[i][1] *= (-1.0f);
-		multMatrixPoint(VIEW, spotLightPos[i], res);
-		glUniform4fv(lPos_uniformId[6 + i], 1, res);
+	stateStencilFunc(GL_EQUAL, 0x0, 0x2);
+	stateStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+	sendLights(false, false);
+
+	// opaque objects first, then the sky only where they left the far plane; deferred,
+	// they go to the G-buffer and every pixel is lit once, before the rest is drawn
+	if (deferredOn && !deferredBegin(windowWidth, windowHeight))
+		deferredOn = false;
+	if (deferredOn) {
+		setGBufferPass(true);
+		renderMainScene(false, false, false);
+		setGBufferPass(false);
+		deferredEnd();
+		stateUseProgram(shader.getProgramIndex());
 	}
-	loc = glGetUniformLocation(shader.getProgramIndex(), "coneDir");
-	multMatrixPoint(VIEW, coneDir, res);
-	glUniform4fv(loc, 1, res);
-
-	pushMatrix(MODEL);
-	scale(MODEL, 1.0f, -1.0f, 1.0f);
-	glCullFace(GL_FRONT);
-	renderMainScene(false, true);
-	glCullFace(GL_BACK);
-	popMatrix(MODEL);
-     
-	glStencilFunc(GL_NOTEQUAL, 0x2, 0x0); // reset outer shader
-	glStencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE);
-
-	glStencilFunc(GL_EQUAL, 0x0, 0x2);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-
-	lightPos[1] *= (-1.0f);
-	directionalLightDir[1] *= (-1.0f);
-	multMatrixPoint(VIEW, directionalLightDir, res);
-	glUniform4fv(ldirpos, 1, res);
-
-	//send the point light positions
-	for (int i = 0; i < 6; i++) {
-		pointLightPos[i][1] *= (-1.0f);
-		multMatrixPoint(VIEW, pointLightPos[i], res);
-		glUniform4fv(lPos_uniformId[i], 1, res);
+	else
+		renderMainScene(false, false, false);
+	if (reflectionOn)
+		draw_water(true);	// opaque with its reflection, it hides what is under it
+	gpuTimerBegin(skyTimer);
+	drawSky();
+	gpuTimerEnd(skyTimer);
+
+	if (oitOn) {
+		// every transparent object (water included) in any order
+		if (oitBegin(windowWidth, windowHeight)) {
+			setOitPass(true);
+			renderTransparentObjects(false);
+			stateUseProgram(shader.getProgramIndex());
+			setTransparentBlend();
+			if (!reflectionOn)
+				draw_water();
+			setOitPass(false);
+			oitEnd();
+			stateUseProgram(shader.getProgramIndex());
+		}
+		else
+			oitOn = false;
 	}
-
-	for (int i = 0; i < 2; i++) {
-		spotLightPos[i][1] *= (-1.0f);
-		multMatrixPoint(VIEW, spotLightPos[i], res);
-		glUniform4fv(lPos_uniformId[6 + i], 1, res);
-	}
-	loc = glGetUniformLocation(shader.getProgramIndex(), "coneDir");
-	multMatrixPoint(VIEW, coneDir, res);
-	glUniform4fv(loc, 1, res);
-	renderMainScene(false, false);
-	glDepthMask(GL_FALSE);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	draw_water();
-	glDisable(GL_BLEND);
-	glDepthMask(GL_TRUE);
+	if (!oitOn) {
+		renderTransparentObjects(false);
+		stateDisable(GL_BLEND);
+		if (!reflectionOn) {
+			stateDepthMask(GL_FALSE);
+			stateEnable(GL_BLEND);
+			stateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			draw_water();
+			stateDisable(GL_BLEND);
+			stateDepthMask(GL_TRUE);
+		}
+	}
+	gpuTimerEnd(mainTimer);
 	renderHUD();
 
 
-	// REARVIEWTIME
-	glClear(GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_STENCIL_TEST);
-
-	glViewport(windowWidth / 2 - 200, windowHeight - 200, 400, 200);
-
-	loadIdentity(VIEW);
-	loadIdentity(MODEL);
-
-	lookAt(cams[3].camPos[0], cams[3].camPos[1], cams[3].camPos[2],
-		cams[3].camTarget[0], cams[3].camTarget[1], cams[3].camTarget[2],
-		0.0f, 1.0f, 0.0f);
-	glGetIntegerv(GL_VIEWPORT, m_view);
-	ratio = (float)(m_view[2] - m_view[0]) / (float)(m_view[3] - m_view[1]);
-
-	loadIdentity(PROJECTION);
-	
-	perspective(53.13f, ratio, 0.1f, 1000.0f);
-	glStencilFunc(GL_EQUAL, 0x2, 0x2);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-
-	glStencilFunc(GL_LESS, 0x1, 0x3);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-
-	draw_water();
-
-	glStencilFunc(GL_NOTEQUAL, 0x1, 0x1);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-
-	ldirpos = glGetUniformLocation(shader.getProgramIndex(), "dir_pos");
-
-	multMatrixPoint(VIEW, directionalLightDir, res);
-	glUniform4fv(ldirpos, 1, res);
+	// REARVIEWTIME: rendered into its own texture only when rearMirror asks for it,
+	// then pasted inside the stencil shape drawn by changeSize
+	int mirrorX = windowWidth / 2 - 200, mirrorY = windowHeight - 200;
+	if (rearMirrorBegin(400, 200, cams[3].camPos, cams[3].camTarget)) {
+		loadIdentity(VIEW);
+		loadIdentity(MODEL);
 
-	glUseProgram(shader.getProgramIndex());
+		lookAt(cams[3].camPos[0], cams[3].camPos[1], cams[3].camPos[2],
+			cams[3].camTarget[0], cams[3].camTarget[1], cams[3].camTarget[2],
+			0.0f, 1.0f, 0.0f);
 
-	loc = glGetUniformLocation(shader.getProgramIndex(), "isDay");
-	if (isDay == true)
-		glUniform1i(loc, 1);
-	else
-		glUniform1i(loc, 0);
-
-	loc = glGetUniformLocation(shader.getProgramIndex(), "pointLightsOn");
-	if (pointLightsOn == true)
-		glUniform1i(loc, 1);
-	else
-		glUniform1i(loc, 0);
+		loadIdentity(PROJECTION);
+		perspective(53.13f, 400.0f / 200.0f, 0.1f, 1000.0f);
+		stateUseProgram(shader.getProgramIndex());
+		sendLights(false, true);
 
-	loc = glGetUniformLocation(shader.getProgramIndex(), "fogEffectOn");
-	if (fogEffectOn == true)
-		glUniform1i(loc, 1);
-	else
-		glUniform1i(loc, 0);
+		// same stencil use as the main view: the reflection only where the water is
+		stateEnable(GL_STENCIL_TEST);
+		stateStencilFunc(GL_GREATER, 0x1, 0x3);
+		stateStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 
-	loc = glGetUniformLocation(shader.getProgramIndex(), "spotLightsOn");
-	glUniform1i(loc, 0);
+		draw_water();
 
-	glUniform1i(shadowMode_uniformId, 0);
+		stateStencilFunc(GL_EQUAL, 0x1, 0x1);
+		stateStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
+		shadowMode_uniform.set(0);
 
-	lightPos[1] *= (-1.0f);
-	directionalLightDir[1] *= (-1.0f);
-	multMatrixPoint(VIEW, directionalLightDir, res);
-	glUniform4fv(ldirpos, 1, res);
+		lightPos[1] *= (-1.0f);
+		directionalLightDir[1] *= (-1.0f);
+		sendLights(true, true);
 
-	//send the point light positions
-	for (int i = 0; i < 6; i++) {
-		pointLightPos[i][1] *= (-1.0f);
-		multMatrixPoint(VIEW, r_pointLightPos[i], res);
-		glUniform4fv(lPos_uniformId[i], 1, res);
+		pushMatrix(MODEL);
+		scale(MODEL, 1.0f, -1.0f, 1.0f);
+		stateCullFace(GL_FRONT);
+		renderMainScene(true, true);
+		stateCullFace(GL_BACK);
+		popMatrix(MODEL);
+		stateDisable(GL_STENCIL_TEST);
+
+		lightPos[1] *= (-1.0f);
+		directionalLightDir[1] *= (-1.0f);
+		sendLights(false, true);
+
+		renderMainScene(true, false, false);
+		drawSky();
+		renderTransparentObjects(true);
+		stateDisable(GL_BLEND);
+		stateDepthMask(GL_FALSE);
+		stateDisable(GL_CULL_FACE);
+		stateEnable(GL_BLEND);
+		stateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		draw_water();
+		stateDisable(GL_BLEND);
+		stateDepthMask(GL_TRUE);
+		stateEnable(GL_CULL_FACE);
+		rearMirrorEnd();
 	}
-	pushMatrix(MODEL);
-	scale(MODEL, 1.0f, -1.0f, 1.0f);
-	glCullFace(GL_FRONT);
-	renderMainScene(true, true);
-	glCullFace(GL_BACK);
-	popMatrix(MODEL);
-	glStencilFunc(GL_NOTEQUAL, 0x2, 0x0); // reset outer shader
-	glStencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE);
 
-	glStencilFunc(GL_EQUAL, 0x2, 0x2);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-
-	lightPos[1] *= (-1.0f);
-	directionalLightDir[1] *= (-1.0f);
-	multMatrixPoint(VIEW, directionalLightDir, res);
-	glUniform4fv(ldirpos, 1, res);
-
-	//send the point light positions
-	for (int i = 0; i < 6; i++) {
-		pointLightPos[i][1] *= (-1.0f);
-		multMatrixPoint(VIEW, r_pointLightPos[i], res);
-		glUniform4fv(lPos_uniformId[i], 1, res);
-	}
-	glCullFace(GL_BACK);
-	renderMainScene(true, false);
-	glDepthMask(GL_FALSE);
-	glDisable(GL_CULL_FACE);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	draw_water();
-	glDisable(GL_BLEND);
-	glDepthMask(GL_TRUE);
-	glDisable(GL_STENCIL_TEST);
-	glEnable(GL_CULL_FACE);
+	stateEnable(GL_STENCIL_TEST);
+	stateStencilFunc(GL_EQUAL, 0x2, 0x2);
+	stateStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	rearMirrorComposite(mirrorX, mirrorY, 400, 200);
+	stateDisable(GL_STENCIL_TEST);
+	stateViewport(0, 0, windowWidth, windowHeight);
+	stateUseProgram(shader.getProgramIndex());
+	particleRendererEndFrame();
+	gpuTimerEnd(frameTimer);
+	gpuTimerEndFrame();
+
+#ifdef _DEBUG
+	// every uniform used while drawing must come from a handle resolved in setupShaders
+	int lookups = VSShaderLib::resetLookupCount();
+	if (lookups > 0 && FrameCount > 1)
+		printf("Frame %d: %d uniform lookups by name\n", FrameCount, lookups);
+#endif
 	glutSwapBuffers();
 }
 
@@ -1598,12 +2082,12 @@ void processKeys(unsigned char key, int xx, int yy)
 		case '0': 
 			printf("Camera Spherical Coordinates (%f, %f, %f)\n", alpha, beta, r);
 			break;
-		case 'm': glEnable(GL_MULTISAMPLE); break;
-		case '�': glDisable(GL_MULTISAMPLE); break;
+		case 'm': stateEnable(GL_MULTISAMPLE); break;
+		case '�': stateDisable(GL_MULTISAMPLE); break;
 
-		case '1': active = 0; break;
-		case '2': active = 1; break;
-		case '3': active = 2; break;
+		case '1': active = 0; occlusionInvalidate(); break;
+		case '2': active = 1; occlusionInvalidate(); break;
+		case '3': active = 2; occlusionInvalidate(); break;
 
 		case 'a':
 			if (isPaused) break;
@@ -1679,9 +2163,115 @@ void processKeys(unsigned char key, int xx, int yy)
 			isPaused = !isPaused;
 			break;
 		case 't':
-			fireworks = 1;
 			iniParticles();
 			break;
+		case 'u':
+			if (!gpuParticlesAvailable) {
+				printf("Compute shader particles not available.\n");
+				break;
+			}
+			// the state of one path is not carried over to the other
+			gpuParticlesOn = !gpuParticlesOn;
+			particles.setDeferred(gpuParticlesOn);
+			gpuParticlesClear();
+			printf(gpuParticlesOn ? "GPU particle simulation enabled.\n" : "GPU particle simulation disabled.\n");
+			break;
+		case 'i':
+			oitOn = !oitOn;
+			printf(oitOn ? "Order independent transparency enabled.\n" : "Order independent transparency disabled.\n");
+			break;
+		case 'b':
+			if (!batchAvailable) {
+				printf("Static mesh batching not available.\n");
+				break;
+			}
+			batchOn = !batchOn;
+			printf(batchOn ? "Static meshes drawn with one multi draw per pass.\n" : "Static meshes drawn one by one.\n");
+			break;
+
+		case 'v':
+			cullSetEnabled(!cullEnabled());
+			printf(cullEnabled() ? "Frustum culling enabled.\n" : "Frustum culling disabled.\n");
+			break;
+		case 'x':
+			occlusionSetEnabled(!occlusionEnabled());
+			printf(occlusionEnabled() ? "Occlusion culling enabled.\n" : "Occlusion culling disabled.\n");
+			break;
+		case 'z':
+			softOcclusionOn = !softOcclusionOn;
+			printf(softOcclusionOn ? "Software occlusion culling enabled.\n" : "Software occlusion culling disabled.\n");
+			break;
+
+		case 'k': {
+			// rear-view mirror: full quality, then cheaper and staler
+			static const REAR_MIRROR_SETTINGS presets[] = { { 1.0f, 1, 0.0f }, { 0.5f, 3, 1.0f }, { 0.5f, 6, 2.0f }, { 0.25f, 10, 4.0f } };
+			static int preset = 1;
+			preset = (preset + 1) % (sizeof(presets) / sizeof(presets[0]));
+			rearMirrorSettings() = presets[preset];
+			rearMirrorInvalidate();
+			printf("Rear mirror at %.0f%% resolution, every %d frames or %.1f units of movement.\n",
+				presets[preset].resolution * 100.0f, presets[preset].interval, presets[preset].moveThreshold);
+			break;
+		}
+
+		case 'j':
+			// water reflection: half resolution target, quarter, then the stencil pass
+			if (reflectionOn && reflectionScale() > 0.25f)
+				reflectionSetScale(0.25f);
+			else if (reflectionOn)
+				reflectionOn = false;
+			else {
+				reflectionOn = true;
+				reflectionSetScale(0.5f);
+			}
+			if (reflectionOn)
+				printf("Water reflection at %.0f%% resolution.\n", reflectionScale() * 100.0f);
+			else
+				printf("Water reflection drawn in place with the stencil.\n");
+			break;
+
+		case 'e':
+			if (!envProbeAvailable) {
+				printf("Environment probe not available.\n");
+				break;
+			}
+			envProbeOn = !envProbeOn;
+			printf(envProbeOn ? "Environment probe enabled.\n" : "Environment probe disabled.\n");
+			break;
+
+		case 'l':
+			variantsOn = !variantsOn;
+			if (variantsOn)
+				printf("Shader variants enabled, %d built.\n", shader.getVariantCount());
+			else
+				printf("Shader variants disabled, generic phong shader.\n");
+			break;
+
+		case 'w':
+			// off, then more PCF taps
+			if (!shadowsOn) {
+				shadowsOn = true;
+				shadowMapSetFilter(0);
+			}
+			else if (shadowMapFilter() < SHADOW_MAP_MAX_FILTER)
+				shadowMapSetFilter(shadowMapFilter() + 1);
+			else
+				shadowsOn = false;
+			if (shadowsOn)
+				printf("Sun shadows, %dx%d PCF taps.\n", 2 * shadowMapFilter() + 1, 2 * shadowMapFilter() + 1);
+			else
+				printf("Sun shadows disabled.\n");
+			break;
+
+		case 'q':
+			deferredOn = !deferredOn;
+			printf(deferredOn ? "Deferred shading of the main view.\n" : "Forward shading of the main view.\n");
+			break;
+
+		case 'y':
+			skyboxOn = !skyboxOn;
+			printf(skyboxOn ? "Sky cube enabled.\n" : "Sky cube disabled, color cleared every frame.\n");
+			break;
 
 		case 'r':
 			resetGame();
@@ -1806,11 +2396,14 @@ GLuint setupShaders() {
 
 	// set semantics for the shader variables
 	glBindFragDataLocation(shader.getProgramIndex(), 0,"colorOut");
+	glBindFragDataLocation(shader.getProgramIndex(), 1, "revealOut");
 	glBindAttribLocation(shader.getProgramIndex(), VERTEX_COORD_ATTRIB, "position");
 	glBindAttribLocation(shader.getProgramIndex(), NORMAL_ATTRIB, "normal");
 	glBindAttribLocation(shader.getProgramIndex(), TEXTURE_COORD_ATTRIB, "texCoord");
+	glBindAttribLocation(shader.getProgramIndex(), TANGENT_ATTRIB, "tangent");
+	glBindAttribLocation(shader.getProgramIndex(), BATCH_DRAW_ID_ATTRIB, "drawId");
 
-	glLinkProgram(shader.getProgramIndex());
+	shader.prepareProgram();
 	printf("InfoLog for Model Rendering Shader\n%s\n\n", shaderText.getAllInfoLogs().c_str());
 
 	if (!shader.isProgramValid()) {
@@ -1819,35 +2412,47 @@ GLuint setupShaders() {
 		exit(1);
 	}
 
-	pvm_uniformId = glGetUniformLocation(shader.getProgramIndex(), "m_pvm");
-	vm_uniformId = glGetUniformLocation(shader.getProgramIndex(), "m_viewModel");
-	normal_uniformId = glGetUniformLocation(shader.getProgramIndex(), "m_normal");
-	normalMap_loc = glGetUniformLocation(shader.getProgramIndex(), "normalMap");
-	specularMap_loc = glGetUniformLocation(shader.getProgramIndex(), "specularMap");
-	diffMapCount_loc = glGetUniformLocation(shader.getProgramIndex(), "diffMapCount");
+	pvm_uniform = shader.getUniform<mat4>("m_pvm");
+	vm_uniform = shader.getUniform<mat4>("m_viewModel");
+	normal_uniform = shader.getUniform<mat3>("m_normal");
+	normalMap_uniform = shader.getUniform<int>("normalMap");
+	specularMap_uniform = shader.getUniform<int>("specularMap");
+	diffMapCount_uniform = shader.getUniform<unsigned int>("diffMapCount");
 	glUniform1d(lightEnabledId, 1);
 	
-	ldirpos = glGetUniformLocation(shader.getProgramIndex(), "dir_pos");
-	GLint LightsUniformLoc = glGetUniformLocation(shader.getProgramIndex(), "point_pos");
-	for (int i = 0; i < 6; i++) {
-		std::string result = "point_pos[" + std::to_string(i) + "]";
-		const GLchar* glString = result.c_str();
-		lPos_uniformId[i] = glGetUniformLocation(shader.getProgramIndex(), glString);
-	}
 
-	LightsUniformLoc = glGetUniformLocation(shader.getProgramIndex(), "spot_pos");
-	for (int i = 0; i < 2; i++) {
-		std::string result = "spot_pos[" + std::to_string(i) + "]";
-		const GLchar* glString = result.c_str();
-		lPos_uniformId[6 + i] = glGetUniformLocation(shader.getProgramIndex(), glString);
-	}
-  
-	texMode_uniformId = glGetUniformLocation(shader.getProgramIndex(), "texMode");
-	shadowMode_uniformId = glGetUniformLocation(shader.getProgramIndex(), "shadowMode");
-	tex_loc = glGetUniformLocation(shader.getProgramIndex(), "texmap");
-	tex_loc1 = glGetUniformLocation(shader.getProgramIndex(), "texmap1");
-	tex_loc2 = glGetUniformLocation(shader.getProgramIndex(), "texmap2");
-	tex_flare = glGetUniformLocation(shader.getProgramIndex(), "tex_flare");
+	texMode_uniform = shader.getUniform<int>("texMode");
+	shadowMode_uniform = shader.getUniform<int>("shadowMode");
+	tex_uniform = shader.getUniform<int>("texmap");
+	tex1_uniform = shader.getUniform<int>("texmap1");
+	oitPass_uniform = shader.getUniform<int>("oitPass");
+	batched_uniform = shader.getUniform<int>("batched");
+	reflectionOn_uniform = shader.getUniform<int>("reflectionOn");
+	envLevels_uniform = shader.getUniform<float>("envLevels");
+
+	matIndex_uniform = shader.getUniform<int>("matIndex");
+
+	RENDER_QUEUE_UNIFORMS queueUniforms;
+	queueUniforms.pvm = pvm_uniform;
+	queueUniforms.vm = vm_uniform;
+	queueUniforms.normal = normal_uniform;
+	queueUniforms.texMode = texMode_uniform;
+	queueUniforms.matIndex = matIndex_uniform;
+	queueUniforms.useProgram = usePhongTexMode;
+	renderQueueInit(queueUniforms);
+
+	// the tree sampler always reads TU2, the water reflection its own unit
+	glProgramUniform1i(shader.getProgramIndex(), shader.getUniformLocation("texmap2"), 2);
+	glProgramUniform1i(shader.getProgramIndex(), shader.getUniformLocation("reflectionMap"), REFLECTION_TEXTURE_UNIT);
+	glProgramUniform1i(shader.getProgramIndex(), shader.getUniformLocation("envMap"), ENV_PROBE_TEXTURE_UNIT);
+	glProgramUniform1i(shader.getProgramIndex(), shader.getUniformLocation("shadowMap"), SHADOW_MAP_TEXTURE_UNIT);
+	texUnitDiff_uniform = shader.getUniform<int>("texUnitDiff");
+	texUnitDiff1_uniform = shader.getUniform<int>("texUnitDiff1");
+	texUnitSpec_uniform = shader.getUniform<int>("texUnitSpec");
+	texUnitNormalMap_uniform = shader.getUniform<int>("texUnitNormalMap");
+
+	// specialized copies of the shader, built when a draw first needs one
+	shader.setVariantFeatures(phongVariantDefines);
 	
 	printf("InfoLog for Per Fragment Phong Lightning Shader\n%s\n\n", shader.getAllInfoLogs().c_str());
 
@@ -1856,15 +2461,123 @@ GLuint setupShaders() {
 	shaderText.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/text.vert");
 	shaderText.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/text.frag");
 
-	glLinkProgram(shaderText.getProgramIndex());
+	shaderText.prepareProgram();
 	printf("InfoLog for Text Rendering Shader\n%s\n\n", shaderText.getAllInfoLogs().c_str());
 
 	if (!shaderText.isProgramValid()) {
 		printf("GLSL Text Program Not Valid!\n");
 		exit(1);
 	}
+
+	// Shader for instanced particles
+	shaderParticles.init();
+	shaderParticles.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/particle.vert");
+	shaderParticles.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/particle.frag");
+
+	glBindFragDataLocation(shaderParticles.getProgramIndex(), 0, "colorOut");
+	glBindFragDataLocation(shaderParticles.getProgramIndex(), 1, "revealOut");
+	shaderParticles.prepareProgram();
+	printf("InfoLog for Particle Rendering Shader\n%s\n\n", shaderParticles.getAllInfoLogs().c_str());
+
+	if (!shaderParticles.isProgramValid()) {
+		printf("GLSL Particle Program Not Valid!\n");
+		exit(1);
+	}
+
+	// Compute shader for the particle simulation; optional, the CPU path is used if it fails
+	shaderParticleSim.init();
+	shaderParticleSim.loadShader(VSShaderLib::COMPUTE_SHADER, "shaders/particles.comp");
+	shaderParticleSim.prepareProgram();
+	printf("InfoLog for Particle Simulation Shader\n%s\n\n", shaderParticleSim.getAllInfoLogs().c_str());
+
+	// Shader resolving the order independent transparency targets
+	shaderOITComposite.init();
+	shaderOITComposite.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/oit_composite.vert");
+	shaderOITComposite.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/oit_composite.frag");
+
+	glBindFragDataLocation(shaderOITComposite.getProgramIndex(), 0, "colorOut");
+	shaderOITComposite.prepareProgram();
+	printf("InfoLog for OIT Composite Shader\n%s\n\n", shaderOITComposite.getAllInfoLogs().c_str());
+
+	if (!shaderOITComposite.isProgramValid()) {
+		printf("GLSL OIT Composite Program Not Valid!\n");
+		exit(1);
+	}
+
+	// Shader of the occlusion query boxes, depth only
+	shaderOcclusion.init();
+	shaderOcclusion.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/occlusion.vert");
+	shaderOcclusion.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/occlusion.frag");
+	shaderOcclusion.prepareProgram();
+	printf("InfoLog for Occlusion Query Shader\n%s\n\n", shaderOcclusion.getAllInfoLogs().c_str());
+
+	if (!shaderOcclusion.isProgramValid()) {
+		printf("GLSL Occlusion Query Program Not Valid!\n");
+		exit(1);
+	}
+
+	// Shader pasting the rear-view mirror texture
+	shaderMirror.init();
+	shaderMirror.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/mirror.vert");
+	shaderMirror.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/mirror.frag");
+
+	glBindFragDataLocation(shaderMirror.getProgramIndex(), 0, "colorOut");
+	shaderMirror.prepareProgram();
+	printf("InfoLog for Mirror Shader\n%s\n\n", shaderMirror.getAllInfoLogs().c_str());
+
+	if (!shaderMirror.isProgramValid()) {
+		printf("GLSL Mirror Program Not Valid!\n");
+		exit(1);
+	}
+
+	// Shader of the sky cube
+	shaderSkybox.init();
+	shaderSkybox.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/skybox.vert");
+	shaderSkybox.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/skybox.frag");
+
+	glBindFragDataLocation(shaderSkybox.getProgramIndex(), 0, "colorOut");
+	shaderSkybox.prepareProgram();
+	printf("InfoLog for Skybox Shader\n%s\n\n", shaderSkybox.getAllInfoLogs().c_str());
+
+	if (!shaderSkybox.isProgramValid()) {
+		printf("GLSL Skybox Program Not Valid!\n");
+		exit(1);
+	}
+
+	// Shader of the deferred lighting pass
+	shaderDeferredLight.init();
+	shaderDeferredLight.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/deferred_light.vert");
+	shaderDeferredLight.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/deferred_light.frag");
+
+	glBindFragDataLocation(shaderDeferredLight.getProgramIndex(), 0, "colorOut");
+	shaderDeferredLight.prepareProgram();
+	printf("InfoLog for Deferred Lighting Shader\n%s\n\n", shaderDeferredLight.getAllInfoLogs().c_str());
+
+	if (!shaderDeferredLight.isProgramValid()) {
+		printf("GLSL Deferred Lighting Program Not Valid!\n");
+		exit(1);
+	}
+	glProgramUniform1i(shaderDeferredLight.getProgramIndex(),
+		shaderDeferredLight.getUniformLocation("shadowMap"), SHADOW_MAP_TEXTURE_UNIT);
+	glProgramUniform1i(shaderDeferredLight.getProgramIndex(),
+		shaderDeferredLight.getUniformLocation("envMap"), ENV_PROBE_TEXTURE_UNIT);
+
+	// Shader of the shadow map casters
+	shaderShadow.init();
+	shaderShadow.loadShader(VSShaderLib::VERTEX_SHADER, "shaders/shadow_depth.vert");
+	shaderShadow.loadShader(VSShaderLib::FRAGMENT_SHADER, "shaders/shadow_depth.frag");
+
+	glBindAttribLocation(shaderShadow.getProgramIndex(), VERTEX_COORD_ATTRIB, "position");
+	shaderShadow.prepareProgram();
+	printf("InfoLog for Shadow Map Shader\n%s\n\n", shaderShadow.getAllInfoLogs().c_str());
+
+	if (!shaderShadow.isProgramValid()) {
+		printf("GLSL Shadow Map Program Not Valid!\n");
+		exit(1);
+	}
+	shadowPvm_uniform = shaderShadow.getUniform<mat4>("m_pvm");
 	
-	return(shader.isProgramLinked() && shaderText.isProgramLinked());
+	return(shader.isProgramLinked() && shaderText.isProgramLinked() && shaderParticles.isProgramLinked());
 }
 
 // ------------------------------------------------------------
@@ -1891,6 +2604,69 @@ void initCams() {
 }
 
 
+// every material goes to the table once; draws only send materialId
+void initMaterials() {
+	for (MyMesh& m : myMeshes)
+		m.materialId = materialAdd(m.mat);
+	for (MyMesh& m : fishMeshes)
+		m.materialId = materialAdd(m.mat);
+	for (MyMesh& m : assimpMeshes)
+		m.materialId = materialAdd(m.mat, 0.2f);	// varnished boat
+	myMeshes[0].materialId = materialAdd(myMeshes[0].mat, 0.5f);	// water
+
+	// flare elements: only the diffuse color is used, modulated by the element texture
+	for (int i = 0; i < AVTflare.nPieces; i++) {
+		struct Material mat;
+		memset(&mat, 0, sizeof(mat));
+		memcpy(mat.diffuse, AVTflare.element[i].matDiffuse, 4 * sizeof(float));
+		AVTflare.element[i].materialId = materialAdd(mat);
+	}
+
+	materialUpload();
+	printf("Materials: %d in the table\n", materialCount());
+}
+
+// the boat joins the batch only if its meshes can be drawn with the same textures bound
+bool sameTextures(const MyMesh& a, const MyMesh& b) {
+	if (a.mat.texCount != b.mat.texCount)
+		return false;
+	for (int i = 0; i < a.mat.texCount; i++)
+		if (a.texUnits[i] != b.texUnits[i] || a.texTypes[i] != b.texTypes[i])
+			return false;
+	return true;
+}
+
+void initStaticBatch() {
+	boatBatched = !assimpMeshes.empty();
+	for (MyMesh& m : assimpMeshes)
+		if (!sameTextures(m, assimpMeshes[0]))
+			boatBatched = false;
+
+	batchAvailable = batchBuild(batched_uniform);
+	batchOn = batchAvailable;
+}
+
+int addOccluder(const MyMesh& mesh) {
+	std::vector<float> positions;
+	std::vector<GLuint> indices;
+	if (!meshArenaGeometry(mesh, positions, indices))
+		return -1;
+	return softOcclusionAddOccluder(positions.data(), (int)positions.size() / 3, indices.data(), (int)indices.size());
+}
+
+// the island, the house and the boat hide most of what is behind them; the workers
+// leave one hardware thread to the main loop
+void initSoftOcclusion() {
+	islandOccluder = addOccluder(myMeshes[1]);
+	houseOccluder = addOccluder(myMeshes[2]);
+	roofOccluder = addOccluder(myMeshes[3]);
+	for (MyMesh& m : assimpMeshes)
+		boatOccluders.push_back(addOccluder(m));
+
+	int threads = (int)std::thread::hardware_concurrency() - 2;
+	softOcclusionInit(threads > 0 ? threads : 0);
+}
+
 void init()
 {
 	// set the lights
@@ -1920,6 +2696,19 @@ void init()
 	Texture2D_Loader(TextureArray, "billboards/tree.tga", 2);
 	Texture2D_Loader(TextureArray, "billboards/particle.tga", 3);
 
+	// sky cube map, in place of the environment probe until all its faces are rendered
+	const char* skyboxFaces[6] = { "skybox/posx.jpg", "skybox/negx.jpg", "skybox/posy.jpg",
+		"skybox/negy.jpg", "skybox/posz.jpg", "skybox/negz.jpg" };
+	glGenTextures(1, &skyboxTexture);
+	TextureCubeMap_Loader(&skyboxTexture, skyboxFaces, 0);
+	stateEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+	envProbeAvailable = envProbeInit(128, 4, skyboxTexture);
+	envProbeOn = envProbeAvailable;
+	glProgramUniform1f(shader.getProgramIndex(), envLevels_uniform.location(), (float)envProbeLevels());
+	glProgramUniform1f(shaderDeferredLight.getProgramIndex(),
+		shaderDeferredLight.getUniformLocation("envLevels"), (float)envProbeLevels());
+	envProbeBindTexture();
+
 	//Flare elements textures
 	glGenTextures(5, FlareTextureArray);
 	Texture2D_Loader(FlareTextureArray, "crcl.tga", 0);
@@ -1940,7 +2729,7 @@ void init()
 	float shininess = 50.0f;
 	int texcount = 0;
 
-	amesh = createCube();
+	amesh = createQuad(1.0f, 1.0f);
 	memcpy(amesh.mat.ambient, amb0, 4 * sizeof(float));
 	memcpy(amesh.mat.diffuse, diff0, 4 * sizeof(float));
 	memcpy(amesh.mat.specular, spec0, 4 * sizeof(float));
@@ -2138,22 +2927,46 @@ void init()
 	//Load flare from file
 	loadFlareFile(&AVTflare, "flare.txt");
 
+	initParticleEmitters();
+	oitInit(shaderOITComposite);
+	rearMirrorInit(shaderMirror);
+	reflectionInit();
+	skyboxInit(shaderSkybox);
+	occlusionInit(shaderOcclusion);
+	lightClustersInit();
+	deferredInit(shaderDeferredLight);
+	if (!shadowMapInit(1024))
+		shadowsOn = false;
+	frameTimer = gpuTimerCreate("FRAME");
+	mainTimer = gpuTimerCreate("MAIN");
+	skyTimer = gpuTimerCreate("SKY");
+	shadowTimer = gpuTimerCreate("SHADOW");
+
 
 	std::string filepath = "boat/boat.obj";
 	if (!Import3DFromFile(filepath, importer, scene, scaleFactor))
 		return;
 	assimpMeshes = createMeshFromAssimp(scene, textureIds);
+	initSoftOcclusion();	// reads the geometry back from the arena before it goes to GL
+	meshArenaBuild();
+
+	initMaterials();
+	initStaticBatch();
+	buoyOcclusion = occlusionAddGroup(6);
+	fishOcclusion = occlusionAddGroup(maxFish);
 
+	// the texture and mesh loaders bind state behind the cache
+	stateInvalidate();
 
 	// some GL settings
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_MULTISAMPLE);
+	stateEnable(GL_DEPTH_TEST);
+	stateEnable(GL_CULL_FACE);
+	stateEnable(GL_MULTISAMPLE);
 	//glDeleteTextures(2, TextureArray);
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
 	glClearStencil(0x0);
-	glEnable(GL_STENCIL_TEST);
+	stateEnable(GL_STENCIL_TEST);
 
 	initCams();
 
@@ -2167,6 +2980,14 @@ void init()
 
 int main(int argc, char **argv) {
 
+	// CPU benchmarks, no window or GL context required
+	if (argc > 1 && strcmp(argv[1], "-bench") == 0) {
+		particleBenchmark(1000000, 200);
+		softOcclusionBenchmark(4096, 200);
+		lightClustersBenchmark(512, 200);
+		return(0);
+	}
+
 //  GLUT initialization
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH|GLUT_DOUBLE|GLUT_RGBA|GLUT_MULTISAMPLE|GLUT_STENCIL);
@@ -2179,8 +3000,8 @@ int main(int argc, char **argv) {
 	glutInitWindowSize(WinX, WinY);
 	WindowHandle = glutCreateWindow(CAPTION);
 
-	//glEnable(GL_BLEND); //TRANS
-	//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  //TRANS
+	//stateEnable(GL_BLEND); //TRANS
+	//stateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  //TRANS
 
 
 
@@ -2221,6 +3042,8 @@ int main(int argc, char **argv) {
 	//  GLUT main loop
 	glutMainLoop();
 
+	softOcclusionShutdown();
+
 	return(0);
 }
 
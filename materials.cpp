@@ -0,0 +1,72 @@
+/* --------------------------------------------------
+Material table
+ *
+ * The Material of every mesh is copied, once, into a shader storage buffer
+ * read by the phong shader as materials[matIndex]. Draws set matIndex instead
+ * of the six mat.* uniforms.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "geometry.h"
+#include "materials.h"
+
+typedef struct {
+	float	diffuse[4];
+	float	ambient[4];
+	float	specular[4];
+	float	emissive[4];
+	float	shininess;
+	int		texCount;
+	float	reflectivity;
+	float	pad;		// std430 array stride of the struct is 80 bytes
+} GPU_MATERIAL;
+
+static std::vector<GPU_MATERIAL> table;
+static GLuint materialBuffer = 0;
+
+
+int materialAdd(const struct Material& mat, float reflectivity) {
+
+	GPU_MATERIAL m;
+	memset(&m, 0, sizeof(m));
+	memcpy(m.diffuse, mat.diffuse, 4 * sizeof(float));
+	memcpy(m.ambient, mat.ambient, 4 * sizeof(float));
+	memcpy(m.specular, mat.specular, 4 * sizeof(float));
+	memcpy(m.emissive, mat.emissive, 4 * sizeof(float));
+	m.shininess = mat.shininess;
+	m.texCount = mat.texCount;
+	m.reflectivity = reflectivity;
+
+	for (int i = 0; i < (int)table.size(); i++)
+		if (memcmp(&table[i], &m, sizeof(m)) == 0)
+			return i;
+
+	table.push_back(m);
+	return (int)table.size() - 1;
+}
+
+
+int materialCount() {
+
+	return (int)table.size();
+}
+
+
+void materialUpload() {
+
+	if (table.empty()) {
+		printf("Materials: no materials to upload\n");
+		return;
+	}
+	if (!materialBuffer)
+		glGenBuffers(1, &materialBuffer);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, table.size() * sizeof(GPU_MATERIAL), table.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING, materialBuffer);
+}
@@ -0,0 +1,24 @@
+#ifndef __MATERIALS_H
+#define __MATERIALS_H
+
+struct Material;	// geometry.h
+
+/* --- Defines --- */
+
+// shader storage binding of the MaterialTable buffer in shaders/pointlight_phong.frag
+// (0-5 are taken by the particle simulation)
+#define MATERIAL_BINDING 6
+
+/* --- Functions --- */
+
+// All materials live in one shader storage buffer, filled at load time;
+// a draw only sends the index of its material.
+
+// adds a material to the table and returns its index; identical materials share one entry.
+// reflectivity: how much of the environment probe (envProbe.h) it mirrors, 0 to 1
+int  materialAdd(const struct Material& mat, float reflectivity = 0.0f);
+int  materialCount();
+// creates the buffer with every material added so far and binds it to MATERIAL_BINDING
+void materialUpload();
+
+#endif
@@ -0,0 +1,330 @@
+/* --------------------------------------------------
+Mesh arena
+ *
+ * Vertices are kept interleaved in the layout chosen, encoded as they are
+ * added, and indices stay relative to their mesh, so a mesh is drawn with
+ * glDrawElementsBaseVertex at its own range. Until meshArenaBuild everything
+ * is staged in memory; the VAO name is handed out on the first add so meshes
+ * can keep it.
+ *
+ * The packed layout relies on the vertex fetch to decode: 2_10_10_10_REV
+ * normalized and half floats reach the shader as floats, and missing
+ * components still read as (0,0,0,1).
+ *
+ * Every mesh goes through meshOptimizer.h as it is added: triangles are
+ * reordered for the vertex cache and against overdraw, and vertices are
+ * stored in the order the triangles first use them, dropping unused ones.
+ * Indices are relative to baseVertex, so the index buffer is 16 bit as long
+ * as every mesh has fewer than 65536 vertices. The type is the same for the
+ * whole buffer, since a batch draws many meshes with one index type.
+----------------------------------------------------*/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "VertexAttrDef.h"
+#include "geometry.h"
+#include "meshArena.h"
+#include "meshOptimizer.h"
+#include "glStateCache.h"
+
+typedef struct {
+	GLint		size;
+	GLenum		type;
+	GLboolean	normalized;
+	int			offset;
+} ARENA_ATTRIB;
+
+typedef struct {
+	int				stride;
+	ARENA_ATTRIB	attrib[ARENA_STREAMS];
+} ARENA_FORMAT;
+
+// indexed by ARENA_LAYOUT; attributes in stream order
+static const ARENA_FORMAT formats[] = {
+	{ 64, { { 4, GL_FLOAT, GL_FALSE, 0 }, { 4, GL_FLOAT, GL_FALSE, 16 },
+			{ 4, GL_FLOAT, GL_FALSE, 32 }, { 4, GL_FLOAT, GL_FALSE, 48 } } },
+	{ 24, { { 3, GL_FLOAT, GL_FALSE, 0 }, { 4, GL_INT_2_10_10_10_REV, GL_TRUE, 12 },
+			{ 2, GL_HALF_FLOAT, GL_FALSE, 20 }, { 4, GL_INT_2_10_10_10_REV, GL_TRUE, 16 } } }
+};
+
+static const GLuint attribs[ARENA_STREAMS] = { VERTEX_COORD_ATTRIB, NORMAL_ATTRIB, TEXTURE_COORD_ATTRIB, TANGENT_ATTRIB };
+
+static const ARENA_FORMAT* format = &formats[ARENA_LAYOUT_PACKED];
+static std::vector<unsigned char> vertices;
+static std::vector<GLuint> indices;
+static GLuint arenaVAO = 0, vertexBuffer = 0, indexBuffer = 0;
+static GLenum indexType = GL_UNSIGNED_INT;
+static GLuint largestMesh = 0;		// vertices
+static bool built = false;
+static int meshes = 0;
+
+static std::map<std::string, MyMesh> registry;
+static int registryHits = 0;
+
+
+static int snorm(float f, int bits) {
+
+	int max = (1 << (bits - 1)) - 1;
+	if (f > 1.0f) f = 1.0f;
+	if (f < -1.0f) f = -1.0f;
+	return (int)floorf(f * max + 0.5f);
+}
+
+
+static GLuint packSnorm1010102(const float v[4]) {
+
+	return (snorm(v[0], 10) & 0x3FF) | ((snorm(v[1], 10) & 0x3FF) << 10) |
+		((snorm(v[2], 10) & 0x3FF) << 20) | ((GLuint)(snorm(v[3], 2) & 0x3) << 30);
+}
+
+
+// round to nearest; values below the half float normal range become zero
+static unsigned short packHalf(float f) {
+
+	GLuint x;
+	memcpy(&x, &f, sizeof(x));
+	GLuint sign = (x >> 16) & 0x8000;
+	int exponent = (int)((x >> 23) & 0xFF) - 127 + 15;
+	GLuint mantissa = x & 0x7FFFFF;
+
+	if (exponent <= 0)
+		return (unsigned short)sign;
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7C00);
+	GLuint h = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		h++;
+	return (unsigned short)h;
+}
+
+
+// centre of the bounding box and the farthest vertex from it
+static void computeBounds(const float* positions, int size, GLuint numVertices, const std::vector<int>& remap, float bounds[4]) {
+
+	float lo[3] = { 1e30f, 1e30f, 1e30f }, hi[3] = { -1e30f, -1e30f, -1e30f };
+	float radius2 = 0.0f;
+
+	bounds[0] = bounds[1] = bounds[2] = 0.0f;
+	bounds[3] = 1e30f;
+	if (!positions)
+		return;
+	for (GLuint i = 0; i < numVertices; i++)
+		if (remap[i] >= 0)
+			for (int c = 0; c < size && c < 3; c++) {
+				lo[c] = fminf(lo[c], positions[i * size + c]);
+				hi[c] = fmaxf(hi[c], positions[i * size + c]);
+			}
+	for (int c = 0; c < 3; c++)
+		bounds[c] = c < size && lo[c] <= hi[c] ? 0.5f * (lo[c] + hi[c]) : 0.0f;
+	for (GLuint i = 0; i < numVertices; i++)
+		if (remap[i] >= 0) {
+			float d2 = 0.0f;
+			for (int c = 0; c < size && c < 3; c++)
+				d2 += (positions[i * size + c] - bounds[c]) * (positions[i * size + c] - bounds[c]);
+			radius2 = fmaxf(radius2, d2);
+		}
+	bounds[3] = sqrtf(radius2);
+}
+
+
+static void encodeVertex(const float v[ARENA_STREAMS][4], unsigned char* dst) {
+
+	for (int s = 0; s < ARENA_STREAMS; s++) {
+		const ARENA_ATTRIB& a = format->attrib[s];
+		unsigned char* d = dst + a.offset;
+
+		if (a.type == GL_FLOAT)
+			memcpy(d, v[s], a.size * sizeof(float));
+		else if (a.type == GL_INT_2_10_10_10_REV) {
+			GLuint packed = packSnorm1010102(v[s]);
+			memcpy(d, &packed, sizeof(packed));
+		}
+		else if (a.type == GL_HALF_FLOAT)
+			for (int c = 0; c < a.size; c++) {
+				unsigned short h = packHalf(v[s][c]);
+				memcpy(d + c * sizeof(h), &h, sizeof(h));
+			}
+	}
+}
+
+
+void meshArenaSetLayout(ARENA_LAYOUT layout) {
+
+	if (!vertices.empty() || built) {
+		printf("Mesh arena: meshes already added, layout not changed\n");
+		return;
+	}
+	format = &formats[layout];
+}
+
+
+bool meshArenaAdd(struct MyMesh& mesh, GLuint numVertices, const float* const streams[ARENA_STREAMS],
+		const int sizes[ARENA_STREAMS], GLuint numIndices, const GLuint* meshIndices) {
+
+	static const float defaults[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	float v[ARENA_STREAMS][4];
+
+	if (built) {
+		printf("Mesh arena: already uploaded, mesh not added\n");
+		return false;
+	}
+	if (!arenaVAO)
+		glGenVertexArrays(1, &arenaVAO);
+
+	std::vector<GLuint> optimized(meshIndices, meshIndices + numIndices);
+	std::vector<int> remap;
+	float acmr = meshACMR(optimized, numVertices), atvr = meshATVR(optimized, numVertices);
+	meshOptimizeTriangles(optimized, numVertices, streams[0], sizes[0]);
+	GLuint usedVertices = meshOptimizeVertexFetch(optimized, numVertices, remap);
+	printf("Mesh arena: mesh %d, %d vertices, %d triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+		meshes, usedVertices, numIndices / 3, acmr, meshACMR(optimized, usedVertices),
+		atvr, meshATVR(optimized, usedVertices));
+
+	size_t first = vertices.size();
+	vertices.resize(first + (size_t)usedVertices * format->stride);
+	for (GLuint i = 0; i < numVertices; i++) {
+		if (remap[i] < 0)
+			continue;
+		for (int s = 0; s < ARENA_STREAMS; s++) {
+			memcpy(v[s], defaults, sizeof(defaults));
+			if (streams[s])
+				memcpy(v[s], streams[s] + (size_t)i * sizes[s], sizes[s] * sizeof(float));
+		}
+		encodeVertex(v, &vertices[first + (size_t)remap[i] * format->stride]);
+	}
+	if (usedVertices > largestMesh)
+		largestMesh = usedVertices;
+	computeBounds(streams[0], sizes[0], numVertices, remap, mesh.bounds);
+
+	mesh.vao = arenaVAO;
+	mesh.firstIndex = (GLuint)indices.size();
+	mesh.baseVertex = (GLint)(first / format->stride);
+	mesh.numIndexes = numIndices;
+	indices.insert(indices.end(), optimized.begin(), optimized.end());
+	meshes++;
+	return true;
+}
+
+
+bool meshArenaGeometry(const struct MyMesh& mesh, std::vector<float>& positions, std::vector<GLuint>& meshIndices) {
+
+	if (built || mesh.vao != arenaVAO || mesh.firstIndex + mesh.numIndexes > indices.size()) {
+		printf("Mesh arena: geometry is only kept until the arena is uploaded\n");
+		return false;
+	}
+
+	GLuint numVertices = 0;
+	meshIndices.assign(indices.begin() + mesh.firstIndex, indices.begin() + mesh.firstIndex + mesh.numIndexes);
+	for (GLuint index : meshIndices)
+		if (index + 1 > numVertices)
+			numVertices = index + 1;
+
+	// positions are plain floats in every layout
+	const ARENA_ATTRIB& a = format->attrib[0];
+	positions.resize((size_t)numVertices * 3);
+	for (GLuint i = 0; i < numVertices; i++)
+		memcpy(&positions[i * 3], &vertices[((size_t)mesh.baseVertex + i) * format->stride + a.offset], 3 * sizeof(float));
+	return true;
+}
+
+
+void meshArenaAttribs() {
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	for (int s = 0; s < ARENA_STREAMS; s++) {
+		const ARENA_ATTRIB& a = format->attrib[s];
+		glEnableVertexAttribArray(attribs[s]);
+		glVertexAttribPointer(attribs[s], a.size, a.type, a.normalized, format->stride, (void*)(size_t)a.offset);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+}
+
+
+void meshArenaBuild() {
+
+	if (built || !arenaVAO)
+		return;
+
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	glGenBuffers(1, &indexBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+	if (largestMesh < 65536) {
+		std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+		indexType = GL_UNSIGNED_SHORT;
+		glBufferData(GL_COPY_WRITE_BUFFER, shortIndices.size() * sizeof(GLushort), shortIndices.data(), GL_STATIC_DRAW);
+	}
+	else
+		glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	stateBindVertexArray(arenaVAO);
+	meshArenaAttribs();
+	stateBindVertexArray(0);
+
+	printf("Mesh arena: %d meshes (%d shared), %d vertices of %d bytes, %d indices of %d bytes, %d KB\n", meshes,
+		registryHits, (int)(vertices.size() / format->stride), format->stride, (int)indices.size(), meshArenaIndexSize(),
+		(int)((vertices.size() + indices.size() * meshArenaIndexSize()) / 1024));
+
+	// the geometry only lives on the GPU from now on
+	std::vector<unsigned char>().swap(vertices);
+	std::vector<GLuint>().swap(indices);
+	built = true;
+}
+
+
+GLuint meshArenaVAO() {
+
+	return arenaVAO;
+}
+
+
+GLenum meshArenaIndexType() {
+
+	return indexType;
+}
+
+
+int meshArenaIndexSize() {
+
+	return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+
+bool meshRegistryFind(const char* key, struct MyMesh& mesh) {
+
+	std::map<std::string, MyMesh>::const_iterator it = registry.find(key);
+	if (it == registry.end())
+		return false;
+
+	mesh.vao = it->second.vao;
+	mesh.firstIndex = it->second.firstIndex;
+	mesh.baseVertex = it->second.baseVertex;
+	mesh.numIndexes = it->second.numIndexes;
+	mesh.type = it->second.type;
+	memcpy(mesh.bounds, it->second.bounds, sizeof(mesh.bounds));
+	registryHits++;
+	return true;
+}
+
+
+void meshRegistryAdd(const char* key, const struct MyMesh& mesh) {
+
+	registry[key] = mesh;
+}
+
+
+void meshDraw(const struct MyMesh& mesh) {
+
+	stateBindVertexArray(mesh.vao);
+	glDrawElementsBaseVertex(mesh.type, mesh.numIndexes, indexType,
+		(void*)(size_t)(mesh.firstIndex * meshArenaIndexSize()), mesh.baseVertex);
+}
@@ -0,0 +1,57 @@
+#ifndef __MESH_ARENA_H
+#define __MESH_ARENA_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+struct MyMesh;	// geometry.h
+
+/* --- Defines --- */
+
+// vertex streams given to the arena: position, normal, texture coordinate, tangent
+#define ARENA_STREAMS 4
+
+/* --- Types --- */
+
+// Interleaved vertex layouts; the shader sees the same vec4 attributes with either.
+//   FLOAT:  4 x vec4 float, 64 bytes
+//   PACKED: float3 position, 10:10:10:2 snorm normal and tangent (w = handedness),
+//           half float texture coordinate, 24 bytes
+typedef enum { ARENA_LAYOUT_FLOAT, ARENA_LAYOUT_PACKED } ARENA_LAYOUT;
+
+/* --- Functions --- */
+
+// All meshes share one vertex and one index buffer, drawn through one VAO.
+// A mesh is a range of them, at firstIndex and baseVertex. Meshes are appended
+// while loading; meshArenaBuild uploads them and nothing can be added after it.
+
+// PACKED unless changed before the first mesh is added
+void   meshArenaSetLayout(ARENA_LAYOUT layout);
+
+// streams[i] holds sizes[i] floats per vertex, or is NULL; missing components read
+// as GL gives them to the shader, (0,0,0,1). Indices are a triangle list, optimized
+// on the way in (meshOptimizer.h). Fills vao, firstIndex, baseVertex, numIndexes and bounds.
+bool   meshArenaAdd(struct MyMesh& mesh, GLuint numVertices, const float* const streams[ARENA_STREAMS],
+		const int sizes[ARENA_STREAMS], GLuint numIndices, const GLuint* indices);
+void   meshArenaBuild();
+// copy of the positions (xyz) and indices of a mesh, for CPU side users; only
+// while the arena is still staged, before meshArenaBuild
+bool   meshArenaGeometry(const struct MyMesh& mesh, std::vector<float>& positions, std::vector<GLuint>& meshIndices);
+GLuint meshArenaVAO();
+// GL_UNSIGNED_SHORT when every mesh has fewer than 65536 vertices, else GL_UNSIGNED_INT;
+// known after meshArenaBuild. firstIndex counts indices of this size.
+GLenum meshArenaIndexType();
+int    meshArenaIndexSize();
+// attaches the arena vertex and index buffers to the bound VAO
+void   meshArenaAttribs();
+
+// Generated geometry by generator and parameters, e.g. "cone 0.7 1 4": meshes with
+// the same key share their range of the arena; materials stay with each MyMesh.
+bool   meshRegistryFind(const char* key, struct MyMesh& mesh);
+void   meshRegistryAdd(const char* key, const struct MyMesh& mesh);
+
+// draws a whole mesh with the shader in use
+void   meshDraw(const struct MyMesh& mesh);
+
+#endif
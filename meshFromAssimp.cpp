@@ -35,6 +35,7 @@ Functions to handle with struct MyMesh based meshes from Assimp meshes:
 #include "VertexAttrDef.h"
 #include "geometry.h"
 #include "Texture_Loader.h"
+#include "meshArena.h"
 
 
 using namespace std;
@@ -191,8 +192,6 @@ vector<struct MyMesh> createMeshFromAssimp(const aiScene*& sc, GLuint*& textureI
 
 	vector<struct MyMesh> myMeshes;
 
-	GLuint buffer;
-
 	// unordered map which maps image filenames to texture units TU. This map is filled in the  LoadGLTexturesTUs()
 	unordered_map<std::string, GLuint> textureIdMap;
 
@@ -222,66 +221,27 @@ vector<struct MyMesh> createMeshFromAssimp(const aiScene*& sc, GLuint*& textureI
 		aMesh.type = GL_TRIANGLES;
 		aMesh.mat.texCount = 0;
 
-		// generate Vertex Array for mesh
-		glGenVertexArrays(1, &(aMesh.vao));
-		glBindVertexArray(aMesh.vao);
-
-		// buffer for faces
-		glGenBuffers(1, &buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * aMesh.numIndexes, faceArray, GL_STATIC_DRAW);
-
-		// buffer for vertex positions
-		if (mesh->HasPositions()) {
-			glGenBuffers(1, &buffer);
-			glBindBuffer(GL_ARRAY_BUFFER, buffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * mesh->mNumVertices, mesh->mVertices, GL_STATIC_DRAW);
-			glEnableVertexAttribArray(VERTEX_COORD_ATTRIB);
-			glVertexAttribPointer(VERTEX_COORD_ATTRIB, 3, GL_FLOAT, 0, 0, 0);
-		}
-
-		// buffer for vertex normals
-		if (mesh->HasNormals()) {
-			glGenBuffers(1, &buffer);
-			glBindBuffer(GL_ARRAY_BUFFER, buffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * mesh->mNumVertices, mesh->mNormals, GL_STATIC_DRAW);
-			glEnableVertexAttribArray(NORMAL_ATTRIB);
-			glVertexAttribPointer(NORMAL_ATTRIB, 3, GL_FLOAT, 0, 0, 0);
-		}
-
-		// buffers for vertex tangents and bitangents
-		if (mesh->HasTangentsAndBitangents()) {
-			glGenBuffers(1, &buffer);
-			glBindBuffer(GL_ARRAY_BUFFER, buffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * mesh->mNumVertices, mesh->mTangents, GL_STATIC_DRAW);
-			glEnableVertexAttribArray(TANGENT_ATTRIB);
-			glVertexAttribPointer(TANGENT_ATTRIB, 3, GL_FLOAT, 0, 0, 0);
-
-			glGenBuffers(1, &buffer);
-			glBindBuffer(GL_ARRAY_BUFFER, buffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * mesh->mNumVertices, mesh->mBitangents, GL_STATIC_DRAW);
-			glEnableVertexAttribArray(BITANGENT_ATTRIB);
-			glVertexAttribPointer(BITANGENT_ATTRIB, 3, GL_FLOAT, 0, 0, 0);
-		}
-
-		// buffer for vertex texture coordinates
+		// texture coordinates are 3D in Assimp, only s and t are used
+		float* texCoords = NULL;
 		if (mesh->HasTextureCoords(0)) {
-			float* texCoords = (float*)malloc(sizeof(float) * 2 * mesh->mNumVertices);
+			texCoords = (float*)malloc(sizeof(float) * 2 * mesh->mNumVertices);
 			for (unsigned int k = 0; k < mesh->mNumVertices; ++k) {
 				texCoords[k * 2] = mesh->mTextureCoords[0][k].x;
 				texCoords[k * 2 + 1] = mesh->mTextureCoords[0][k].y;
 			}
-			glGenBuffers(1, &buffer);
-			glBindBuffer(GL_ARRAY_BUFFER, buffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * mesh->mNumVertices, texCoords, GL_STATIC_DRAW);
-			glEnableVertexAttribArray(TEXTURE_COORD_ATTRIB);
-			glVertexAttribPointer(TEXTURE_COORD_ATTRIB, 2, GL_FLOAT, 0, 0, 0);
 		}
 
-		// unbind buffers
-		glBindVertexArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		// geometry goes to the mesh arena; the bitangent is rebuilt in the shader from normal and tangent
+		const float* streams[ARENA_STREAMS] = {
+			mesh->HasPositions() ? &mesh->mVertices[0].x : NULL,
+			mesh->HasNormals() ? &mesh->mNormals[0].x : NULL,
+			texCoords,
+			mesh->HasTangentsAndBitangents() ? &mesh->mTangents[0].x : NULL
+		};
+		const int sizes[ARENA_STREAMS] = { 3, 3, 2, 3 };
+		meshArenaAdd(aMesh, mesh->mNumVertices, streams, sizes, aMesh.numIndexes, faceArray);
+		free(texCoords);
+		free(faceArray);
 
 		// create material; each mesh has ONE material
 		aiMaterial* mtl = sc->mMaterials[mesh->mMaterialIndex];
@@ -0,0 +1,226 @@
+/* --------------------------------------------------
+Mesh optimization
+ *
+ * Triangle order follows Tipsify (Sander, Nehab and Barczak, "Fast triangle
+ * reordering for vertex locality and reduced overdraw", 2007): triangles are
+ * emitted as fans around a vertex, and the next fan vertex is the candidate
+ * that will still be in the cache, falling back to a dead-end stack and then
+ * to a linear scan.
+ *
+ * Every fallback starts a new cluster. Clusters are then sorted by how much
+ * they face away from the mesh centre, so outer surfaces are drawn first and
+ * hide what lies behind them. Reordering whole clusters keeps the cache
+ * behaviour of each.
+----------------------------------------------------*/
+#include <math.h>
+#include <algorithm>
+
+#include "meshOptimizer.h"
+
+typedef struct {
+	GLuint	first;		// first triangle
+	GLuint	count;
+	float	sortKey;
+} MESH_CLUSTER;
+
+
+// triangles using each vertex, as offsets into one list
+static void buildAdjacency(const std::vector<GLuint>& indices, GLuint numVertices,
+		std::vector<GLuint>& offset, std::vector<GLuint>& triangles) {
+
+	GLuint numTriangles = (GLuint)indices.size() / 3;
+	offset.assign(numVertices + 1, 0);
+	for (GLuint i = 0; i < numTriangles * 3; i++)
+		offset[indices[i] + 1]++;
+	for (GLuint v = 0; v < numVertices; v++)
+		offset[v + 1] += offset[v];
+
+	std::vector<GLuint> fill(offset.begin(), offset.end() - 1);
+	triangles.resize(numTriangles * 3);
+	for (GLuint i = 0; i < numTriangles * 3; i++)
+		triangles[fill[indices[i]]++] = i / 3;
+}
+
+
+// triangle order; a cluster starts at every triangle in `starts`
+static void tipsify(const std::vector<GLuint>& indices, GLuint numVertices,
+		std::vector<GLuint>& order, std::vector<GLuint>& starts) {
+
+	GLuint numTriangles = (GLuint)indices.size() / 3;
+	std::vector<GLuint> offset, adjacency;
+	buildAdjacency(indices, numVertices, offset, adjacency);
+
+	std::vector<int> live(numVertices);
+	for (GLuint v = 0; v < numVertices; v++)
+		live[v] = offset[v + 1] - offset[v];
+	std::vector<int> cacheTime(numVertices, 0);
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<GLuint> deadEnd, candidates;
+
+	int time = MESH_CACHE_SIZE + 1;
+	GLuint cursor = 0;
+	int fan = numVertices ? 0 : -1;
+	bool newCluster = true;
+
+	order.clear();
+	starts.clear();
+	while (fan >= 0) {
+		candidates.clear();
+		for (GLuint a = offset[fan]; a < offset[fan + 1]; a++) {
+			GLuint t = adjacency[a];
+			if (emitted[t])
+				continue;
+			if (newCluster) {
+				starts.push_back((GLuint)order.size());
+				newCluster = false;
+			}
+			for (int k = 0; k < 3; k++) {
+				GLuint v = indices[t * 3 + k];
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cacheTime[v] > MESH_CACHE_SIZE)
+					cacheTime[v] = time++;
+			}
+			emitted[t] = true;
+			order.push_back(t);
+		}
+
+		// next fan: the candidate still cached after its own triangles, oldest first
+		int best = -1, bestPriority = -1;
+		for (GLuint v : candidates) {
+			if (live[v] <= 0)
+				continue;
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= MESH_CACHE_SIZE)
+				priority = time - cacheTime[v];
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = v;
+			}
+		}
+		if (best < 0) {
+			// dead end: the cache is lost, so a new cluster begins
+			newCluster = true;
+			while (!deadEnd.empty() && best < 0) {
+				GLuint d = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[d] > 0)
+					best = d;
+			}
+			while (best < 0 && cursor < numVertices) {
+				if (live[cursor] > 0)
+					best = cursor;
+				cursor++;
+			}
+		}
+		fan = best;
+	}
+}
+
+
+void meshOptimizeTriangles(std::vector<GLuint>& indices, GLuint numVertices, const float* positions, int stride) {
+
+	GLuint numTriangles = (GLuint)indices.size() / 3;
+	if (numTriangles == 0 || indices.size() % 3)
+		return;
+
+	std::vector<GLuint> order, starts;
+	tipsify(indices, numVertices, order, starts);
+
+	std::vector<MESH_CLUSTER> clusters(starts.size());
+	for (size_t c = 0; c < starts.size(); c++) {
+		clusters[c].first = starts[c];
+		clusters[c].count = (c + 1 < starts.size() ? starts[c + 1] : numTriangles) - starts[c];
+		clusters[c].sortKey = 0.0f;
+	}
+
+	if (positions && clusters.size() > 1) {
+		float meshCentre[3] = { 0.0f, 0.0f, 0.0f };
+		for (GLuint v = 0; v < numVertices; v++)
+			for (int k = 0; k < 3; k++)
+				meshCentre[k] += positions[v * stride + k] / numVertices;
+
+		// area weighted normal and centroid of each cluster; the key is how far the
+		// cluster faces away from the centre of the mesh
+		for (MESH_CLUSTER& c : clusters) {
+			float centre[3] = { 0.0f, 0.0f, 0.0f }, normal[3] = { 0.0f, 0.0f, 0.0f }, area = 0.0f;
+			for (GLuint i = c.first; i < c.first + c.count; i++) {
+				const float* p0 = positions + indices[order[i] * 3] * stride;
+				const float* p1 = positions + indices[order[i] * 3 + 1] * stride;
+				const float* p2 = positions + indices[order[i] * 3 + 2] * stride;
+				float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+				float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+				float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				for (int k = 0; k < 3; k++) {
+					normal[k] += n[k];
+					centre[k] += (p0[k] + p1[k] + p2[k]) / 3.0f * a;
+				}
+				area += a;
+			}
+			if (area > 0.0f)
+				for (int k = 0; k < 3; k++)
+					c.sortKey += (centre[k] / area - meshCentre[k]) * normal[k] / area;
+		}
+		std::stable_sort(clusters.begin(), clusters.end(),
+			[](const MESH_CLUSTER& a, const MESH_CLUSTER& b) { return a.sortKey > b.sortKey; });
+	}
+
+	std::vector<GLuint> reordered;
+	reordered.reserve(indices.size());
+	for (const MESH_CLUSTER& c : clusters)
+		for (GLuint i = c.first; i < c.first + c.count; i++)
+			reordered.insert(reordered.end(), &indices[order[i] * 3], &indices[order[i] * 3] + 3);
+	indices.swap(reordered);
+}
+
+
+GLuint meshOptimizeVertexFetch(std::vector<GLuint>& indices, GLuint numVertices, std::vector<int>& remap) {
+
+	GLuint next = 0;
+	remap.assign(numVertices, -1);
+	for (GLuint& index : indices) {
+		if (remap[index] < 0)
+			remap[index] = next++;
+		index = remap[index];
+	}
+	return next;
+}
+
+
+// vertices transformed with a FIFO cache of MESH_CACHE_SIZE entries
+static GLuint cacheMisses(const std::vector<GLuint>& indices, GLuint numVertices) {
+
+	std::vector<GLuint> insertedAt(numVertices, 0);
+	GLuint misses = 0;
+	for (GLuint index : indices) {
+		// a vertex is cached while fewer than MESH_CACHE_SIZE misses happened after it
+		if (insertedAt[index] == 0 || misses - insertedAt[index] + 1 > MESH_CACHE_SIZE) {
+			misses++;
+			insertedAt[index] = misses;
+		}
+	}
+	return misses;
+}
+
+
+float meshACMR(const std::vector<GLuint>& indices, GLuint numVertices) {
+
+	if (indices.size() < 3)
+		return 0.0f;
+	return (float)cacheMisses(indices, numVertices) / (indices.size() / 3);
+}
+
+
+float meshATVR(const std::vector<GLuint>& indices, GLuint numVertices) {
+
+	std::vector<bool> used(numVertices, false);
+	GLuint usedCount = 0;
+	for (GLuint index : indices)
+		if (!used[index]) {
+			used[index] = true;
+			usedCount++;
+		}
+	return usedCount ? (float)cacheMisses(indices, numVertices) / usedCount : 0.0f;
+}
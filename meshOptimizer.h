@@ -0,0 +1,30 @@
+#ifndef __MESH_OPTIMIZER_H
+#define __MESH_OPTIMIZER_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+/* --- Defines --- */
+
+// entries of the post-transform vertex cache assumed by the reordering and the statistics
+#define MESH_CACHE_SIZE 16
+
+/* --- Functions --- */
+
+// Load time optimization of indexed triangle lists, in place:
+// meshOptimizeTriangles reorders triangles for the post-transform cache (Tipsify)
+// and orders the resulting clusters against overdraw; meshOptimizeVertexFetch then
+// renumbers vertices in the order they are first used.
+
+// positions: `stride` floats per vertex, NULL to skip the overdraw ordering
+void   meshOptimizeTriangles(std::vector<GLuint>& indices, GLuint numVertices, const float* positions, int stride);
+// remap[old] is the new index of a vertex, or -1 when no triangle uses it; returns the vertices kept
+GLuint meshOptimizeVertexFetch(std::vector<GLuint>& indices, GLuint numVertices, std::vector<int>& remap);
+
+// average cache miss ratio: transformed vertices per triangle with a FIFO cache of MESH_CACHE_SIZE
+float  meshACMR(const std::vector<GLuint>& indices, GLuint numVertices);
+// average transform to vertex ratio: transformed vertices per vertex used (1 is optimal)
+float  meshATVR(const std::vector<GLuint>& indices, GLuint numVertices);
+
+#endif
@@ -0,0 +1,188 @@
+/* --------------------------------------------------
+Occlusion culling with conditional rendering
+ *
+ * Every slot owns one GL_ANY_SAMPLES_PASSED_CONSERVATIVE query per pass. The
+ * same query object is issued again each frame: GL runs commands in order, so
+ * a conditional draw queued before the new query still sees the old result.
+ *
+ * Query boxes come from gl_VertexID (shaders/occlusion.vert) and are drawn
+ * with depth test on and every write off; back faces are kept, so a box only
+ * needs the camera outside of it to be conservative.
+----------------------------------------------------*/
+#include <math.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "occlusion.h"
+#include "glStateCache.h"
+
+extern float mMatrix[COUNT_MATRICES][16];
+extern float mCompMatrix[COUNT_COMPUTED_MATRICES][16];
+
+typedef struct {
+	GLuint			query;
+	unsigned int	frame;		// of the last query, 0 when never queried
+	bool			inside;		// the camera was inside the box then
+} OCCLUSION_SLOT;
+
+static std::vector<OCCLUSION_SLOT> slots[CULL_PASSES];
+static unsigned int frame = 1, validFrom = 1;
+static CULL_PASS current = CULL_PASS_MAIN;
+static bool enabled = true;
+
+static GLuint boxVAO = 0;
+static GLuint program = 0;
+static UniformHandle<mat4> pvm_uniform;
+static GLboolean depthMaskWas, cullWasEnabled;
+
+
+void occlusionInit(VSShaderLib& shader) {
+
+	program = shader.getProgramIndex();
+	pvm_uniform = shader.getUniform<mat4>("m_pvm");
+	glGenVertexArrays(1, &boxVAO);
+}
+
+
+int occlusionAddGroup(int count) {
+
+	OCCLUSION_SLOT empty = { 0, 0, false };
+	int first = (int)slots[0].size();
+	for (int p = 0; p < CULL_PASSES; p++)
+		slots[p].resize(first + count, empty);
+	return first;
+}
+
+
+void occlusionSetEnabled(bool on) {
+
+	enabled = on;
+	occlusionInvalidate();
+}
+
+
+bool occlusionEnabled() {
+
+	return enabled;
+}
+
+
+void occlusionBeginFrame() {
+
+	frame++;
+}
+
+
+void occlusionInvalidate() {
+
+	validFrom = frame + 1;
+}
+
+
+void occlusionBeginPass(CULL_PASS pass) {
+
+	current = pass;
+}
+
+
+void occlusionBeginQueries() {
+
+	stateUseProgram(program);
+	stateBindVertexArray(boxVAO);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	depthMaskWas = stateGetDepthMask();
+	stateDepthMask(GL_FALSE);
+	cullWasEnabled = stateIsEnabled(GL_CULL_FACE);
+	stateDisable(GL_CULL_FACE);
+}
+
+
+void occlusionQuery(int slot, const float centre[3], float radius) {
+
+	if (!enabled)
+		return;
+
+	OCCLUSION_SLOT& s = slots[current][slot];
+	s.frame = frame;
+
+	// box in world space, as a sphere around the box, and the camera position
+	const float* m = mMatrix[MODEL];
+	const float* v = mMatrix[VIEW];
+	float world[3], eye[3], axis2 = 0.0f, d2 = 0.0f;
+	for (int r = 0; r < 3; r++)
+		world[r] = m[r] * centre[0] + m[4 + r] * centre[1] + m[8 + r] * centre[2] + m[12 + r];
+	for (int c = 0; c < 3; c++) {
+		axis2 = fmaxf(axis2, m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2]);
+		eye[c] = -(v[c * 4] * v[12] + v[c * 4 + 1] * v[13] + v[c * 4 + 2] * v[14]);
+		d2 += (eye[c] - world[c]) * (eye[c] - world[c]);
+	}
+	// corners of the box are sqrt(3) radii away; the near plane is left some room too
+	float reach = sqrtf(3.0f * axis2) * radius * OCCLUSION_MARGIN + 0.5f;
+	s.inside = d2 < reach * reach;
+	if (s.inside)
+		return;
+
+	if (!s.query)
+		glGenQueries(1, &s.query);
+
+	pushMatrix(MODEL);
+	translate(MODEL, centre[0], centre[1], centre[2]);
+	scale(MODEL, radius * OCCLUSION_MARGIN, radius * OCCLUSION_MARGIN, radius * OCCLUSION_MARGIN);
+	computeDerivedMatrix(PROJ_VIEW_MODEL);
+	pvm_uniform.set(mCompMatrix[PROJ_VIEW_MODEL]);
+	popMatrix(MODEL);
+
+	glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, s.query);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 14);
+	glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+}
+
+
+void occlusionEndQueries() {
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	stateDepthMask(depthMaskWas);
+	if (cullWasEnabled) stateEnable(GL_CULL_FACE);
+}
+
+
+GLuint occlusionQueryOf(int slot) {
+
+	if (!enabled)
+		return 0;
+
+	const OCCLUSION_SLOT& s = slots[current][slot];
+	if (!s.query || s.inside || s.frame + 1 < frame || s.frame < validFrom)
+		return 0;
+	return s.query;
+}
+
+
+void occlusionBeginDraw(GLuint query) {
+
+	if (query)
+		glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+}
+
+
+void occlusionEndDraw(GLuint query) {
+
+	if (query)
+		glEndConditionalRender();
+}
+
+
+bool occlusionHidden(int slot) {
+
+	GLuint query = occlusionQueryOf(slot), available = 0, passed = 1;
+	if (!query)
+		return false;
+
+	glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return false;
+	glGetQueryObjectuiv(query, GL_QUERY_RESULT, &passed);
+	return passed == 0;
+}
@@ -0,0 +1,55 @@
+#ifndef __OCCLUSION_H
+#define __OCCLUSION_H
+
+#include <GL/glew.h>
+
+#include "VSShaderlib.h"
+#include "frustumCull.h"
+
+/* --- Defines --- */
+
+// query boxes are grown by this around the bounding sphere, so an object that
+// moved since its query still lies inside its box
+#define OCCLUSION_MARGIN 1.25f
+
+/* --- Functions --- */
+
+// Hardware occlusion culling. Each pass issues box queries once its opaque
+// occluders are in the depth buffer; a draw is then conditioned on the last
+// query of its slot with glBeginConditionalRender(GL_QUERY_NO_WAIT), so the
+// CPU never waits. Objects drawn after the queries (transparent ones) use this
+// frame's results, opaque ones the previous frame's.
+//
+// A draw is unconditional (occlusionQueryOf returns 0) when:
+//  - its slot was not queried in this or the last frame (new or newly visible objects),
+//  - the camera is inside its box, where the query would see nothing,
+//  - occlusionInvalidate was called since (camera cut), or culling is disabled.
+// A query whose result is not ready when the draw runs lets the draw through.
+
+// `shader` draws the query boxes (shaders/occlusion.*)
+void   occlusionInit(VSShaderLib& shader);
+// `count` consecutive slots, in every pass; returns the first
+int    occlusionAddGroup(int count);
+void   occlusionSetEnabled(bool on);
+bool   occlusionEnabled();
+void   occlusionBeginFrame();
+// results so far describe another view
+void   occlusionInvalidate();
+void   occlusionBeginPass(CULL_PASS pass);
+
+// depth and color writes are off in between, so the box queries can be
+// issued amid the drawing of a pass
+void   occlusionBeginQueries();
+// box around a sphere in the current MODEL coordinates
+void   occlusionQuery(int slot, const float centre[3], float radius);
+void   occlusionEndQueries();
+
+// query a draw of the slot is conditioned on in the current pass, 0 to draw it anyway
+GLuint occlusionQueryOf(int slot);
+void   occlusionBeginDraw(GLuint query);
+void   occlusionEndDraw(GLuint query);
+// for draws that cannot be conditioned (multi draws): true if the slot is known to be
+// hidden from a result already available, without waiting
+bool   occlusionHidden(int slot);
+
+#endif
@@ -0,0 +1,204 @@
+/* --------------------------------------------------
+Weighted blended order independent transparency
+ *
+ * Transparent fragments are accumulated into two targets that share the
+ * depth and stencil of the opaque scene:
+ *   accum  (RGBA16F)  sum of premultiplied color * weight, blended ONE, ONE
+ *   reveal (R8)       product of (1 - alpha), blended ZERO, ONE_MINUS_SRC_COLOR
+ * The weight falls off with view depth, so no sorting is needed. The shaders
+ * write both outputs when their oitPass uniform is set.
+ *
+ * The default framebuffer depth/stencil is blitted into the OIT framebuffer, so
+ * its sample count and depth/stencil format are matched (checked once, when the
+ * targets are made); the composite averages the samples.
+----------------------------------------------------*/
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "oit.h"
+#include "glStateCache.h"
+
+static GLuint oitFBO = 0, accumTex = 0, revealTex = 0, depthTex = 0;
+static GLuint emptyVAO = 0;
+static int oitWidth = 0, oitHeight = 0, oitSamples = 0;
+static bool active = false;
+static GLboolean depthMaskWas;
+
+static GLuint compositeProgram = 0;
+static UniformHandle<int> accum_uniform, reveal_uniform, accumMS_uniform, revealMS_uniform, samples_uniform;
+
+
+static GLuint createTarget(GLenum internalFormat, GLenum attachment) {
+
+	GLuint tex;
+	glGenTextures(1, &tex);
+	if (oitSamples > 0) {
+		stateBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex);
+		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, oitSamples, internalFormat, oitWidth, oitHeight, GL_TRUE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D_MULTISAMPLE, tex, 0);
+		stateBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+	}
+	else {
+		stateBindTexture(GL_TEXTURE_2D, tex);
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, oitWidth, oitHeight);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, tex, 0);
+		stateBindTexture(GL_TEXTURE_2D, 0);
+	}
+	return tex;
+}
+
+
+// the blit needs the same depth and stencil format on both sides
+static bool defaultDepthStencilMatches() {
+
+	GLint depthBits = 0, stencilBits = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+	if (depthBits != 24 || stencilBits != 8) {
+		printf("OIT: cannot copy the default depth/stencil buffer (%d/%d bits, 24/8 needed)\n", depthBits, stencilBits);
+		return false;
+	}
+	return true;
+}
+
+
+static bool createTargets(int width, int height) {
+
+	if (!defaultDepthStencilMatches())
+		return false;
+
+	if (oitFBO) {
+		GLuint tex[3] = { accumTex, revealTex, depthTex };
+		glDeleteTextures(3, tex);
+		glDeleteFramebuffers(1, &oitFBO);
+		stateInvalidate();	// the deleted names may come back from glGenTextures
+	}
+
+	oitWidth = width;
+	oitHeight = height;
+
+	glGenFramebuffers(1, &oitFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, oitFBO);
+	accumTex = createTarget(GL_RGBA16F, GL_COLOR_ATTACHMENT0);
+	revealTex = createTarget(GL_R8, GL_COLOR_ATTACHMENT1);
+	depthTex = createTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL_ATTACHMENT);
+
+	GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, buffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("OIT framebuffer incomplete (0x%x)\n", status);
+		GLuint tex[3] = { accumTex, revealTex, depthTex };
+		glDeleteTextures(3, tex);
+		glDeleteFramebuffers(1, &oitFBO);
+		oitFBO = 0;
+		return false;
+	}
+	return true;
+}
+
+
+void oitInit(VSShaderLib& composite) {
+
+	compositeProgram = composite.getProgramIndex();
+	accum_uniform = composite.getUniform<int>("accumTex");
+	reveal_uniform = composite.getUniform<int>("revealTex");
+	accumMS_uniform = composite.getUniform<int>("accumTexMS");
+	revealMS_uniform = composite.getUniform<int>("revealTexMS");
+	samples_uniform = composite.getUniform<int>("samples");
+
+	// the OIT targets must match the default framebuffer to receive its depth and stencil
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetIntegerv(GL_SAMPLES, &oitSamples);
+
+	glGenVertexArrays(1, &emptyVAO);
+}
+
+
+bool oitBegin(int width, int height) {
+
+	if (width != oitWidth || height != oitHeight || !oitFBO) {
+		if (!createTargets(width, height))
+			return false;
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oitFBO);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, oitFBO);
+
+	const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const GLfloat one[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glClearBufferfv(GL_COLOR, 1, one);
+
+	depthMaskWas = stateGetDepthMask();
+	stateDepthMask(GL_FALSE);
+	active = true;
+	setTransparentBlend();
+	return true;
+}
+
+
+void oitEnd() {
+
+	active = false;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	stateUseProgram(compositeProgram);
+	samples_uniform.set(oitSamples);
+
+	// 2D and multisample samplers on separate units
+	GLenum target = oitSamples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+	int unit = oitSamples > 0 ? 2 : 0;
+	stateActiveTexture(GL_TEXTURE0 + unit);
+	stateBindTexture(target, accumTex);
+	stateActiveTexture(GL_TEXTURE0 + unit + 1);
+	stateBindTexture(target, revealTex);
+	accum_uniform.set(0);
+	reveal_uniform.set(1);
+	accumMS_uniform.set(2);
+	revealMS_uniform.set(3);
+
+	GLboolean depthTest = stateIsEnabled(GL_DEPTH_TEST);
+	stateDisable(GL_DEPTH_TEST);
+	stateEnable(GL_BLEND);
+	stateBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+
+	stateBindVertexArray(emptyVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	stateDisable(GL_BLEND);
+	if (depthTest) stateEnable(GL_DEPTH_TEST);
+	stateDepthMask(depthMaskWas);
+
+	stateBindTexture(target, 0);
+	stateActiveTexture(GL_TEXTURE0 + unit);
+	stateBindTexture(target, 0);
+	stateActiveTexture(GL_TEXTURE0);
+}
+
+
+bool oitActive() {
+
+	return active;
+}
+
+
+void setTransparentBlend() {
+
+	stateEnable(GL_BLEND);
+	if (active) {
+		stateBlendFunci(0, GL_ONE, GL_ONE);
+		stateBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+	}
+	else
+		stateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
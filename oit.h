@@ -0,0 +1,24 @@
+#ifndef __OIT_H
+#define __OIT_H
+
+#include "VSShaderlib.h"
+
+/* --- Functions --- */
+
+// Weighted blended order independent transparency.
+// Between oitBegin and oitEnd transparent draws go to the accumulation and
+// revealage targets in any order; oitEnd blends their average over the scene.
+
+// `composite` blends the targets over the scene (shaders/oit_composite.*)
+void oitInit(VSShaderLib& composite);
+// copies depth and stencil of the default framebuffer and binds the OIT targets;
+// returns false (and leaves the default framebuffer bound) if that is not possible
+bool oitBegin(int width, int height);
+void oitEnd();
+bool oitActive();
+
+// alpha blending for a transparent draw: per-target OIT blending inside
+// oitBegin/oitEnd, plain SRC_ALPHA / ONE_MINUS_SRC_ALPHA otherwise
+void setTransparentBlend();
+
+#endif
@@ -0,0 +1,266 @@
+/* --------------------------------------------------
+Instanced particle rendering
+ *
+ * Every live particle becomes one instance of a camera facing quad, so the
+ * whole effect is a single glDrawArraysInstancedBaseInstance per pass.
+ *
+ * Instance data is streamed through a ring of PARTICLE_RING_REGIONS regions.
+ * With ARB_buffer_storage the ring is mapped once, persistently and coherently;
+ * otherwise each region is mapped unsynchronized when written. Either way a
+ * fence per region keeps the CPU from overwriting data the GPU still reads.
+ *
+ * Consecutive instances are grouped in chunks of PARTICLE_CULL_CHUNK with a
+ * bounding sphere each; a pass draws only the chunks inside its frustum,
+ * joining neighbours into one draw. A chunk with an occlusion query is drawn
+ * by itself, conditioned on it.
+----------------------------------------------------*/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "particleRenderer.h"
+#include "glStateCache.h"
+#include "frustumCull.h"
+#include "occlusion.h"
+#include "oit.h"
+
+typedef struct {
+	float	centre[3];
+	float	radius;
+} PARTICLE_CHUNK;
+
+extern float mMatrix[COUNT_MATRICES][16];
+extern float mCompMatrix[COUNT_COMPUTED_MATRICES][16];
+
+static GLuint particleVAO = 0, particleVBO = 0;
+static GLsync regionFence[PARTICLE_RING_REGIONS];
+static float* persistentPtr = NULL;		// whole ring, NULL when not persistently mapped
+static int regionCapacity = 0;			// particles per region
+static int region = 0;					// region written this frame
+static int instanceCount = 0;			// particles uploaded this frame
+static bool uploaded = false;
+static PARTICLE_CHUNK* chunks = NULL;	// bounds of the instances uploaded this frame
+static int occlusionSlots = 0;			// first occlusion slot, one per chunk
+
+static GLuint program = 0;
+static UniformHandle<mat4> viewModel_uniform, proj_uniform;
+static UniformHandle<int> texmap_uniform, oitPass_uniform;
+
+static inline GLsizeiptr regionBytes() {
+	return (GLsizeiptr)regionCapacity * PARTICLE_INSTANCE_FLOATS * sizeof(float);
+}
+
+
+void particleRendererInit(int maxParticles, VSShaderLib& shader) {
+
+	program = shader.getProgramIndex();
+	viewModel_uniform = shader.getUniform<mat4>("m_viewModel");
+	proj_uniform = shader.getUniform<mat4>("m_proj");
+	texmap_uniform = shader.getUniform<int>("texmap");
+	oitPass_uniform = shader.getUniform<int>("oitPass");
+
+	regionCapacity = maxParticles;
+	chunks = new PARTICLE_CHUNK[(maxParticles + PARTICLE_CULL_CHUNK - 1) / PARTICLE_CULL_CHUNK];
+	occlusionSlots = occlusionAddGroup((maxParticles + PARTICLE_CULL_CHUNK - 1) / PARTICLE_CULL_CHUNK);
+	GLsizeiptr ringBytes = regionBytes() * PARTICLE_RING_REGIONS;
+
+	glGenVertexArrays(1, &particleVAO);
+	stateBindVertexArray(particleVAO);
+
+	glGenBuffers(1, &particleVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+
+	if (GLEW_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, ringBytes, NULL, flags);
+		persistentPtr = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, ringBytes, flags);
+	}
+	if (!persistentPtr) {
+		printf("Particles: persistent mapping not available, streaming with unsynchronized maps\n");
+		glBufferData(GL_ARRAY_BUFFER, ringBytes, NULL, GL_STREAM_DRAW);
+	}
+
+	// both attributes advance once per instance; the quad corners come from gl_VertexID
+	GLsizei stride = PARTICLE_INSTANCE_FLOATS * sizeof(float);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, 0);
+	glVertexAttribDivisor(0, 1);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)(4 * sizeof(float)));
+	glVertexAttribDivisor(1, 1);
+
+	stateBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	for (int i = 0; i < PARTICLE_RING_REGIONS; i++)
+		regionFence[i] = 0;
+}
+
+
+// sphere around a box of particle centres, billboard half diagonal included
+static void setChunk(PARTICLE_CHUNK& c, const float lo[3], const float hi[3], float size) {
+
+	float radius2 = 0.0f;
+	for (int k = 0; k < 3; k++) {
+		c.centre[k] = 0.5f * (lo[k] + hi[k]);
+		radius2 += 0.25f * (hi[k] - lo[k]) * (hi[k] - lo[k]);
+	}
+	c.radius = sqrtf(radius2) + 0.71f * size;
+}
+
+
+void particleRendererUpload(const ParticleSystem& ps) {
+
+	region = (region + 1) % PARTICLE_RING_REGIONS;
+
+	// the region was last drawn PARTICLE_RING_REGIONS frames ago; normally this returns at once
+	if (regionFence[region]) {
+		glClientWaitSync(regionFence[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(regionFence[region]);
+		regionFence[region] = 0;
+	}
+
+	float* dst;
+	if (persistentPtr)
+		dst = persistentPtr + (size_t)region * regionCapacity * PARTICLE_INSTANCE_FLOATS;
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+		dst = (float*)glMapBufferRange(GL_ARRAY_BUFFER, region * regionBytes(), regionBytes(),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (!dst) {
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			instanceCount = 0;
+			uploaded = false;
+			return;
+		}
+	}
+
+	int n = 0;
+	float lo[3], hi[3], size = 0.0f;
+	for (const PARTICLE_EMITTER& e : ps.emitters) {
+		for (int k = 0; k < e.live && n < regionCapacity; k++, n++) {
+			int i = ps.index(e, k);
+			if (n % PARTICLE_CULL_CHUNK == 0) {
+				if (n)
+					setChunk(chunks[n / PARTICLE_CULL_CHUNK - 1], lo, hi, size);
+				lo[0] = hi[0] = ps.x[i];
+				lo[1] = hi[1] = ps.y[i];
+				lo[2] = hi[2] = ps.z[i];
+				size = 0.0f;
+			}
+			lo[0] = fminf(lo[0], ps.x[i]); hi[0] = fmaxf(hi[0], ps.x[i]);
+			lo[1] = fminf(lo[1], ps.y[i]); hi[1] = fmaxf(hi[1], ps.y[i]);
+			lo[2] = fminf(lo[2], ps.z[i]); hi[2] = fmaxf(hi[2], ps.z[i]);
+			size = fmaxf(size, e.size);
+
+			float* p = dst + n * PARTICLE_INSTANCE_FLOATS;
+			p[0] = ps.x[i];
+			p[1] = ps.y[i];
+			p[2] = ps.z[i];
+			p[3] = e.size;
+			p[4] = e.color[0];
+			p[5] = e.color[1];
+			p[6] = e.color[2];
+			p[7] = ps.life[i];
+		}
+	}
+	if (n)
+		setChunk(chunks[(n - 1) / PARTICLE_CULL_CHUNK], lo, hi, size);
+
+	if (!persistentPtr) {
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	instanceCount = n;
+	uploaded = true;
+}
+
+
+static GLboolean cullWasEnabled, depthMaskWas;
+
+void particleRendererBegin(GLuint texture) {
+
+	stateUseProgram(program);
+
+	// MODEL carries the mirror scale of the reflected passes
+	computeDerivedMatrix(VIEW_MODEL);
+	viewModel_uniform.set(mCompMatrix[VIEW_MODEL]);
+	proj_uniform.set(mMatrix[PROJECTION]);
+	texmap_uniform.set(0);
+	oitPass_uniform.set(oitActive());
+
+	stateActiveTexture(GL_TEXTURE0);
+	stateBindTexture(GL_TEXTURE_2D, texture);
+
+	setTransparentBlend();
+	depthMaskWas = stateGetDepthMask();
+	stateDepthMask(GL_FALSE);  //Depth Buffer Read Only
+	// billboards are built in eye space, so their winding flips in the mirrored passes
+	cullWasEnabled = stateIsEnabled(GL_CULL_FACE);
+	stateDisable(GL_CULL_FACE);
+}
+
+
+void particleRendererEnd() {
+
+	if (cullWasEnabled) stateEnable(GL_CULL_FACE);
+	stateDepthMask(depthMaskWas);
+}
+
+
+void particleRendererDraw(GLuint texture) {
+
+	if (!uploaded || instanceCount == 0)
+		return;
+
+	particleRendererBegin(texture);
+	stateBindVertexArray(particleVAO);
+	int runStart = 0, runCount = 0;
+	for (int first = 0; first < instanceCount; first += PARTICLE_CULL_CHUNK) {
+		int count = instanceCount - first < PARTICLE_CULL_CHUNK ? instanceCount - first : PARTICLE_CULL_CHUNK;
+		const PARTICLE_CHUNK& c = chunks[first / PARTICLE_CULL_CHUNK];
+		bool visible = cullParticles(c.centre, c.radius, count);
+		GLuint query = visible ? occlusionQueryOf(occlusionSlots + first / PARTICLE_CULL_CHUNK) : 0;
+		if (visible && !query) {
+			if (runCount == 0)
+				runStart = first;
+			runCount += count;
+			continue;
+		}
+		if (runCount)
+			glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, runCount, region * regionCapacity + runStart);
+		runCount = 0;
+		if (query) {
+			occlusionBeginDraw(query);
+			glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, count, region * regionCapacity + first);
+			occlusionEndDraw(query);
+		}
+	}
+	if (runCount)
+		glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, runCount, region * regionCapacity + runStart);
+	particleRendererEnd();
+}
+
+
+void particleRendererQueryOcclusion() {
+
+	if (!uploaded)
+		return;
+	for (int first = 0; first < instanceCount; first += PARTICLE_CULL_CHUNK) {
+		const PARTICLE_CHUNK& c = chunks[first / PARTICLE_CULL_CHUNK];
+		occlusionQuery(occlusionSlots + first / PARTICLE_CULL_CHUNK, c.centre, c.radius);
+	}
+}
+
+
+void particleRendererEndFrame() {
+
+	if (!uploaded)
+		return;
+	regionFence[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	uploaded = false;
+}
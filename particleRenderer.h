@@ -0,0 +1,35 @@
+#ifndef __PARTICLE_RENDERER_H
+#define __PARTICLE_RENDERER_H
+
+#include "VSShaderlib.h"
+#include "particles.h"
+
+/* --- Defines --- */
+
+// frames the GPU may be behind before the CPU waits on a ring region
+#define PARTICLE_RING_REGIONS 3
+
+// per instance: vec4 position + size, vec4 color + life
+#define PARTICLE_INSTANCE_FLOATS 8
+
+// instances culled together against the frustum of each pass (frustumCull.h)
+#define PARTICLE_CULL_CHUNK 64
+
+/* --- Functions --- */
+
+// `shader` draws the billboards (shaders/particle.*)
+void particleRendererInit(int maxParticles, VSShaderLib& shader);
+// copies the live particles into the next ring region; call once per frame, after the update
+void particleRendererUpload(const ParticleSystem& ps);
+// instanced draws of the uploaded particles inside the frustum, with the current MODEL, VIEW and PROJECTION
+void particleRendererDraw(GLuint texture);
+// particle shader, texture and blend state shared by the CPU and GPU simulated paths
+void particleRendererBegin(GLuint texture);
+void particleRendererEnd();
+// occlusion queries of the chunks uploaded this frame, between occlusionBeginQueries
+// and occlusionEndQueries; the draws of the pass are conditioned on them
+void particleRendererQueryOcclusion();
+// fences the region written this frame; call after the last draw of the frame
+void particleRendererEndFrame();
+
+#endif
@@ -0,0 +1,452 @@
+/* --------------------------------------------------
+Structure-of-arrays particle system
+ *
+ * Positions, velocities and life live in separate aligned arrays so that
+ * four particles are integrated per SSE instruction. Color, acceleration and
+ * fade never change during a particle's life, so they are kept once per
+ * emitter instead of once per particle.
+ *
+ * The pool is split in blocks of PARTICLE_BLOCK particles kept in a free list.
+ * Emitters take blocks as they spawn and return them as their particles die,
+ * and keep their live particles packed over the blocks they own, so dead
+ * particles cost nothing to update and no emitter ever resets the pool.
+ *
+ * Streams (trails) spawn at a rate per unit of simulated time, limited by the
+ * emitter cap, a per-update spawn budget shared by all streams and the space
+ * left in the pool.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+#include "particles.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define PARTICLES_SSE
+#endif
+
+#define frand()			((float)rand()/RAND_MAX)
+
+static const float PI = 3.14159265f;
+
+static float* allocLanes(int n) {
+#ifdef PARTICLES_SSE
+	return (float*)_mm_malloc(sizeof(float) * n, 16);
+#else
+	return (float*)malloc(sizeof(float) * n);
+#endif
+}
+
+static void freeLanes(float* p) {
+#ifdef PARTICLES_SSE
+	_mm_free(p);
+#else
+	free(p);
+#endif
+}
+
+static inline int roundUpLanes(int n) {
+	return (n + PARTICLE_LANES - 1) / PARTICLE_LANES * PARTICLE_LANES;
+}
+
+
+ParticleSystem::ParticleSystem() : x(NULL), y(NULL), z(NULL), vx(NULL), vy(NULL), vz(NULL), life(NULL),
+	pCapacity(0), pSpawnBudget(256), pDeferred(false) {
+}
+
+
+ParticleSystem::~ParticleSystem() {
+
+	release();
+}
+
+
+void ParticleSystem::release() {
+
+	float** arrays[] = { &x, &y, &z, &vx, &vy, &vz, &life };
+	for (float** a : arrays) {
+		if (*a) freeLanes(*a);
+		*a = NULL;
+	}
+}
+
+
+void ParticleSystem::init(int maxParticles) {
+
+	release();
+	emitters.clear();
+	spawns.clear();
+
+	int numBlocks = (maxParticles + PARTICLE_BLOCK - 1) / PARTICLE_BLOCK;
+	pCapacity = numBlocks * PARTICLE_BLOCK;
+
+	float** arrays[] = { &x, &y, &z, &vx, &vy, &vz, &life };
+	for (float** a : arrays) {
+		*a = allocLanes(pCapacity);
+		memset(*a, 0, sizeof(float) * pCapacity);
+	}
+
+	// popped from the back, so the first blocks handed out are the lowest ones
+	pFree.clear();
+	for (int b = numBlocks - 1; b >= 0; b--)
+		pFree.push_back(b);
+}
+
+
+int ParticleSystem::addEmitter(const float color[3], const float accel[3], float fade, float size, int maxLive) {
+
+	PARTICLE_EMITTER e;
+	memcpy(e.color, color, 3 * sizeof(float));
+	memcpy(e.accel, accel, 3 * sizeof(float));
+	e.fade = fade;
+	e.size = size;
+	e.maxLive = maxLive;
+	e.rate = 0.0f;
+	memset(e.origin, 0, 3 * sizeof(float));
+	memset(e.velocity, 0, 3 * sizeof(float));
+	e.spread = 0.0f;
+	e.owed = 0.0f;
+	e.live = 0;
+	e.spawnedAt.assign((int)ceil(1.0f / fade), 0);
+	e.ageSlot = 0;
+
+	emitters.push_back(e);
+	return (int)emitters.size() - 1;
+}
+
+
+void ParticleSystem::setStream(int emitter, float rate, const float origin[3], const float velocity[3], float spread) {
+
+	PARTICLE_EMITTER& e = emitters[emitter];
+	e.rate = rate;
+	memcpy(e.origin, origin, 3 * sizeof(float));
+	memcpy(e.velocity, velocity, 3 * sizeof(float));
+	e.spread = spread;
+	if (rate == 0.0f) e.owed = 0.0f;
+}
+
+
+int ParticleSystem::emitBurst(int emitter, const float origin[3], int count, float minSpeed, float maxSpeed) {
+
+	PARTICLE_SPAWN s;
+	s.emitter = emitter;
+	s.count = count;
+	memcpy(s.origin, origin, 3 * sizeof(float));
+	memset(s.velocity, 0, 3 * sizeof(float));
+	s.spread = 0.0f;
+	s.minSpeed = minSpeed;
+	s.maxSpeed = maxSpeed;
+	return spawn(s);
+}
+
+
+// how many of `count` new particles fit under the emitter cap and in the pool
+int ParticleSystem::spawnLimit(const PARTICLE_EMITTER& e, int count) const {
+
+	int room = e.maxLive - e.live;
+	int pool;
+
+	if (pDeferred)
+		pool = pCapacity - liveCount();
+	else
+		pool = (int)e.blocks.size() * PARTICLE_BLOCK - e.live + (int)pFree.size() * PARTICLE_BLOCK;
+
+	if (count > room) count = room;
+	if (count > pool) count = pool;
+	return count > 0 ? count : 0;
+}
+
+
+int ParticleSystem::spawn(const PARTICLE_SPAWN& request) {
+
+	PARTICLE_EMITTER& e = emitters[request.emitter];
+	int count = spawnLimit(e, request.count);
+	if (count == 0) return 0;
+
+	if (pDeferred) {
+		spawns.push_back(request);
+		spawns.back().count = count;
+		e.spawnedAt[e.ageSlot] += count;
+		e.live += count;
+		return count;
+	}
+
+	while ((int)e.blocks.size() * PARTICLE_BLOCK < e.live + count) {
+		e.blocks.push_back(pFree.back());
+		pFree.pop_back();
+	}
+
+	float v, theta, phi;
+	for (int k = 0; k < count; k++) {
+		int i = index(e, e.live + k);
+
+		v = (request.maxSpeed - request.minSpeed) * frand() + request.minSpeed;
+		phi = frand() * PI;
+		theta = 2.0f * frand() * PI;
+
+		x[i] = request.origin[0];
+		y[i] = request.origin[1];
+		z[i] = request.origin[2];
+		vx[i] = request.velocity[0] + v * cos(theta) * sin(phi);
+		vy[i] = request.velocity[1] + v * cos(phi);
+		vz[i] = request.velocity[2] + v * sin(theta) * sin(phi);
+		if (request.spread > 0.0f) {
+			vx[i] += request.spread * (2.0f * frand() - 1.0f);
+			vy[i] += request.spread * (2.0f * frand() - 1.0f);
+			vz[i] += request.spread * (2.0f * frand() - 1.0f);
+		}
+		life[i] = 1.0f;
+	}
+	e.live += count;
+	return count;
+}
+
+
+void ParticleSystem::releaseBlocks(PARTICLE_EMITTER& e, int keep) {
+
+	while ((int)e.blocks.size() > keep) {
+		pFree.push_back(e.blocks.back());
+		e.blocks.pop_back();
+	}
+}
+
+
+void ParticleSystem::clear(int emitter) {
+
+	PARTICLE_EMITTER& e = emitters[emitter];
+	e.live = 0;
+	e.owed = 0.0f;
+	releaseBlocks(e, 0);
+	std::fill(e.spawnedAt.begin(), e.spawnedAt.end(), 0);
+}
+
+
+void ParticleSystem::clearAll() {
+
+	for (int i = 0; i < (int)emitters.size(); i++)
+		clear(i);
+	spawns.clear();
+}
+
+
+void ParticleSystem::setDeferred(bool on) {
+
+	clearAll();
+	pDeferred = on;
+}
+
+
+int ParticleSystem::liveCount() const {
+
+	int n = 0;
+	for (const PARTICLE_EMITTER& e : emitters)
+		n += e.live;
+	return n;
+}
+
+
+void ParticleSystem::update(float h) {
+
+	// streams first: each owes rate * h particles, scaled down when together they
+	// exceed the spawn budget or when the pool is running out of free space
+	std::vector<int> want(emitters.size(), 0);
+	int total = 0;
+	for (int i = 0; i < (int)emitters.size(); i++) {
+		PARTICLE_EMITTER& e = emitters[i];
+		if (pDeferred) age(e);
+		if (e.rate <= 0.0f) continue;
+		e.owed += e.rate * h;
+		want[i] = (int)e.owed;
+		e.owed -= want[i];
+		total += want[i];
+	}
+
+	if (total > 0) {
+		float scale = total > pSpawnBudget ? (float)pSpawnBudget / total : 1.0f;
+		float freeFraction = (float)(pCapacity - liveCount()) / pCapacity;
+		if (freeFraction < 0.25f)
+			scale *= freeFraction / 0.25f;
+
+		for (int i = 0; i < (int)emitters.size(); i++) {
+			if (want[i] == 0) continue;
+			const PARTICLE_EMITTER& e = emitters[i];
+			PARTICLE_SPAWN s;
+			s.emitter = i;
+			s.count = (int)(want[i] * scale);
+			memcpy(s.origin, e.origin, 3 * sizeof(float));
+			memcpy(s.velocity, e.velocity, 3 * sizeof(float));
+			s.spread = e.spread;
+			s.minSpeed = s.maxSpeed = 0.0f;
+			if (s.count > 0) spawn(s);
+		}
+	}
+
+	if (pDeferred) return;
+
+	for (PARTICLE_EMITTER& e : emitters) {
+		if (e.live == 0) continue;
+		integrate(e, h);
+		compact(e);
+	}
+}
+
+
+// deferred mode: particles spawned a lifetime ago have faded out by now
+void ParticleSystem::age(PARTICLE_EMITTER& e) {
+
+	e.ageSlot = (e.ageSlot + 1) % (int)e.spawnedAt.size();
+	e.live -= e.spawnedAt[e.ageSlot];
+	e.spawnedAt[e.ageSlot] = 0;
+}
+
+
+/* Euler step: x += h*v; v += h*a; life -= fade.
+ * Each block is integrated up to the next lane boundary; the slots past the last
+ * live particle belong to the emitter and their contents are ignored. */
+void ParticleSystem::integrate(const PARTICLE_EMITTER& e, float h) {
+
+#ifdef PARTICLES_SSE
+	const __m128 vh = _mm_set1_ps(h);
+	const __m128 dvx = _mm_set1_ps(h * e.accel[0]);
+	const __m128 dvy = _mm_set1_ps(h * e.accel[1]);
+	const __m128 dvz = _mm_set1_ps(h * e.accel[2]);
+	const __m128 fade = _mm_set1_ps(e.fade);
+#else
+	float dvx = h * e.accel[0], dvy = h * e.accel[1], dvz = h * e.accel[2];
+#endif
+
+	for (int b = 0; b * PARTICLE_BLOCK < e.live; b++) {
+		int n = e.live - b * PARTICLE_BLOCK;
+		if (n > PARTICLE_BLOCK) n = PARTICLE_BLOCK;
+		int begin = e.blocks[b] * PARTICLE_BLOCK;
+		int end = begin + roundUpLanes(n);
+
+#ifdef PARTICLES_SSE
+		for (int i = begin; i < end; i += PARTICLE_LANES) {
+			__m128 px = _mm_load_ps(x + i), py = _mm_load_ps(y + i), pz = _mm_load_ps(z + i);
+			__m128 qx = _mm_load_ps(vx + i), qy = _mm_load_ps(vy + i), qz = _mm_load_ps(vz + i);
+
+			_mm_store_ps(x + i, _mm_add_ps(px, _mm_mul_ps(vh, qx)));
+			_mm_store_ps(y + i, _mm_add_ps(py, _mm_mul_ps(vh, qy)));
+			_mm_store_ps(z + i, _mm_add_ps(pz, _mm_mul_ps(vh, qz)));
+			_mm_store_ps(vx + i, _mm_add_ps(qx, dvx));
+			_mm_store_ps(vy + i, _mm_add_ps(qy, dvy));
+			_mm_store_ps(vz + i, _mm_add_ps(qz, dvz));
+			_mm_store_ps(life + i, _mm_sub_ps(_mm_load_ps(life + i), fade));
+		}
+#else
+		for (int i = begin; i < end; i++) {
+			x[i] += h * vx[i];
+			y[i] += h * vy[i];
+			z[i] += h * vz[i];
+			vx[i] += dvx;
+			vy[i] += dvy;
+			vz[i] += dvz;
+			life[i] -= e.fade;
+		}
+#endif
+	}
+}
+
+
+// moves live particles down over the dead ones, keeping their order, and returns
+// the blocks left empty to the free list
+void ParticleSystem::compact(PARTICLE_EMITTER& e) {
+
+	int w = 0;
+
+	// skip the leading run of survivors, nothing to move there
+	while (w < e.live && life[index(e, w)] > 0.0f) w++;
+
+	for (int r = w + 1; r < e.live; r++) {
+		int src = index(e, r);
+		if (life[src] > 0.0f) {
+			int dst = index(e, w);
+			x[dst] = x[src]; y[dst] = y[src]; z[dst] = z[src];
+			vx[dst] = vx[src]; vy[dst] = vy[src]; vz[dst] = vz[src];
+			life[dst] = life[src];
+			w++;
+		}
+	}
+	e.live = w;
+	releaseBlocks(e, (w + PARTICLE_BLOCK - 1) / PARTICLE_BLOCK);
+}
+
+
+// ------------------------------------------------------------
+//
+// Benchmark: SoA/SIMD update against the former AoS scalar loop
+//
+
+typedef struct {
+	float	life, fade;
+	float	r, g, b;
+	float	x, y, z;
+	float	vx, vy, vz;
+	float	ax, ay, az;
+} AoSParticle;
+
+void particleBenchmark(int numParticles, int frames) {
+
+	typedef std::chrono::high_resolution_clock Clock;
+	const float h = 0.033f;
+	const float frameBudgetMs = 1000.0f / 60.0f;
+	const int numEmitters = 4;
+	float color[3] = { 0.882f, 0.552f, 0.211f };
+	float accel[3] = { 0.1f, -0.15f, 0.0f };
+	float origin[3] = { 0.0f, 10.0f, 0.0f };
+
+	// fades chosen so that only the last emitter dies, near the end of the run, exercising compaction
+	// without letting the pool shrink for most of the measurement
+
+	ParticleSystem ps;
+	ps.init(numParticles + numEmitters * PARTICLE_BLOCK);
+	for (int k = 0; k < numEmitters; k++) {
+		int e = ps.addEmitter(color, accel, (0.6f + 0.15f * k) / frames, 2.0f, numParticles / numEmitters);
+		ps.emitBurst(e, origin, numParticles / numEmitters, 0.2f, 1.0f);
+	}
+
+	AoSParticle* aos = (AoSParticle*)malloc(sizeof(AoSParticle) * numParticles);
+	for (int i = 0; i < numParticles; i++) {
+		aos[i].x = origin[0]; aos[i].y = origin[1]; aos[i].z = origin[2];
+		aos[i].vx = frand(); aos[i].vy = frand(); aos[i].vz = frand();
+		aos[i].ax = accel[0]; aos[i].ay = accel[1]; aos[i].az = accel[2];
+		aos[i].r = color[0]; aos[i].g = color[1]; aos[i].b = color[2];
+		aos[i].life = 1.0f; aos[i].fade = 0.6f / frames;
+	}
+
+	Clock::time_point t0 = Clock::now();
+	for (int f = 0; f < frames; f++) {
+		for (int i = 0; i < numParticles; i++) {
+			aos[i].x += h * aos[i].vx;
+			aos[i].y += h * aos[i].vy;
+			aos[i].z += h * aos[i].vz;
+			aos[i].vx += h * aos[i].ax;
+			aos[i].vy += h * aos[i].ay;
+			aos[i].vz += h * aos[i].az;
+			aos[i].life -= aos[i].fade;
+		}
+	}
+	Clock::time_point t1 = Clock::now();
+	for (int f = 0; f < frames; f++)
+		ps.update(h);
+	Clock::time_point t2 = Clock::now();
+
+	double aosMs = std::chrono::duration<double, std::milli>(t1 - t0).count() / frames;
+	double soaMs = std::chrono::duration<double, std::milli>(t2 - t1).count() / frames;
+
+	// keep the AoS loop from being optimised away
+	float checksum = 0.0f;
+	for (int i = 0; i < numParticles; i += 4096) checksum += aos[i].y;
+	free(aos);
+
+	printf("Particle benchmark: %d particles, %d frames (checksum %.2f)\n", numParticles, frames, checksum);
+	printf("  AoS scalar : %8.3f ms/frame  %7.1f M particles per %.1f ms frame\n",
+		aosMs, numParticles / aosMs * frameBudgetMs / 1.0e6, frameBudgetMs);
+	printf("  SoA SIMD   : %8.3f ms/frame  %7.1f M particles per %.1f ms frame  (%d still alive)\n",
+		soaMs, numParticles / soaMs * frameBudgetMs / 1.0e6, frameBudgetMs, ps.liveCount());
+}
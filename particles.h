@@ -0,0 +1,107 @@
+#ifndef __PARTICLES_H
+#define __PARTICLES_H
+
+#include <vector>
+
+/* --- Defines --- */
+
+// particles are integrated this many at a time; blocks are a multiple of it
+#define PARTICLE_LANES 4
+
+// the pool is handed out to emitters in blocks of this many particles
+#define PARTICLE_BLOCK 64
+
+/* --- Types --- */
+
+// Attributes shared by every particle of an emitter are stored once here
+typedef struct PARTICLE_EMITTER {
+	float	color[3];
+	float	accel[3];	// wind + gravity
+	float	fade;		// life lost per step
+	float	size;		// side of the billboard quad
+	int		maxLive;	// hard cap, spawns beyond it are dropped
+
+	// continuous emission (trails); rate 0 means bursts only
+	float	rate;		// particles per unit of simulated time
+	float	origin[3];
+	float	velocity[3];
+	float	spread;		// random velocity in [-spread, spread] added on every axis
+	float	owed;		// fraction of a particle carried to the next step
+
+	int		live;		// live particles, packed in order over the emitter blocks
+	std::vector<int> blocks;	// pool blocks owned, taken from and returned to the free list
+
+	// deferred mode: particles spawned per step over the last lifetime, to know when they die
+	std::vector<int> spawnedAt;
+	int		ageSlot;
+} PARTICLE_EMITTER;
+
+// A spawn handed to an external (GPU) simulation in deferred mode.
+// Velocity = velocity + random in [-spread, spread] + random direction * speed in [minSpeed, maxSpeed]
+typedef struct PARTICLE_SPAWN {
+	int		emitter;
+	int		count;
+	float	origin[3];
+	float	velocity[3];
+	float	spread;
+	float	minSpeed, maxSpeed;
+} PARTICLE_SPAWN;
+
+// Structure-of-arrays particle pool shared by many emitters. Each emitter takes
+// blocks from a free list as it grows and gives them back once its particles die,
+// so emitters come and go without ever reinitialising the pool. Dead particles
+// are compacted out after every update so live ones stay packed.
+class ParticleSystem {
+public:
+	ParticleSystem();
+	~ParticleSystem();
+
+	void init(int maxParticles);
+	int  addEmitter(const float color[3], const float accel[3], float fade, float size, int maxLive);
+	void setStream(int emitter, float rate, const float origin[3], const float velocity[3], float spread);
+	// spherical burst with speeds in [minSpeed, maxSpeed]; returns the number spawned
+	int  emitBurst(int emitter, const float origin[3], int count, float minSpeed, float maxSpeed);
+	void clear(int emitter);
+	void clearAll();
+	void update(float h);
+	int  liveCount() const;
+	int  freeBlocks() const { return (int)pFree.size(); }
+
+	// most particles streams may spawn in one update; when they ask for more, all are scaled down
+	void setSpawnBudget(int perUpdate) { pSpawnBudget = perUpdate; }
+
+	// In deferred mode particles are not simulated here: spawns are queued in `spawns`
+	// for an external simulation and live counts are estimated from the fade.
+	void setDeferred(bool on);
+	bool isDeferred() const { return pDeferred; }
+	std::vector<PARTICLE_SPAWN> spawns;
+
+	// pool index of the k-th live particle of an emitter
+	inline int index(const PARTICLE_EMITTER& e, int k) const {
+		return e.blocks[k / PARTICLE_BLOCK] * PARTICLE_BLOCK + k % PARTICLE_BLOCK;
+	}
+
+	float *x, *y, *z;
+	float *vx, *vy, *vz;
+	float *life;
+	std::vector<PARTICLE_EMITTER> emitters;
+
+private:
+	int pCapacity;
+	int pSpawnBudget;
+	bool pDeferred;
+	std::vector<int> pFree;
+
+	void release();
+	int  spawnLimit(const PARTICLE_EMITTER& e, int count) const;
+	int  spawn(const PARTICLE_SPAWN& s);
+	void integrate(const PARTICLE_EMITTER& e, float h);
+	void compact(PARTICLE_EMITTER& e);
+	void age(PARTICLE_EMITTER& e);
+	void releaseBlocks(PARTICLE_EMITTER& e, int keep);
+};
+
+// CPU only, no GL context needed
+void particleBenchmark(int numParticles, int frames);
+
+#endif
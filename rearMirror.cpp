@@ -0,0 +1,182 @@
+/* --------------------------------------------------
+Rear-view mirror rendered to a texture
+ *
+ * The mirror has its own framebuffer: an RGBA8 color texture and a depth and
+ * stencil renderbuffer, single sampled and sized resolution times the mirror
+ * on screen. The texture is filtered linearly when pasted, which also smooths
+ * the lower resolutions.
+ *
+ * A new image is rendered when `interval` frames went by since the last one,
+ * when the mirror camera moved more than `moveThreshold`, or when the size
+ * changed. In between the last image is pasted again.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "rearMirror.h"
+#include "glStateCache.h"
+
+static REAR_MIRROR_SETTINGS settings = { 0.5f, 3, 1.0f };
+
+static GLuint mirrorFBO = 0, colorTex = 0, depthStencil = 0;
+static GLuint emptyVAO = 0;
+static int targetWidth = 0, targetHeight = 0;
+
+static bool valid = false;
+static bool disabled = false;	// the framebuffer could not be created, not tried again
+static int framesSince = 0;
+static float lastEye[3], lastTarget[3];
+static int rendered = 0, shown = 0;
+
+static GLuint compositeProgram = 0;
+static UniformHandle<int> mirrorTex_uniform;
+
+
+static bool createTarget(int width, int height) {
+
+	if (mirrorFBO) {
+		glDeleteTextures(1, &colorTex);
+		glDeleteRenderbuffers(1, &depthStencil);
+		glDeleteFramebuffers(1, &mirrorFBO);
+		stateInvalidate();	// the deleted names may come back from glGenTextures
+	}
+
+	targetWidth = width;
+	targetHeight = height;
+
+	glGenFramebuffers(1, &mirrorFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, mirrorFBO);
+
+	glGenTextures(1, &colorTex);
+	stateBindTexture(GL_TEXTURE_2D, colorTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
+	stateBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &depthStencil);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Rear mirror framebuffer incomplete (0x%x), mirror disabled\n", status);
+		glDeleteTextures(1, &colorTex);
+		glDeleteRenderbuffers(1, &depthStencil);
+		glDeleteFramebuffers(1, &mirrorFBO);
+		stateInvalidate();
+		colorTex = depthStencil = mirrorFBO = 0;
+		disabled = true;
+		return false;
+	}
+	return true;
+}
+
+
+void rearMirrorInit(VSShaderLib& shader) {
+
+	compositeProgram = shader.getProgramIndex();
+	mirrorTex_uniform = shader.getUniform<int>("mirrorTex");
+	glGenVertexArrays(1, &emptyVAO);
+}
+
+
+REAR_MIRROR_SETTINGS& rearMirrorSettings() {
+
+	return settings;
+}
+
+
+void rearMirrorInvalidate() {
+
+	valid = false;
+}
+
+
+static float distance(const float a[3], const float b[3]) {
+
+	return sqrtf((a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]));
+}
+
+
+bool rearMirrorBegin(int width, int height, const float eye[3], const float target[3]) {
+
+	if (disabled)
+		return false;
+	shown++;
+	framesSince++;
+
+	float resolution = settings.resolution > 0.0f ? settings.resolution : 1.0f;
+	int w = (int)(width * resolution + 0.5f), h = (int)(height * resolution + 0.5f);
+	if (w < 1) w = 1;
+	if (h < 1) h = 1;
+	if (w != targetWidth || h != targetHeight || !mirrorFBO) {
+		valid = false;
+		if (!createTarget(w, h))
+			return false;
+	}
+
+	bool moved = settings.moveThreshold > 0.0f &&
+		(distance(eye, lastEye) > settings.moveThreshold || distance(target, lastTarget) > settings.moveThreshold);
+	if (valid && framesSince < settings.interval && !moved)
+		return false;
+
+	valid = true;
+	framesSince = 0;
+	for (int c = 0; c < 3; c++) {
+		lastEye[c] = eye[c];
+		lastTarget[c] = target[c];
+	}
+	rendered++;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mirrorFBO);
+	stateViewport(0, 0, w, h);
+	stateDepthMask(GL_TRUE);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	return true;
+}
+
+
+void rearMirrorEnd() {
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void rearMirrorComposite(int x, int y, int width, int height) {
+
+	if (!valid)
+		return;
+
+	stateUseProgram(compositeProgram);
+	mirrorTex_uniform.set(0);
+	stateActiveTexture(GL_TEXTURE0);
+	stateBindTexture(GL_TEXTURE_2D, colorTex);
+
+	GLboolean depthTest = stateIsEnabled(GL_DEPTH_TEST);
+	stateDisable(GL_DEPTH_TEST);
+	stateDisable(GL_BLEND);
+	stateViewport(x, y, width, height);
+
+	stateBindVertexArray(emptyVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	if (depthTest) stateEnable(GL_DEPTH_TEST);
+	stateBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+void rearMirrorCounts(int& renderedFrames, int& shownFrames) {
+
+	renderedFrames = rendered;
+	shownFrames = shown;
+}
@@ -0,0 +1,40 @@
+#ifndef __REAR_MIRROR_H
+#define __REAR_MIRROR_H
+
+#include "VSShaderlib.h"
+
+/* --- Types --- */
+
+typedef struct {
+	float	resolution;		// of the texture, relative to the mirror on screen
+	int		interval;		// frames between updates, 1 for every frame
+	float	moveThreshold;	// camera movement (world units) that updates it anyway, 0 for none
+} REAR_MIRROR_SETTINGS;
+
+/* --- Functions --- */
+
+// Rear-view mirror rendered into its own framebuffer (color texture plus depth
+// and stencil) and pasted on screen as a textured quad every frame. The scene is
+// only rendered again when the settings say the last image is too old, so
+// freshness can be traded for cost.
+
+// `shader` pastes the image on screen (shaders/mirror.*)
+void rearMirrorInit(VSShaderLib& shader);
+REAR_MIRROR_SETTINGS& rearMirrorSettings();
+// the next rearMirrorBegin renders (new settings, camera cut)
+void rearMirrorInvalidate();
+
+// true when the mirror must be rendered this frame: its framebuffer is then bound,
+// cleared and the viewport covers it. width x height is the size on screen and
+// eye / target the mirror camera. Otherwise nothing changes. If the framebuffer
+// cannot be created the mirror stays off for the rest of the run.
+bool rearMirrorBegin(int width, int height, const float eye[3], const float target[3]);
+void rearMirrorEnd();
+// draws the last image over the viewport x, y, width, height; depth is left
+// untouched, stencil as set by the caller
+void rearMirrorComposite(int x, int y, int width, int height);
+
+// frames rendered of the frames shown, since the start
+void rearMirrorCounts(int& rendered, int& shown);
+
+#endif
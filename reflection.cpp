@@ -0,0 +1,174 @@
+/* --------------------------------------------------
+Planar reflection
+ *
+ * The target is an RGBA8 texture with a depth renderbuffer, single sampled.
+ * The water reads it at the screen position of its own fragment, since the
+ * reflection is rendered with the same camera and the scene mirrored in MODEL.
+ *
+ * Oblique near plane (E. Lengyel, "Modifying the Projection Matrix to Perform
+ * Oblique Near-Plane Clipping"): the third row of the projection is replaced
+ * by the clip plane in eye space, scaled so the far plane still goes through
+ * the frustum corner opposite to it. Depth precision is lost the more the
+ * plane tilts away from the view direction, which the reflection can afford.
+----------------------------------------------------*/
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "reflection.h"
+#include "glStateCache.h"
+
+extern float mMatrix[COUNT_MATRICES][16];
+
+static GLuint reflectionFBO = 0, colorTex = 0, depthBuffer = 0;
+static int targetWidth = 0, targetHeight = 0;
+static float targetScale = 0.5f;
+static bool failed = false;	// the target could not be created, not tried again
+
+
+static bool createTarget(int width, int height) {
+
+	if (reflectionFBO) {
+		glDeleteTextures(1, &colorTex);
+		glDeleteRenderbuffers(1, &depthBuffer);
+		glDeleteFramebuffers(1, &reflectionFBO);
+		stateInvalidate();	// the deleted names may come back from glGenTextures
+	}
+
+	targetWidth = width;
+	targetHeight = height;
+
+	glGenFramebuffers(1, &reflectionFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, reflectionFBO);
+
+	glGenTextures(1, &colorTex);
+	stateBindTexture(GL_TEXTURE_2D, colorTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
+	stateBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Reflection framebuffer incomplete (0x%x), reflection disabled\n", status);
+		glDeleteTextures(1, &colorTex);
+		glDeleteRenderbuffers(1, &depthBuffer);
+		glDeleteFramebuffers(1, &reflectionFBO);
+		stateInvalidate();
+		colorTex = depthBuffer = reflectionFBO = 0;
+		failed = true;
+		return false;
+	}
+	return true;
+}
+
+
+void reflectionInit() {
+
+	targetWidth = targetHeight = 0;
+}
+
+
+void reflectionSetScale(float scale) {
+
+	targetScale = scale;
+}
+
+
+float reflectionScale() {
+
+	return targetScale;
+}
+
+
+bool reflectionBegin(int width, int height) {
+
+	if (failed)
+		return false;
+	int w = (int)(width * targetScale + 0.5f), h = (int)(height * targetScale + 0.5f);
+	if (w < 1) w = 1;
+	if (h < 1) h = 1;
+	if (w != targetWidth || h != targetHeight || !reflectionFBO) {
+		if (!createTarget(w, h))
+			return false;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, reflectionFBO);
+	stateViewport(0, 0, w, h);
+	stateDepthMask(GL_TRUE);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	return true;
+}
+
+
+void reflectionEnd() {
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void reflectionBindTexture() {
+
+	stateActiveTexture(GL_TEXTURE0 + REFLECTION_TEXTURE_UNIT);
+	stateBindTexture(GL_TEXTURE_2D, colorTex);
+	stateActiveTexture(GL_TEXTURE0);
+}
+
+
+static float sign(float x) {
+
+	return x > 0.0f ? 1.0f : (x < 0.0f ? -1.0f : 0.0f);
+}
+
+
+void reflectionClipProjection(const float plane[4]) {
+
+	// plane in eye space: VIEW is a rigid transform, so the normal goes through its
+	// rotation and the distance follows from a point of the plane
+	const float* v = mMatrix[VIEW];
+	float c[4], point[3], eyePoint[3];
+	for (int r = 0; r < 3; r++) {
+		c[r] = v[r] * plane[0] + v[4 + r] * plane[1] + v[8 + r] * plane[2];
+		point[r] = -plane[3] * plane[r];	// plane normal is unit length
+	}
+	for (int r = 0; r < 3; r++)
+		eyePoint[r] = v[r] * point[0] + v[4 + r] * point[1] + v[8 + r] * point[2] + v[12 + r];
+	c[3] = -(c[0] * eyePoint[0] + c[1] * eyePoint[1] + c[2] * eyePoint[2]);
+	if (c[3] >= 0.0f)
+		return;		// the camera is on the kept side
+
+	// q: the frustum corner opposite to the plane, in eye space (inverse projection of
+	// (sign(c.x), sign(c.y), 1, 1)), for perspective and orthographic projections
+	float* m = mMatrix[PROJECTION];
+	float q[4];
+	if (m[15] == 0.0f) {
+		q[0] = (sign(c[0]) + m[8]) / m[0];
+		q[1] = (sign(c[1]) + m[9]) / m[5];
+		q[2] = -1.0f;
+		q[3] = (1.0f + m[10]) / m[14];
+	}
+	else {
+		q[0] = (sign(c[0]) - m[12]) / m[0];
+		q[1] = (sign(c[1]) - m[13]) / m[5];
+		q[2] = (1.0f - m[14]) / m[10];
+		q[3] = 1.0f;
+	}
+
+	float k = 2.0f / (c[0] * q[0] + c[1] * q[1] + c[2] * q[2] + c[3] * q[3]);
+	m[2] = c[0] * k - m[3];
+	m[6] = c[1] * k - m[7];
+	m[10] = c[2] * k - m[11];
+	m[14] = c[3] * k - m[15];
+}
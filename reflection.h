@@ -0,0 +1,33 @@
+#ifndef __REFLECTION_H
+#define __REFLECTION_H
+
+/* --- Defines --- */
+
+// texture unit the water samples the reflection from (texUnits of the assimp meshes start at 3)
+#define REFLECTION_TEXTURE_UNIT 14
+
+/* --- Functions --- */
+
+// Planar reflection rendered into its own target, at a fraction of the window,
+// and sampled by the water with a projective lookup. The mirrored scene is
+// clipped at the water by an oblique near plane, so nothing under the water is
+// rasterized and no stencil is needed.
+
+void  reflectionInit();
+// size of the target relative to the window, 0.5 or 0.25 typically
+void  reflectionSetScale(float scale);
+float reflectionScale();
+
+// binds the target for a window of width x height and clears it; false if it cannot be
+// created, then and for the rest of the run
+bool  reflectionBegin(int width, int height);
+void  reflectionEnd();
+// the last reflection on REFLECTION_TEXTURE_UNIT
+void  reflectionBindTexture();
+
+// makes the near plane of PROJECTION the world space plane (a, b, c, d), keeping
+// a x + b y + c z + d >= 0, for the current VIEW (Lengyel's oblique frustum).
+// Left unchanged when the camera is not on the other side of the plane.
+void  reflectionClipProjection(const float plane[4]);
+
+#endif
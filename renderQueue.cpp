@@ -0,0 +1,163 @@
+/* --------------------------------------------------
+Render queue
+ *
+ * Packets are radix sorted on their key (8 bit digits, least significant
+ * first, digits equal on every key are skipped) and drawn in order, changing
+ * VAO, texture, shader variant, material and blending only when the next
+ * packet needs it.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "AVTmathLib.h"
+#include "renderQueue.h"
+#include "meshArena.h"
+#include "oit.h"
+#include "glStateCache.h"
+#include "occlusion.h"
+
+extern float mCompMatrix[COUNT_COMPUTED_MATRICES][16];
+extern float mNormal3x3[9];
+
+#define TRANSLUCENT_BIT (1ULL << 60)
+
+typedef struct {
+	unsigned long long key;
+	int index;
+} SORT_ENTRY;
+
+static RENDER_QUEUE_UNIFORMS u;
+static std::vector<RENDER_PACKET> packets;
+static std::vector<SORT_ENTRY> order, sortTemp;
+
+
+void renderQueueInit(const RENDER_QUEUE_UNIFORMS& uniforms) {
+
+	u = uniforms;
+	packets.reserve(64);
+}
+
+
+// float bits of a non negative depth keep their order as unsigned integers
+static unsigned int depthBits(float depth) {
+
+	unsigned int bits;
+	if (depth < 0.0f) depth = 0.0f;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits;
+}
+
+
+void renderQueueSubmit(const RENDER_PACKET& packet, bool translucent) {
+
+	packets.push_back(packet);
+	RENDER_PACKET& p = packets.back();
+
+	computeDerivedMatrix(PROJ_VIEW_MODEL);
+	memcpy(p.vm, mCompMatrix[VIEW_MODEL], 16 * sizeof(float));
+	memcpy(p.pvm, mCompMatrix[PROJ_VIEW_MODEL], 16 * sizeof(float));
+	computeNormalMatrix3x3();
+	memcpy(p.normal, mNormal3x3, 9 * sizeof(float));
+
+	// view depth of the object origin
+	unsigned long long depth = depthBits(-p.vm[14]);
+	unsigned long long state = ((unsigned long long)(p.texMode & 0xF) << 24) |
+		((unsigned long long)(p.texture & 0xFF) << 16) |
+		(unsigned long long)(p.materialId & 0xFFFF);
+
+	if (translucent)
+		p.key = TRANSLUCENT_BIT | ((0xFFFFFFFFULL - depth) << 28) | state;
+	else
+		p.key = (state << 32) | depth;
+}
+
+
+static void radixSort() {
+
+	int n = (int)packets.size();
+	order.resize(n);
+	sortTemp.resize(n);
+	for (int i = 0; i < n; i++) {
+		order[i].key = packets[i].key;
+		order[i].index = i;
+	}
+
+	for (int shift = 0; shift < 64; shift += 8) {
+		int count[256] = { 0 };
+		for (int i = 0; i < n; i++)
+			count[(order[i].key >> shift) & 0xFF]++;
+		if (count[(order[0].key >> shift) & 0xFF] == n)
+			continue;	// same digit on every key
+
+		int offset = 0;
+		for (int d = 0; d < 256; d++) {
+			int c = count[d];
+			count[d] = offset;
+			offset += c;
+		}
+		for (int i = 0; i < n; i++)
+			sortTemp[count[(order[i].key >> shift) & 0xFF]++] = order[i];
+		order.swap(sortTemp);
+	}
+}
+
+
+int renderQueueFlush() {
+
+	int n = (int)packets.size();
+	if (n == 0)
+		return 0;
+
+	radixSort();
+
+	GLuint vao = 0, texture = 0;
+	int texMode = -1, materialId = -1;
+	bool blending = false;
+
+	for (int i = 0; i < n; i++) {
+		const RENDER_PACKET& p = packets[order[i].index];
+
+		bool translucent = (p.key & TRANSLUCENT_BIT) != 0;
+		if (translucent != blending) {
+			if (translucent) setTransparentBlend();
+			else stateDisable(GL_BLEND);
+			blending = translucent;
+		}
+		if (p.texture && p.texture != texture) {
+			stateActiveTexture(GL_TEXTURE0 + p.texUnit);
+			stateBindTexture(GL_TEXTURE_2D, p.texture);
+			texture = p.texture;
+		}
+		if (p.texMode != texMode) {
+			if (u.useProgram) {
+				u.useProgram(p.texMode);
+				materialId = -1;	// the uniforms of another program
+			}
+			u.texMode.set(p.texMode);
+			texMode = p.texMode;
+		}
+		if (p.materialId != materialId) {
+			u.matIndex.set(p.materialId);
+			materialId = p.materialId;
+		}
+		if (p.vao != vao) {
+			stateBindVertexArray(p.vao);
+			vao = p.vao;
+		}
+
+		u.vm.set(p.vm);
+		u.pvm.set(p.pvm);
+		u.normal.set(p.normal);
+		occlusionBeginDraw(p.query);
+		glDrawElementsBaseVertex(p.mode, p.count, meshArenaIndexType(),
+			(void*)(size_t)(p.firstIndex * meshArenaIndexSize()), p.baseVertex);
+		occlusionEndDraw(p.query);
+	}
+
+	if (blending) stateDisable(GL_BLEND);
+	stateActiveTexture(GL_TEXTURE0);
+
+	packets.clear();
+	return n;
+}
@@ -0,0 +1,53 @@
+#ifndef __RENDER_QUEUE_H
+#define __RENDER_QUEUE_H
+
+#include <GL/glew.h>
+
+#include "vsShaderLib.h"
+
+/* --- Types --- */
+
+// One draw of the phong shader. The caller fills the geometry and state,
+// renderQueueSubmit adds the matrices of the current MODEL/VIEW/PROJECTION.
+typedef struct RENDER_PACKET {
+	GLuint	vao;
+	GLenum	mode;
+	GLsizei	count;			// indices, of meshArenaIndexType()
+	GLuint	firstIndex;
+	GLint	baseVertex;
+	int		materialId;
+	int		texMode;		// shader variant
+	int		texUnit;		// texture bound for the draw, ignored when texture is 0
+	GLuint	texture;
+	GLuint	query;			// occlusion query the draw is conditioned on, 0 for none (occlusion.h)
+
+	unsigned long long key;
+	float	pvm[16], vm[16], normal[9];
+} RENDER_PACKET;
+
+// uniforms of the phong shader written by renderQueueFlush
+typedef struct RENDER_QUEUE_UNIFORMS {
+	UniformHandle<mat4> pvm, vm;
+	UniformHandle<mat3> normal;
+	UniformHandle<int> texMode, matIndex;
+	// makes the program for a texMode current, before its uniforms are set;
+	// NULL draws everything with the program in use
+	void	(*useProgram)(int texMode);
+} RENDER_QUEUE_UNIFORMS;
+
+/* --- Functions --- */
+
+// Draws are collected as packets with a 61 bit sort key, from the most significant bits:
+//   opaque:      0 | texMode(4) | texture(8) | material(16) | depth(32)
+//   translucent: 1 | far-to-near depth(32) | texMode(4) | texture(8) | material(16)
+// so opaque draws are batched by state and go front to back, translucent ones back to front.
+// Every mesh lives in the mesh arena VAO, so the VAO is not part of the key.
+
+void renderQueueInit(const RENDER_QUEUE_UNIFORMS& uniforms);
+void renderQueueSubmit(const RENDER_PACKET& packet, bool translucent);
+// sorts and draws the queued packets with the shader in use, or the one useProgram
+// makes current for each texMode, then empties the queue;
+// returns the number of draws
+int  renderQueueFlush();
+
+#endif
@@ -0,0 +1,201 @@
+#version 430
+
+// Lighting pass of the deferred path (deferred.h): each pixel of the G-buffer is
+// shaded once, with the lights of the pass and the same phong terms as
+// pointlight_phong.frag (ambient floor of the sun, point lights at half strength
+// on untextured materials), then fogged from its eye distance and mixed with the
+// environment reflection.
+
+layout (location = 0) uniform mat4 m_invProjection;
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gSpecular;
+uniform sampler2D gAmbient;
+uniform sampler2D gDepth;
+// cascades of shadowMap.h, one layer each
+uniform sampler2DArrayShadow shadowMap;
+// environment probe (envProbe.h), mip levels of the cube
+uniform samplerCube envMap;
+uniform float envLevels;
+
+// per pass lights in eye space, filled once per pass by sendLights (std140, same as
+// in pointlight_phong.*)
+layout (std140) uniform Lights {
+	vec4 dir_pos;
+	vec4 spot_pos[2];
+	vec4 coneDir;
+	float spotCosCutOff;
+	// toggle light
+	bool isDay;
+	bool pointLightsOn;
+	bool spotLightsOn;
+	bool fogEffectOn;
+	// environment probe (envProbe.h), in world directions
+	bool envProbeOn;
+	mat3 m_viewToWorld;
+	// point light clusters (lightClusters.h): viewport origin and tiles per pixel,
+	// scale and bias of the log depth slices
+	vec4 clusterViewport;
+	vec2 clusterDepth;
+	// cascaded shadow maps of the sun (shadowMap.h): eye space to shadow map
+	// coordinates per cascade, far view depth of each cascade and texel size (w)
+	mat4 m_shadow[3];
+	vec4 shadowSplits;
+	bool shadowsOn;
+	int shadowFilter;		// PCF radius in texels
+};
+
+// clustered point lights (lightClusters.h), sizes as LIGHT_CLUSTERS_X/Y/Z
+#define CLUSTERS_X 16u
+#define CLUSTERS_Y 9u
+#define CLUSTERS_Z 24u
+struct ClusterLight {
+	vec4 position;		// view space, w: radius
+	vec4 color;
+};
+layout (std430, binding = 8) readonly buffer ClusterLights {
+	ClusterLight clusterLights[];
+};
+// offset and count in clusterIndices of each cluster
+layout (std430, binding = 9) readonly buffer ClusterGrid {
+	uvec2 clusterGrid[];
+};
+layout (std430, binding = 10) readonly buffer ClusterIndices {
+	uint clusterIndices[];
+};
+
+out vec4 colorOut;
+
+uint clusterOf(float depth) {
+	uvec2 tile = uvec2(clamp((gl_FragCoord.xy - clusterViewport.xy) * clusterViewport.zw,
+		vec2(0.0), vec2(CLUSTERS_X - 1u, CLUSTERS_Y - 1u)));
+	uint slice = uint(clamp(floor(log(max(depth, 1e-4)) * clusterDepth.x + clusterDepth.y),
+		0.0, float(CLUSTERS_Z - 1u)));
+	return (slice * CLUSTERS_Y + tile.y) * CLUSTERS_X + tile.x;
+}
+
+// light reaching an eye space position from the sun, 0 to 1
+float sunShadow(vec3 position, vec3 n) {
+	float depth = -position.z;
+	if (depth >= shadowSplits.z)
+		return 1.0;
+	int cascade = depth < shadowSplits.x ? 0 : (depth < shadowSplits.y ? 1 : 2);
+	// pushed off the surface, by more texels the coarser the cascade
+	vec3 p = (m_shadow[cascade] * vec4(position + n * 0.02 * float(cascade + 1), 1.0)).xyz;
+	if (any(lessThan(p.xy, vec2(0.0))) || any(greaterThan(p.xy, vec2(1.0))))
+		return 1.0;
+
+	float lit = 0.0;
+	for (int y = -shadowFilter; y <= shadowFilter; y++)
+		for (int x = -shadowFilter; x <= shadowFilter; x++)
+			lit += texture(shadowMap, vec4(p.xy + vec2(x, y) * shadowSplits.w, float(cascade), p.z));
+	float taps = float(2 * shadowFilter + 1);
+	return lit / (taps * taps);
+}
+
+vec3 envReflection(vec3 n, vec3 e, float shininess) {
+	vec3 r = m_viewToWorld * reflect(-e, n);
+	float lod = clamp(envLevels - 1.0 - 0.5 * log2(max(shininess, 1.0)), 0.0, envLevels - 1.0);
+	return textureLod(envMap, r, lod).rgb;
+}
+
+vec3 decodeNormal(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+void main() {
+
+	ivec2 p = ivec2(gl_FragCoord.xy);
+	vec4 surface = texelFetch(gAlbedo, p, 0);
+	if (surface.a == 0.0)
+		discard;	// no surface drawn there, what is behind stays
+	float depth = texelFetch(gDepth, p, 0).r;
+
+	vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(gDepth, 0))) * 2.0 - 1.0;
+	vec4 eyePos = m_invProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+	vec3 position = eyePos.xyz / eyePos.w;
+
+	vec3 albedo = surface.rgb;
+	vec4 normal = texelFetch(gNormal, p, 0);
+	vec3 n = decodeNormal(normal.xy);
+	float reflectivity = normal.z;
+	// untextured materials (0) have the ambient as floor, textured ones a factor of the albedo
+	float floorFactor = normal.w;
+	vec4 specular = texelFetch(gSpecular, p, 0);
+	float shininess = specular.a * 256.0;
+	vec3 e = normalize(-position);
+
+	vec3 ambient = texelFetch(gAmbient, p, 0).rgb;
+	vec3 lightFloor = floorFactor > 0.0 ? floorFactor * albedo : ambient;
+	vec3 color = ambient;
+
+	if (isDay) {
+		vec3 l = normalize(vec3(-dir_pos));
+		float intensity = max(dot(n,l), 0.0);
+		float sun = shadowsOn && intensity > 0.0 ? sunShadow(position, n) : 1.0;
+		intensity *= sun;
+		vec3 spec = vec3(0.0);
+		if (intensity > 0.0) {
+			vec3 h = normalize(l + e);
+			spec = specular.rgb * pow(max(dot(h, n), 0.0), shininess) * sun;
+		}
+		color += max(intensity * albedo + spec, lightFloor);
+	}
+	else if (floorFactor > 0.0)
+		color += lightFloor;
+
+	if (pointLightsOn) {
+		uvec2 range = clusterGrid[clusterOf(-position.z)];
+		for (uint k = range.x; k < range.x + range.y; k++) {
+			ClusterLight light = clusterLights[clusterIndices[k]];
+			vec3 toLight = light.position.xyz - position;
+			float d2 = dot(toLight, toLight);
+			float r2 = light.position.w * light.position.w;
+			if (d2 >= r2)
+				continue;
+			float falloff = 1.0 - d2 / r2;
+
+			vec3 l = toLight * inversesqrt(d2);
+			float intensity = max(dot(n,l), 0.0);
+			vec3 spec = vec3(0.0);
+			if (intensity > 0.0) {
+				vec3 h = normalize(l + e);
+				spec = specular.rgb * pow(max(dot(h, n), 0.0), shininess);
+			}
+			vec3 lit = floorFactor > 0.0 ? max(intensity * albedo + spec, lightFloor) : intensity * albedo * 0.5 + spec;
+			color += lit * light.color.rgb * falloff * falloff;
+		}
+	}
+
+	if (spotLightsOn) {
+		vec3 sd = normalize(vec3(-coneDir));
+		for (int i = 0; i < 2; i++) {
+			vec3 l = normalize(spot_pos[i].xyz - position);
+			float spotCos = dot(l, sd);
+			if (spotCos > spotCosCutOff) {	//inside cone?
+				float att = pow(spotCos, 50.0);
+				float intensity = max(dot(n,l), 0.0) * att;
+				vec3 spec = vec3(0.0);
+				if (intensity > 0.0) {
+					vec3 h = normalize(l + e);
+					spec = specular.rgb * pow(max(dot(h, n), 0.0), shininess) * att;
+				}
+				color += floorFactor > 0.0 ? max(intensity * albedo + spec, lightFloor) : intensity * albedo + spec;
+			}
+		}
+	}
+
+	color = clamp(color, 0.0, 1.0);
+	if (fogEffectOn) {
+		float fogAmount = exp(-length(position) * 0.05);
+		color = mix(color, vec3(0.5, 0.6, 0.7), fogAmount);
+	}
+	if (reflectivity > 0.0)
+		color = mix(color, envReflection(n, e, shininess), reflectivity);
+
+	colorOut = vec4(color, 1.0);
+	gl_FragDepth = depth;
+}
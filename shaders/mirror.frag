@@ -0,0 +1,11 @@
+#version 430
+
+// rear-view image, scaled up from its own resolution
+uniform sampler2D mirrorTex;
+
+in vec2 texCoord;
+out vec4 colorOut;
+
+void main() {
+	colorOut = vec4(texture(mirrorTex, texCoord).rgb, 1.0);
+}
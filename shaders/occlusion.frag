@@ -0,0 +1,5 @@
+#version 430
+
+// only the samples passing the depth test count; color writes are off
+void main() {
+}
@@ -0,0 +1,11 @@
+#version 430
+
+// bounding box of an occlusion query: the [-1, 1] cube as one 14 vertex
+// triangle strip, built from gl_VertexID with no vertex buffers
+uniform mat4 m_pvm;
+
+void main() {
+	uint b = 1u << gl_VertexID;
+	vec3 corner = vec3((0x287Au & b) != 0u, (0x02AFu & b) != 0u, (0x31E3u & b) != 0u);
+	gl_Position = m_pvm * vec4(corner * 2.0 - 1.0, 1.0);
+}
@@ -0,0 +1,38 @@
+#version 430
+
+// Weighted blended OIT resolve (McGuire & Bavoil 2013). Blended over the opaque
+// image with glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA).
+
+uniform sampler2D accumTex;
+uniform sampler2D revealTex;
+uniform sampler2DMS accumTexMS;
+uniform sampler2DMS revealTexMS;
+uniform int samples;		// 0 when the targets are not multisampled
+
+out vec4 colorOut;
+
+void main() {
+	ivec2 p = ivec2(gl_FragCoord.xy);
+	vec4 accum;
+	float reveal;
+
+	if (samples == 0) {
+		accum = texelFetch(accumTex, p, 0);
+		reveal = texelFetch(revealTex, p, 0).r;
+	}
+	else {
+		accum = vec4(0.0);
+		reveal = 0.0;
+		for (int s = 0; s < samples; s++) {
+			accum += texelFetch(accumTexMS, p, s);
+			reveal += texelFetch(revealTexMS, p, s).r;
+		}
+		accum /= float(samples);
+		reveal /= float(samples);
+	}
+
+	// nothing transparent covers this pixel
+	if (reveal >= 1.0) discard;
+
+	colorOut = vec4(accum.rgb / clamp(accum.a, 1e-4, 5e4), reveal);
+}
@@ -0,0 +1,27 @@
+#version 430
+
+uniform sampler2D texmap;
+uniform bool oitPass;		// see pointlight_phong.frag
+
+in Data {
+	vec4 color;
+	vec2 tex_coord;
+} DataIn;
+
+out vec4 colorOut;
+out vec4 revealOut;
+
+void main() {
+	// same modulation as texMode 2 of pointlight_phong
+	vec4 texel = texture(texmap, DataIn.tex_coord);
+	if (texel.a == 0.0) discard;
+	colorOut = vec4((DataIn.color * texel).rgb, 0.4);
+
+	if (oitPass) {
+		float z = 1.0 / gl_FragCoord.w;
+		float a = colorOut.a;
+		float w = a * clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 1e-2, 3e3);
+		revealOut = vec4(a);
+		colorOut = vec4(colorOut.rgb * a, a) * w;
+	}
+}
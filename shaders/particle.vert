@@ -0,0 +1,26 @@
+#version 430
+
+// one instance per particle, the quad corners come from gl_VertexID
+layout (location = 0) in vec4 posSize;	// xyz = world position, w = quad side
+layout (location = 1) in vec4 color;	// rgb = emitter color, a = life
+
+uniform mat4 m_viewModel;
+uniform mat4 m_proj;
+
+out Data {
+	vec4 color;
+	vec2 tex_coord;
+} DataOut;
+
+void main () {
+	// triangle strip BL, BR, TL, TR
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+	// billboard: offset the corner in eye space so the quad always faces the camera
+	vec4 center = m_viewModel * vec4(posSize.xyz, 1.0);
+	vec4 pos = center + vec4(corner * 0.5 * posSize.w, 0.0, 0.0);
+
+	DataOut.color = color;
+	DataOut.tex_coord = corner * 0.5 + 0.5;
+	gl_Position = m_proj * pos;
+}
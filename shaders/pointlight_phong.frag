@@ -1,30 +1,161 @@
 #version 430
-#define NUMBER_POINT_LIGHTS 6
 
 
-uniform sampler2D texmap;
-uniform sampler2D texmap1;
-uniform sampler2D texmap2;
-uniform sampler2D tex_flare;
-uniform	sampler2D texUnitDiff;
-uniform	sampler2D texUnitDiff1;
-uniform	sampler2D texUnitSpec;
-uniform	sampler2D texUnitNormalMap;
+// explicit locations, the same in every variant (VSShaderLib::getVariant); 0 to 5 are
+// those of the vertex stage
+layout (location = 6) uniform sampler2D texmap;
+layout (location = 7) uniform sampler2D texmap1;
+layout (location = 8) uniform sampler2D texmap2;
+layout (location = 9) uniform sampler2D tex_flare;
+layout (location = 10) uniform	sampler2D texUnitDiff;
+layout (location = 11) uniform	sampler2D texUnitDiff1;
+layout (location = 12) uniform	sampler2D texUnitSpec;
+layout (location = 13) uniform	sampler2D texUnitNormalMap;
 
-uniform int texMode;
+layout (location = 14) uniform int texMode;
 
-// toggle light
-uniform bool isDay;
-uniform bool pointLightsOn;
-uniform bool spotLightsOn;
-uniform bool shadowMode;
-uniform vec4 coneDir;
-uniform float spotCosCutOff;
-uniform bool fogEffectOn;
+// water: mixed with the planar reflection target (reflection.h), looked up at its own
+// screen position; it then covers what is under it
+layout (location = 15) uniform bool reflectionOn;
+layout (location = 16) uniform sampler2D reflectionMap;
 
-uniform vec4 dir_pos;
+// environment probe (envProbe.h), blurrier levels for lower shininess
+layout (location = 17) uniform samplerCube envMap;
+layout (location = 18) uniform float envLevels;
 
+layout (location = 19) uniform bool shadowMode;
+
+// per pass lights in eye space, filled once per pass by sendLights (std140, same in both stages)
+layout (std140) uniform Lights {
+	vec4 dir_pos;
+	vec4 spot_pos[2];
+	vec4 coneDir;
+	float spotCosCutOff;
+	// toggle light
+	bool isDay;
+	bool pointLightsOn;
+	bool spotLightsOn;
+	bool fogEffectOn;
+	// environment probe (envProbe.h), in world directions
+	bool envProbeOn;
+	mat3 m_viewToWorld;
+	// point light clusters (lightClusters.h): viewport origin and tiles per pixel,
+	// scale and bias of the log depth slices
+	vec4 clusterViewport;
+	vec2 clusterDepth;
+	// cascaded shadow maps of the sun (shadowMap.h): eye space to shadow map
+	// coordinates per cascade, far view depth of each cascade and texel size (w)
+	mat4 m_shadow[3];
+	vec4 shadowSplits;
+	bool shadowsOn;
+	int shadowFilter;		// PCF radius in texels
+};
+
+// clustered point lights (lightClusters.h), sizes as LIGHT_CLUSTERS_X/Y/Z
+#define CLUSTERS_X 16u
+#define CLUSTERS_Y 9u
+#define CLUSTERS_Z 24u
+struct ClusterLight {
+	vec4 position;		// view space, w: radius
+	vec4 color;
+};
+layout (std430, binding = 8) readonly buffer ClusterLights {
+	ClusterLight clusterLights[];
+};
+// offset and count in clusterIndices of each cluster
+layout (std430, binding = 9) readonly buffer ClusterGrid {
+	uvec2 clusterGrid[];
+};
+layout (std430, binding = 10) readonly buffer ClusterIndices {
+	uint clusterIndices[];
+};
+
+// weighted blended OIT: colorOut becomes the weighted accumulation, revealOut the revealage
+layout (location = 20) uniform bool oitPass;
+
+layout (location = 21) uniform bool specularMap;
+layout (location = 22) uniform uint diffMapCount;
+
+// cascades of shadowMap.h, one layer each
+layout (location = 23) uniform sampler2DArrayShadow shadowMap;
+
+// A variant fixes this state with its defines, so the branches on it fold away at
+// compile time; the generic shader reads it from the uniforms
+#ifdef VARIANT
+	#if defined(TEX_MODE_1)
+		#define TEX_MODE 1
+	#elif defined(TEX_MODE_2)
+		#define TEX_MODE 2
+	#elif defined(TEX_MODE_3)
+		#define TEX_MODE 3
+	#else
+		#define TEX_MODE 0
+	#endif
+	#if defined(DIFF_MAPS_2)
+		#define DIFF_MAP_COUNT 2u
+	#elif defined(DIFF_MAPS_1)
+		#define DIFF_MAP_COUNT 1u
+	#else
+		#define DIFF_MAP_COUNT 0u
+	#endif
+	#ifdef DAY
+		#define IS_DAY true
+	#else
+		#define IS_DAY false
+	#endif
+	#ifdef POINT_LIGHTS
+		#define POINT_LIGHTS_ON true
+	#else
+		#define POINT_LIGHTS_ON false
+	#endif
+	#ifdef SPOT_LIGHTS
+		#define SPOT_LIGHTS_ON true
+	#else
+		#define SPOT_LIGHTS_ON false
+	#endif
+	#ifdef FOG
+		#define FOG_ON true
+	#else
+		#define FOG_ON false
+	#endif
+	#ifdef SHADOW
+		#define SHADOW_MODE true
+	#else
+		#define SHADOW_MODE false
+	#endif
+	#ifdef OIT_PASS
+		#define OIT_ON true
+	#else
+		#define OIT_ON false
+	#endif
+	#ifdef SPECULAR_MAP
+		#define SPECULAR_MAP_ON true
+	#else
+		#define SPECULAR_MAP_ON false
+	#endif
+#else
+	#define TEX_MODE texMode
+	#define DIFF_MAP_COUNT diffMapCount
+	#define IS_DAY isDay
+	#define POINT_LIGHTS_ON pointLightsOn
+	#define SPOT_LIGHTS_ON spotLightsOn
+	#define FOG_ON fogEffectOn
+	#define SHADOW_MODE shadowMode
+	#define OIT_ON oitPass
+	#define SPECULAR_MAP_ON specularMap
+#endif
+
+#ifdef GBUFFER
+// G-buffer of the deferred path (deferred.h); the lighting pass shades it
+layout (location = 0) out vec4 albedoOut;
+layout (location = 1) out vec4 normalOut;		// eye space, octahedral in xy
+layout (location = 2) out vec4 specularOut;	// a: shininess / 256
+layout (location = 3) out vec4 ambientOut;
+vec4 colorOut, revealOut;
+#else
 out vec4 colorOut;
+out vec4 revealOut;
+#endif
 
 struct Materials {
 	vec4 diffuse;
@@ -33,24 +164,72 @@ struct Materials {
 	vec4 emissive;
 	float shininess;
 	int texCount;
+	float reflectivity;		// of the environment probe
 };
-uniform Materials mat;
-
-uniform bool specularMap;
-uniform uint diffMapCount;
+// every material of the scene, loaded once; a draw only selects one with matIndex,
+// or its DrawTable record when batched, passed on by the vertex shader
+layout (std430, binding = 6) readonly buffer MaterialTable {
+	Materials materials[];
+};
+Materials mat;
 
 in Data {
 	vec3 normal;
 	vec3 eye;
-	vec3 lightDir[8];
+	vec3 position;
+	vec3 spotDir[2];
 	vec2 tex_coord;
+	vec4 clip_pos;
+	flat int matIndex;
 } DataIn;
 
 vec4 diff, auxSpec;
 
+vec3 envReflection(vec3 n, vec3 e, float shininess) {
+	vec3 r = m_viewToWorld * reflect(-e, n);
+	float lod = clamp(envLevels - 1.0 - 0.5 * log2(max(shininess, 1.0)), 0.0, envLevels - 1.0);
+	return textureLod(envMap, r, lod).rgb;
+}
+
+// light reaching an eye space position from the sun, 0 to 1
+float sunShadow(vec3 position, vec3 n) {
+	float depth = -position.z;
+	if (depth >= shadowSplits.z)
+		return 1.0;
+	int cascade = depth < shadowSplits.x ? 0 : (depth < shadowSplits.y ? 1 : 2);
+	// pushed off the surface, by more texels the coarser the cascade
+	vec3 p = (m_shadow[cascade] * vec4(position + n * 0.02 * float(cascade + 1), 1.0)).xyz;
+	if (any(lessThan(p.xy, vec2(0.0))) || any(greaterThan(p.xy, vec2(1.0))))
+		return 1.0;
+
+	float lit = 0.0;
+	for (int y = -shadowFilter; y <= shadowFilter; y++)
+		for (int x = -shadowFilter; x <= shadowFilter; x++)
+			lit += texture(shadowMap, vec4(p.xy + vec2(x, y) * shadowSplits.w, float(cascade), p.z));
+	float taps = float(2 * shadowFilter + 1);
+	return lit / (taps * taps);
+}
+
+vec2 encodeNormal(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n.xy;
+}
+
+uint clusterOf(float depth) {
+	uvec2 tile = uvec2(clamp((gl_FragCoord.xy - clusterViewport.xy) * clusterViewport.zw,
+		vec2(0.0), vec2(CLUSTERS_X - 1u, CLUSTERS_Y - 1u)));
+	uint slice = uint(clamp(floor(log(max(depth, 1e-4)) * clusterDepth.x + clusterDepth.y),
+		0.0, float(CLUSTERS_Z - 1u)));
+	return (slice * CLUSTERS_Y + tile.y) * CLUSTERS_X + tile.x;
+}
+
 void main() {
-	
-	vec4 texel, texel1, texel2; 
+
+	vec4 texel, texel2, texel01;
+
+	mat = materials[DataIn.matIndex];
 
 	vec4 spec = vec4(0.0);
 	vec4 colorAux = mat.ambient;
@@ -66,98 +245,139 @@ void main() {
 	vec3 e = normalize(DataIn.eye);
 	vec3 sd = normalize(vec3(-coneDir));
 
-	if (shadowMode == true) {
+	if (SHADOW_MODE) {
 		colorOut = vec4(0.5, 0.5, 0.5, 1.0);
 	}
 	else {
+		// textures sampled once, not again by every light
+		if (TEX_MODE == 1)
+			texel01 = texture(texmap, DataIn.tex_coord) * texture(texmap1, DataIn.tex_coord);
+		else if (TEX_MODE == 2)
+			texel = texture(texmap, DataIn.tex_coord);  //texel from element flare texture
+		else if (TEX_MODE == 3) {
+			texel2 = texture(texmap2, DataIn.tex_coord);
+			if (texel2.a == 0.0) discard;
+		}
+
 		if (mat.texCount == 0) {
 			diff = mat.diffuse;
 			auxSpec = mat.specular;
 		}
 		else {
-			if(diffMapCount == 0)
+			if(DIFF_MAP_COUNT == 0u)
 				diff = mat.diffuse;
-			else if(diffMapCount == 1)
+			else if(DIFF_MAP_COUNT == 1u)
 				diff = mat.diffuse * texture(texUnitDiff, DataIn.tex_coord);
 			else
 				diff = mat.diffuse * texture(texUnitDiff, DataIn.tex_coord) * texture(texUnitDiff1, DataIn.tex_coord);
 
-			if(specularMap) 
+			if(SPECULAR_MAP_ON)
 				auxSpec = mat.specular * texture(texUnitSpec, DataIn.tex_coord);
 			else
 				auxSpec = mat.specular;
 		}
 
-		if (isDay == true) {
+#ifdef GBUFFER
+		// the terms of the lighting below: the ambient added once, and the floor
+		// no light goes under, the ambient (0) or a factor of the albedo
+		vec3 albedo, ambient;
+		float floorFactor;
+		if (TEX_MODE == 1) {
+			albedo = texel01.rgb;
+			ambient = mat.ambient.rgb;
+			floorFactor = 0.07;
+		}
+		else if (TEX_MODE == 3) {
+			albedo = texel2.rgb;
+			ambient = vec3(0.0);
+			floorFactor = 0.1;
+		}
+		else {
+			albedo = diff.rgb;
+			ambient = mat.ambient.rgb;
+			floorFactor = 0.0;
+		}
+		// the environment reflection is mixed in by the lighting pass, after fog
+		float reflectivity = envProbeOn && !(reflectionOn && TEX_MODE == 1) ? mat.reflectivity : 0.0;
+		albedoOut = vec4(albedo, 1.0);
+		normalOut = vec4(encodeNormal(n), reflectivity, floorFactor);
+		specularOut = vec4(auxSpec.rgb, mat.shininess / 256.0);
+		ambientOut = vec4(ambient, 1.0);
+		return;
+#endif
+
+		if (IS_DAY) {
 			vec3 l = normalize(vec3(-dir_pos));
 			float intensity = max(dot(n,l), 0.0);
+			float sun = shadowsOn && intensity > 0.0 ? sunShadow(DataIn.position, n) : 1.0;
+			intensity *= sun;
 
 			if (intensity > 0.0) {
 				vec3 h = normalize(l + e);
 				float intSpec = max(dot(h, n), 0.0);
-				spec = auxSpec * pow(intSpec, mat.shininess);
+				spec = auxSpec * pow(intSpec, mat.shininess) * sun;
 			}
 
-			if(texMode == 0) {
+			if(TEX_MODE == 0) {
 				colorAux += max(intensity *  diff + spec, mat.ambient);
 			}
-			else if (texMode == 1) {
-				texel = texture(texmap, DataIn.tex_coord); 
-				texel1 = texture(texmap1, DataIn.tex_coord);
-				colorAux += vec4(max(intensity*texel*texel1 + spec, 0.07*texel*texel1).rgb, diff.a);
+			else if (TEX_MODE == 1) {
+				colorAux += vec4(max(intensity*texel01 + spec, 0.07*texel01).rgb, diff.a);
 			}
-			else if (texMode == 3) {
-				texel2 = texture(texmap2, DataIn.tex_coord); 
-				if(texel2.a == 0.0) discard;
-				else
-					colorAux = vec4(max((intensity*texel2 + spec).rgb, 0.1*texel2.rgb), texel2.a);
+			else if (TEX_MODE == 3) {
+				colorAux = vec4(max((intensity*texel2 + spec).rgb, 0.1*texel2.rgb), texel2.a);
 			}
 		} else {
-			if (texMode == 1) {
-				texel = texture(texmap, DataIn.tex_coord); 
-				texel1 = texture(texmap1, DataIn.tex_coord);
-				colorAux += vec4((0.07*texel*texel1).rgb, diff.a);
+			if (TEX_MODE == 1) {
+				colorAux += vec4((0.07*texel01).rgb, diff.a);
 			}
-			else if (texMode == 3) {
-				texel2 = texture(texmap2, DataIn.tex_coord); 
-				if(texel2.a == 0.0) discard;
-				else
-					colorAux = vec4(texel2.rgb*0.1, 0.8);
+			else if (TEX_MODE == 3) {
+				colorAux = vec4(texel2.rgb*0.1, 0.8);
 			}
 
 		}
 
-		if (pointLightsOn == true) { // pointlights are on
-			for (int i = 0; i < 6; i++){
-				vec3 l = normalize(DataIn.lightDir[i]);
+		if (POINT_LIGHTS_ON && TEX_MODE != 2) { // pointlights are on, only those of the fragment's cluster
+			vec3 ev = normalize(-DataIn.position);
+			uvec2 range = clusterGrid[clusterOf(-DataIn.position.z)];
+			for (uint k = range.x; k < range.x + range.y; k++) {
+				ClusterLight light = clusterLights[clusterIndices[k]];
+				vec3 toLight = light.position.xyz - DataIn.position;
+				float d2 = dot(toLight, toLight);
+				float r2 = light.position.w * light.position.w;
+				if (d2 >= r2)
+					continue;
+				// smooth falloff to 0 at the radius
+				float falloff = 1.0 - d2 / r2;
+				vec4 lightColor = vec4(light.color.rgb * falloff * falloff, 1.0);
+
+				vec3 l = toLight * inversesqrt(d2);
 				float intensity = max(dot(n,l), 0.0);
 				spec = vec4(0.0);
 				if (intensity > 0.0) {
-					vec3 h = normalize(l + e);
+					vec3 h = normalize(l + ev);
 					float intSpec = max(dot(h,n), 0.0);
 					spec = auxSpec * pow(intSpec, mat.shininess);
 				}
-				if(texMode == 0) {
-					colorPoint += intensity * diff * 0.5 + spec;
+				if(TEX_MODE == 0) {
+					colorPoint += (intensity * diff * 0.5 + spec) * lightColor;
 				}
-				else if (texMode == 1) {
-					texel = texture(texmap, DataIn.tex_coord);
-					texel1 = texture(texmap1, DataIn.tex_coord);
-					colorPoint += max(intensity*texel*texel1 + spec, 0.07*texel*texel1);
-					colorPoint = vec4(colorPoint.rgb, diff.a);
+				else if (TEX_MODE == 1) {
+					colorPoint += max(intensity*texel01 + spec, 0.07*texel01) * lightColor;
 				}
-				else if (texMode == 3) {
-					texel2 = texture(texmap2, DataIn.tex_coord); 
-					if(texel2.a == 0.0) discard;
-					else
-						colorPoint = vec4(max((intensity*texel2 + spec).rgb, 0.1*texel2.rgb), texel2.a);
+				else if (TEX_MODE == 3) {
+					colorPoint += vec4(max((intensity*texel2 + spec).rgb, 0.1*texel2.rgb), 0.0) * lightColor;
 				}
 			}
+			if (TEX_MODE == 1)
+				colorPoint.a = diff.a;
+			else if (TEX_MODE == 3)
+				colorPoint.a = texel2.a;
 		}
 
-		if (spotLightsOn == true) {
+		if (SPOT_LIGHTS_ON) {
 			for (int i = 0; i < 2; i++){
-				vec3 l = normalize(DataIn.lightDir[6+i]);
+				vec3 l = normalize(DataIn.spotDir[i]);
 				float spotCos = dot(l, sd);
 				float intensity;
 				spec = vec4(0.0);
@@ -171,26 +391,21 @@ void main() {
 						float intSpec = max(dot(h,n), 0.0);
 						spec = auxSpec * pow(intSpec, mat.shininess) * att;
 					}
-					if(texMode == 0) {
+					if(TEX_MODE == 0) {
 						colorSpot += intensity * diff + spec;
 					}
-					else if (texMode == 1) {
-						texel = texture(texmap, DataIn.tex_coord);  
-						texel1 = texture(texmap1, DataIn.tex_coord); 
-						colorSpot += max(intensity*texel*texel1 + spec, 0.07*texel*texel1);
+					else if (TEX_MODE == 1) {
+						colorSpot += max(intensity*texel01 + spec, 0.07*texel01);
 						colorSpot = vec4(colorSpot.rgb, diff.a);
 					}
-					else if (texMode == 3) {
-						texel2 = texture(texmap2, DataIn.tex_coord); 
-						if(texel2.a == 0.0) discard;
-						else
-							colorSpot = vec4(max((intensity*texel2 + spec).rgb, 0.1*texel2.rgb), texel2.a);
+					else if (TEX_MODE == 3) {
+						colorSpot = vec4(max((intensity*texel2 + spec).rgb, 0.1*texel2.rgb), texel2.a);
 					}
 				}
 			}
 		}
 		colorOut = clamp(colorAux + colorPoint + colorSpot, 0.0f, 1.0f);
-		if (fogEffectOn == true) {
+		if (FOG_ON) {
 			float dist = length(DataIn.eye);
 
 			float fogAmount = exp(-dist*0.05);
@@ -198,12 +413,29 @@ void main() {
 			vec3 finalColor = mix(colorOut.rgb, fogColor, fogAmount);
 			colorOut = vec4(finalColor, 1);
 		}
-	
-		if (texMode == 2) {
-			texel = texture(texmap, DataIn.tex_coord);  //texel from element flare texture
+
+		if (TEX_MODE == 2) {
 			if(texel.a == 0.0) discard;
 			else
 				colorOut = vec4((diff * texel).rgb, 0.4);
 		}
-	}	
-}
\ No newline at end of file
+	}
+
+	if (envProbeOn && mat.reflectivity > 0.0 && !SHADOW_MODE && !(reflectionOn && TEX_MODE == 1)) {
+		colorOut.rgb = mix(colorOut.rgb, envReflection(n, e, mat.shininess), mat.reflectivity);
+	}
+
+	if (reflectionOn && TEX_MODE == 1 && !SHADOW_MODE) {
+		vec2 uv = DataIn.clip_pos.xy / DataIn.clip_pos.w * 0.5 + 0.5;
+		colorOut = vec4(mix(texture(reflectionMap, uv).rgb, colorOut.rgb, mat.diffuse.a), 1.0);
+	}
+
+	if (OIT_ON) {
+		// weight from the view depth (McGuire & Bavoil, eq. 9)
+		float z = 1.0 / gl_FragCoord.w;
+		float a = colorOut.a;
+		float w = a * clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 1e-2, 3e3);
+		revealOut = vec4(a);
+		colorOut = vec4(colorOut.rgb * a, a) * w;
+	}
+}
@@ -1,24 +1,67 @@
 #version 430
 
-uniform mat4 m_pvm;
-uniform mat4 m_viewModel;
-uniform mat3 m_normal;
+// explicit locations, the same in every variant (VSShaderLib::getVariant) and apart from
+// those of the fragment stage
+layout (location = 0) uniform mat4 m_pvm;
+layout (location = 1) uniform mat4 m_viewModel;
+layout (location = 2) uniform mat3 m_normal;
+layout (location = 3) uniform int matIndex;
 
-uniform bool normalMap;
+// draws of the static batch (staticBatch.h), picked by the per instance draw id
+layout (location = 4) uniform bool batched;
+struct DrawData {
+	mat4 pvm;
+	mat4 viewModel;
+	mat3 normal;
+	int matIndex;
+};
+layout (std430, binding = 7) readonly buffer DrawTable {
+	DrawData draws[];
+};
+in uint drawId;
 
-uniform vec4 light_pos[8];
-uniform vec4 point_pos[6];
-uniform vec4 spot_pos[2];
+layout (location = 5) uniform bool normalMap;
 
-in vec4 position;
-in vec4 normal, tangent, bitangent;    //por causa do gerador de geometria
-in vec4 texCoord;
+// per pass lights in eye space, filled once per pass by sendLights (std140, same in both stages)
+layout (std140) uniform Lights {
+	vec4 dir_pos;
+	vec4 spot_pos[2];
+	vec4 coneDir;
+	float spotCosCutOff;
+	// toggle light
+	bool isDay;
+	bool pointLightsOn;
+	bool spotLightsOn;
+	bool fogEffectOn;
+	// environment probe (envProbe.h), in world directions
+	bool envProbeOn;
+	mat3 m_viewToWorld;
+	// point light clusters (lightClusters.h): viewport origin and tiles per pixel,
+	// scale and bias of the log depth slices
+	vec4 clusterViewport;
+	vec2 clusterDepth;
+	// cascaded shadow maps of the sun (shadowMap.h): eye space to shadow map
+	// coordinates per cascade, far view depth of each cascade and texel size (w)
+	mat4 m_shadow[3];
+	vec4 shadowSplits;
+	bool shadowsOn;
+	int shadowFilter;		// PCF radius in texels
+};
+
+// mesh arena layout (meshArena.h): the packed one stores only these components
+in vec3 position;
+in vec3 normal;
+in vec4 tangent;	// w: handedness of the bitangent
+in vec2 texCoord;
 
 out Data {
 	vec3 normal;
 	vec3 eye;
-	vec3 lightDir[8];
+	vec3 position;		// view space, for the clustered point lights
+	vec3 spotDir[2];
 	vec2 tex_coord;
+	vec4 clip_pos;
+	flat int matIndex;
 } DataOut;
 
 void main () {
@@ -26,48 +69,43 @@ void main () {
 	vec3 lightDir, eyeDir;
 	vec3 aux;
 
-	vec4 pos = m_viewModel * position;
-	n = normalize(m_normal * normal.xyz);
-	eyeDir =  vec3(-pos);
-
-	for (int i = 0; i < 6; i++){
-		lightDir = vec3(point_pos[i] - pos);
-		if(normalMap)  {  //transform eye and light vectors by tangent basis
-			t = normalize(m_normal * tangent.xyz);
-			b = normalize(m_normal * bitangent.xyz);
+	mat4 pvm = m_pvm;
+	mat4 viewModel = m_viewModel;
+	mat3 normalMatrix = m_normal;
+	DataOut.matIndex = matIndex;
+	if (batched) {
+		pvm = draws[drawId].pvm;
+		viewModel = draws[drawId].viewModel;
+		normalMatrix = draws[drawId].normal;
+		DataOut.matIndex = draws[drawId].matIndex;
+	}
 
-			aux.x = dot(lightDir, t);
-			aux.y = dot(lightDir, b);
-			aux.z = dot(lightDir, n);
-			DataOut.lightDir[i] = normalize(aux);
+	vec4 pos = viewModel * vec4(position, 1.0);
+	n = normalize(normalMatrix * normal);
+	eyeDir =  vec3(-pos);
 
-			aux.x = dot(eyeDir, t);
-			aux.y = dot(eyeDir, b);
-			aux.z = dot(eyeDir, n);
-			eyeDir = normalize(aux);
-		}
-		else DataOut.lightDir[i] = lightDir;
-	}
 	for (int i = 0; i < 2; i++) {
 		lightDir = vec3(spot_pos[i] - pos);
 		if(normalMap)  {  //transform eye and light vectors by tangent basis
-			t = normalize(m_normal * tangent.xyz);
-			b = normalize(m_normal * bitangent.xyz);
+			t = normalize(normalMatrix * tangent.xyz);
+			b = cross(n, t) * (tangent.w < 0.0 ? -1.0 : 1.0);
 
 			aux.x = dot(lightDir, t);
 			aux.y = dot(lightDir, b);
 			aux.z = dot(lightDir, n);
-			DataOut.lightDir[6 + i] = normalize(aux);
+			DataOut.spotDir[i] = normalize(aux);
 
 			aux.x = dot(eyeDir, t);
 			aux.y = dot(eyeDir, b);
 			aux.z = dot(eyeDir, n);
 			eyeDir = normalize(aux);
 		}
-		else DataOut.lightDir[6 + i] = lightDir;
+		else DataOut.spotDir[i] = lightDir;
 	}
 	DataOut.eye = eyeDir;
-	DataOut.tex_coord = texCoord.st;
+	DataOut.position = pos.xyz;
+	DataOut.tex_coord = texCoord;
 	DataOut.normal = n;
-	gl_Position = m_pvm * position;	
+	gl_Position = pvm * vec4(position, 1.0);
+	DataOut.clip_pos = gl_Position;	
 }
\ No newline at end of file
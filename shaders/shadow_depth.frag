@@ -0,0 +1,5 @@
+#version 430
+
+// depth only, the shadow map framebuffer has no color
+void main() {
+}
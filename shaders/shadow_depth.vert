@@ -0,0 +1,11 @@
+#version 430
+
+// depth of a shadow caster from the light (shadowMap.h); the mesh arena layout,
+// of which only the position is needed
+uniform mat4 m_pvm;
+
+in vec3 position;
+
+void main() {
+	gl_Position = m_pvm * vec4(position, 1.0);
+}
@@ -0,0 +1,10 @@
+#version 430
+
+uniform samplerCube skyMap;
+
+in vec3 direction;
+out vec4 colorOut;
+
+void main() {
+	colorOut = vec4(texture(skyMap, direction).rgb, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 430
+
+// sky cube at the far plane: z = w, so with GL_LEQUAL it only shades pixels no
+// geometry covered. The [-1, 1] cube as one 14 vertex strip, as in occlusion.vert
+uniform mat4 m_pvm;		// without the translation of VIEW * MODEL
+
+out vec3 direction;
+
+void main() {
+	uint b = 1u << gl_VertexID;
+	vec3 corner = vec3((0x287Au & b) != 0u, (0x02AFu & b) != 0u, (0x31E3u & b) != 0u) * 2.0 - 1.0;
+	direction = corner;
+	gl_Position = (m_pvm * vec4(corner, 1.0)).xyww;
+}
@@ -0,0 +1,307 @@
+/* --------------------------------------------------
+Cascaded shadow maps
+ *
+ * Cascades split the view depth at fixed distances, the scene being small.
+ * Each slice of the frustum is bounded by a sphere, whose radius only depends
+ * on the projection, so the window of the cascade keeps its size while the
+ * camera turns. Its centre is snapped in light space to 1/8 of the window:
+ * a whole number of texels, so static shadows do not shimmer, and the window
+ * (and with it the static layer) changes only after the camera moved a fair
+ * part of the cascade.
+ *
+ * The light camera looks at the origin from LIGHT_DISTANCE along -lightDir;
+ * every cascade shares its depth range, which holds the whole scene.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "shadowMap.h"
+#include "glStateCache.h"
+
+extern float mMatrix[COUNT_MATRICES][16];
+
+#define LIGHT_DISTANCE 100.0f
+#define LIGHT_DEPTH 200.0f
+
+// view depth where each cascade ends, the first starts at the near plane
+static const float splitDepths[SHADOW_CASCADES] = { 6.0f, 20.0f, 60.0f };
+
+typedef struct {
+	float	projection[16];
+	float	window[3];			// snapped centre x, y and half size, in light space
+	float	cachedWindow[3];	// of the static layer
+	bool	staticValid;
+} CASCADE;
+
+static CASCADE cascades[SHADOW_CASCADES];
+static float lightView[16];
+static float cachedLightDir[3];
+
+static GLuint shadowFBO = 0, staticTex = 0, sampledTex = 0;
+static int mapSize = 0;
+static int filterRadius = 1;
+static int staticRedraws = 0;
+
+
+static GLuint createLayers(bool compare) {
+
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, mapSize, mapSize, SHADOW_CASCADES);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if (compare) {
+		// linear filtering gives 2x2 PCF per tap on most hardware
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
+	else {
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return tex;
+}
+
+
+bool shadowMapInit(int size) {
+
+	mapSize = size;
+	staticTex = createLayers(false);
+	sampledTex = createLayers(true);
+
+	glGenFramebuffers(1, &shadowFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTex, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	for (int c = 0; c < SHADOW_CASCADES; c++)
+		cascades[c].staticValid = false;
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Shadow map framebuffer incomplete (0x%x)\n", status);
+		glDeleteFramebuffers(1, &shadowFBO);
+		shadowFBO = 0;
+		return false;
+	}
+	return true;
+}
+
+
+void shadowMapSetFilter(int radius) {
+
+	filterRadius = radius < 0 ? 0 : (radius > SHADOW_MAP_MAX_FILTER ? SHADOW_MAP_MAX_FILTER : radius);
+}
+
+
+int shadowMapFilter() {
+
+	return filterRadius;
+}
+
+
+// rigid inverse: transposed rotation, rotated and negated translation
+static void invertView(const float view[16], float inv[16]) {
+
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 3; c++)
+			inv[c * 4 + r] = view[r * 4 + c];
+		inv[r * 4 + 3] = 0.0f;
+	}
+	for (int r = 0; r < 3; r++)
+		inv[12 + r] = -(inv[r] * view[12] + inv[4 + r] * view[13] + inv[8 + r] * view[14]);
+	inv[15] = 1.0f;
+}
+
+
+static void transformPoint(const float m[16], const float p[3], float res[3]) {
+
+	for (int r = 0; r < 3; r++)
+		res[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+}
+
+
+void shadowMapUpdate(const float lightDir[3], const float view[16], const float projection[16]) {
+
+	float dir[3] = { lightDir[0], lightDir[1], lightDir[2] };
+	normalize(dir);
+
+	if (memcmp(dir, cachedLightDir, sizeof(dir)) != 0) {
+		for (int c = 0; c < SHADOW_CASCADES; c++)
+			cascades[c].staticValid = false;
+		memcpy(cachedLightDir, dir, sizeof(dir));
+	}
+
+	pushMatrix(VIEW);
+	loadIdentity(VIEW);
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+	if (fabsf(dir[1]) > 0.99f) {
+		up[1] = 0.0f;
+		up[2] = 1.0f;
+	}
+	lookAt(-dir[0] * LIGHT_DISTANCE, -dir[1] * LIGHT_DISTANCE, -dir[2] * LIGHT_DISTANCE,
+		0.0f, 0.0f, 0.0f, up[0], up[1], up[2]);
+	memcpy(lightView, mMatrix[VIEW], sizeof(lightView));
+	popMatrix(VIEW);
+
+	// frustum edges in eye space, from the near to the far corners
+	float invProjection[16], invView[16];
+	if (!invertMatrix(projection, invProjection))
+		return;
+	invertView(view, invView);
+	float nearCorner[4][3], farCorner[4][3];
+	for (int i = 0; i < 4; i++) {
+		for (int f = 0; f < 2; f++) {
+			float ndc[4] = { i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, f ? 1.0f : -1.0f, 1.0f };
+			float eye[4];
+			for (int r = 0; r < 4; r++)
+				eye[r] = invProjection[r] * ndc[0] + invProjection[4 + r] * ndc[1] + invProjection[8 + r] * ndc[2] + invProjection[12 + r];
+			float* corner = f ? farCorner[i] : nearCorner[i];
+			for (int r = 0; r < 3; r++)
+				corner[r] = eye[r] / eye[3];
+		}
+	}
+
+	staticRedraws = 0;
+	float sliceNear = -nearCorner[0][2];
+	for (int c = 0; c < SHADOW_CASCADES; c++) {
+		CASCADE& cascade = cascades[c];
+
+		// the slice corners, on the frustum edges
+		float corners[8][3], centre[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 4; i++) {
+			float n = -nearCorner[i][2], f = -farCorner[i][2];
+			for (int k = 0; k < 2; k++) {
+				float depth = k ? splitDepths[c] : sliceNear;
+				float t = (depth - n) / (f - n);
+				for (int r = 0; r < 3; r++) {
+					corners[2 * i + k][r] = nearCorner[i][r] + (farCorner[i][r] - nearCorner[i][r]) * t;
+					centre[r] += corners[2 * i + k][r] / 8.0f;
+				}
+			}
+		}
+		float radius = 0.0f;
+		for (int i = 0; i < 8; i++) {
+			float d[3] = { corners[i][0] - centre[0], corners[i][1] - centre[1], corners[i][2] - centre[2] };
+			radius = fmaxf(radius, length(d));
+		}
+		radius = ceilf(radius * 16.0f) / 16.0f;	// rounding noise would resize the window
+		sliceNear = splitDepths[c];
+
+		// snapped window, large enough for the sphere wherever the snap puts it
+		float worldCentre[3], lightCentre[3];
+		transformPoint(invView, centre, worldCentre);
+		transformPoint(lightView, worldCentre, lightCentre);
+		float halfSize = radius * 8.0f / 7.0f;
+		float step = halfSize / 4.0f;
+		cascade.window[0] = floorf(lightCentre[0] / step + 0.5f) * step;
+		cascade.window[1] = floorf(lightCentre[1] / step + 0.5f) * step;
+		cascade.window[2] = halfSize;
+
+		pushMatrix(PROJECTION);
+		loadIdentity(PROJECTION);
+		ortho(cascade.window[0] - halfSize, cascade.window[0] + halfSize,
+			cascade.window[1] - halfSize, cascade.window[1] + halfSize, 1.0f, LIGHT_DEPTH);
+		memcpy(cascade.projection, mMatrix[PROJECTION], sizeof(cascade.projection));
+		popMatrix(PROJECTION);
+
+		if (memcmp(cascade.window, cascade.cachedWindow, sizeof(cascade.window)) != 0)
+			cascade.staticValid = false;
+	}
+}
+
+
+static void bindLayer(int cascade, GLuint tex) {
+
+	pushMatrix(PROJECTION);
+	pushMatrix(VIEW);
+	loadMatrix(PROJECTION, cascades[cascade].projection);
+	loadMatrix(VIEW, lightView);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tex, 0, cascade);
+	stateViewport(0, 0, mapSize, mapSize);
+	stateDepthMask(GL_TRUE);
+	// against acne on the surfaces facing the light
+	stateEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+}
+
+
+bool shadowMapBeginStatic(int cascade) {
+
+	CASCADE& c = cascades[cascade];
+	if (c.staticValid || !shadowFBO)
+		return false;
+
+	bindLayer(cascade, staticTex);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	memcpy(c.cachedWindow, c.window, sizeof(c.window));
+	c.staticValid = true;
+	staticRedraws++;
+	return true;
+}
+
+
+void shadowMapBeginDynamic(int cascade) {
+
+	if (shadowFBO)
+		glCopyImageSubData(staticTex, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+			sampledTex, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade, mapSize, mapSize, 1);
+	bindLayer(cascade, sampledTex);
+}
+
+
+void shadowMapEnd() {
+
+	stateDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	popMatrix(VIEW);
+	popMatrix(PROJECTION);
+}
+
+
+int shadowMapStaticRedraws() {
+
+	return staticRedraws;
+}
+
+
+void shadowMapBindTexture() {
+
+	stateActiveTexture(GL_TEXTURE0 + SHADOW_MAP_TEXTURE_UNIT);
+	stateBindTexture(GL_TEXTURE_2D_ARRAY, sampledTex);
+	stateActiveTexture(GL_TEXTURE0);
+}
+
+
+void shadowMapMatrices(const float view[16], float matrices[SHADOW_CASCADES][16], float splits[4]) {
+
+	// [-1, 1] to [0, 1]
+	static const float bias[16] = {
+		0.5f, 0.0f, 0.0f, 0.0f,
+		0.0f, 0.5f, 0.0f, 0.0f,
+		0.0f, 0.0f, 0.5f, 0.0f,
+		0.5f, 0.5f, 0.5f, 1.0f };
+
+	float invView[16];
+	invertView(view, invView);
+	for (int c = 0; c < SHADOW_CASCADES; c++) {
+		memcpy(matrices[c], bias, sizeof(bias));
+		multMatrix(matrices[c], cascades[c].projection);
+		multMatrix(matrices[c], lightView);
+		multMatrix(matrices[c], invView);
+		splits[c] = splitDepths[c];
+	}
+	splits[3] = mapSize > 0 ? 1.0f / mapSize : 0.0f;
+}
@@ -0,0 +1,52 @@
+#ifndef __SHADOW_MAP_H
+#define __SHADOW_MAP_H
+
+#include <GL/glew.h>
+
+/* --- Defines --- */
+
+#define SHADOW_CASCADES 3
+// texture unit the phong and deferred lighting shaders sample the cascades from
+#define SHADOW_MAP_TEXTURE_UNIT 13
+// largest PCF radius, (2 r + 1)^2 taps
+#define SHADOW_MAP_MAX_FILTER 2
+
+/* --- Functions --- */
+
+// Cascaded shadow maps of the directional light (the sun).
+// Each cascade covers a slice of the view frustum with an orthographic window
+// that only moves in steps of 1/8 of its width, and has two layers: the static
+// casters, drawn again only when the light or the window changed, and the
+// layer sampled, a copy of the static one with the moving casters drawn over
+// it every frame.
+
+// size x size per cascade; false if the framebuffer cannot be made
+bool shadowMapInit(int size);
+
+// PCF radius in texels, 0 (one hardware compare) to SHADOW_MAP_MAX_FILTER
+void shadowMapSetFilter(int radius);
+int  shadowMapFilter();
+
+// fits the cascades to the camera of view and projection, for a light going
+// along the world direction lightDir; marks the static layers to redraw
+void shadowMapUpdate(const float lightDir[3], const float view[16], const float projection[16]);
+
+// Begin binds a layer of a cascade as depth target, with PROJECTION and VIEW
+// (both pushed) those of the light; shadowMapEnd restores them and the default
+// framebuffer, the caller the viewport.
+// false when the static layer is still valid, nothing is bound then
+bool shadowMapBeginStatic(int cascade);
+// the static layer is copied first
+void shadowMapBeginDynamic(int cascade);
+void shadowMapEnd();
+
+// static layers drawn in the last shadowMapUpdate frame
+int  shadowMapStaticRedraws();
+
+// the cascades on SHADOW_MAP_TEXTURE_UNIT
+void shadowMapBindTexture();
+// eye space of `view` to shadow map coordinates and depth, per cascade, and the
+// far view depth of each cascade (xyz) and the texel size (w)
+void shadowMapMatrices(const float view[16], float matrices[SHADOW_CASCADES][16], float splits[4]);
+
+#endif
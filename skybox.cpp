@@ -0,0 +1,64 @@
+/* --------------------------------------------------
+Skybox
+ *
+ * The cube comes from gl_VertexID (shaders/skybox.vert), around the eye: the
+ * translation of VIEW * MODEL is dropped, and the vertex shader outputs
+ * z = w so every sky fragment lies at depth 1. Both faces are kept since a
+ * mirroring MODEL flips the winding.
+----------------------------------------------------*/
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "skybox.h"
+#include "glStateCache.h"
+
+extern float mMatrix[COUNT_MATRICES][16];
+
+static GLuint cubeVAO = 0;
+static GLuint program = 0;
+static UniformHandle<mat4> pvm_uniform;
+static UniformHandle<int> skyMap_uniform;
+
+
+void skyboxInit(VSShaderLib& shader) {
+
+	program = shader.getProgramIndex();
+	pvm_uniform = shader.getUniform<mat4>("m_pvm");
+	skyMap_uniform = shader.getUniform<int>("skyMap");
+	glGenVertexArrays(1, &cubeVAO);
+}
+
+
+void skyboxDraw(GLuint cubeMap) {
+
+	float vm[16], pvm[16];
+	memcpy(vm, mMatrix[VIEW], sizeof(vm));
+	multMatrix(vm, mMatrix[MODEL]);
+	vm[12] = vm[13] = vm[14] = 0.0f;
+	memcpy(pvm, mMatrix[PROJECTION], sizeof(pvm));
+	multMatrix(pvm, vm);
+
+	stateUseProgram(program);
+	pvm_uniform.set(pvm);
+	skyMap_uniform.set(0);
+	stateActiveTexture(GL_TEXTURE0);
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
+
+	GLboolean depthMaskWas = stateGetDepthMask();
+	GLenum depthFuncWas = stateGetDepthFunc();
+	bool cullWasEnabled = stateIsEnabled(GL_CULL_FACE);
+	stateDepthMask(GL_FALSE);
+	stateDisable(GL_CULL_FACE);
+	stateDisable(GL_BLEND);
+	stateDepthFunc(GL_LEQUAL);
+
+	stateBindVertexArray(cubeVAO);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 14);
+
+	stateDepthFunc(depthFuncWas);
+	stateDepthMask(depthMaskWas);
+	if (cullWasEnabled) stateEnable(GL_CULL_FACE);
+	stateBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
@@ -0,0 +1,20 @@
+#ifndef __SKYBOX_H
+#define __SKYBOX_H
+
+#include <GL/glew.h>
+
+#include "VSShaderlib.h"
+
+/* --- Functions --- */
+
+// Sky cube map drawn after the opaque objects, at the far plane with depth func
+// GL_LEQUAL: only pixels no geometry covered are shaded, and the color buffer
+// needs no clearing.
+
+// `shader` is shaders/skybox.*, linked
+void skyboxInit(VSShaderLib& shader);
+// for the current PROJECTION, VIEW and MODEL; MODEL may mirror it.
+// Depth is tested, never written.
+void skyboxDraw(GLuint cubeMap);
+
+#endif
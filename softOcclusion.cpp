@@ -0,0 +1,479 @@
+/* --------------------------------------------------
+Software occlusion culling
+ *
+ * Occluder triangles are transformed and clipped against the near plane on
+ * the calling thread. They are then rasterized into a SOFT_OCCLUSION_WIDTH x
+ * SOFT_OCCLUSION_HEIGHT buffer of NDC depth, nearest kept. Each worker fills
+ * its own bands of rows, so no two threads write the same pixel. The inner
+ * loop evaluates the edge functions and the depth plane for four pixels per
+ * SSE instruction.
+ *
+ * An object box is projected to its screen rectangle and its nearest depth.
+ * It is hidden only if every pixel of that rectangle holds an occluder in
+ * front of it. Boxes crossing the near plane or leaving the screen are always
+ * visible, leaving them to the frustum test.
+ *
+ * Coverage is sampled at pixel centres, like the GPU does, so an object
+ * thinner than a pixel along an occluder silhouette may be dropped.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AVTmathLib.h"
+#include "softOcclusion.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define SOFT_OCCLUSION_SSE
+#endif
+
+extern float mMatrix[COUNT_MATRICES][16];
+
+// rows rasterized by one job
+#define SOFT_OCCLUSION_BAND 16
+// boxes tested by one job
+#define SOFT_OCCLUSION_BATCH 32
+
+typedef struct {
+	std::vector<float>			positions;
+	std::vector<unsigned int>	indices;
+} OCCLUDER;
+
+// counter-clockwise screen triangle: edge functions A x + B y + C are >= 0
+// inside, and depth is Z0 + dzdx x + dzdy y
+typedef struct {
+	float	A[3], B[3], C[3];
+	float	Z0, dzdx, dzdy;
+	int		minX, maxX, minY, maxY;		// pixels, max exclusive
+} SCREEN_TRIANGLE;
+
+static std::vector<OCCLUDER> occluders;
+static std::vector<SCREEN_TRIANGLE> triangles;
+static std::vector<float> clipSpace;
+static float* depth = NULL;
+static float viewProj[16];
+static SOFT_OCCLUSION_STATS stats;
+
+// worker pool: a batch of jobs is handed out by index until none is left
+static std::vector<std::thread> workers;
+static std::mutex poolLock;
+static std::condition_variable wake, finished;
+static std::function<void(int)> job;
+static int jobCount = 0, jobNext = 0, jobsDone = 0;
+static unsigned int generation = 0;
+static bool quit = false;
+
+
+// with the lock held
+static void runJobs(std::unique_lock<std::mutex>& lk) {
+
+	while (jobNext < jobCount) {
+		int j = jobNext++;
+		lk.unlock();
+		job(j);
+		lk.lock();
+		if (++jobsDone == jobCount)
+			finished.notify_all();
+	}
+}
+
+
+static void workerLoop() {
+
+	unsigned int seen = 0;
+	std::unique_lock<std::mutex> lk(poolLock);
+	for (;;) {
+		wake.wait(lk, [&seen] { return quit || generation != seen; });
+		if (quit)
+			return;
+		seen = generation;
+		runJobs(lk);
+	}
+}
+
+
+// runs fn(0) .. fn(count - 1) on the workers and the calling thread
+static void parallelFor(int count, const std::function<void(int)>& fn) {
+
+	std::unique_lock<std::mutex> lk(poolLock);
+	job = fn;
+	jobCount = count;
+	jobNext = jobsDone = 0;
+	generation++;
+	wake.notify_all();
+	runJobs(lk);
+	finished.wait(lk, [] { return jobsDone == jobCount; });
+}
+
+
+void softOcclusionInit(int threads) {
+
+	if (!depth) {
+#ifdef SOFT_OCCLUSION_SSE
+		depth = (float*)_mm_malloc(sizeof(float) * SOFT_OCCLUSION_WIDTH * SOFT_OCCLUSION_HEIGHT, 16);
+#else
+		depth = (float*)malloc(sizeof(float) * SOFT_OCCLUSION_WIDTH * SOFT_OCCLUSION_HEIGHT);
+#endif
+	}
+	// the workers must be joined before the std::thread objects are destroyed,
+	// also when the program leaves through exit()
+	static bool shutdownRegistered = false;
+	if (!shutdownRegistered) {
+		atexit(softOcclusionShutdown);
+		shutdownRegistered = true;
+	}
+	quit = false;
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(workerLoop));
+}
+
+
+void softOcclusionShutdown() {
+
+	{
+		std::lock_guard<std::mutex> lk(poolLock);
+		quit = true;
+	}
+	wake.notify_all();
+	for (std::thread& t : workers)
+		t.join();
+	workers.clear();
+}
+
+
+int softOcclusionAddOccluder(const float* positions, int numVertices, const unsigned int* indices, int numIndices) {
+
+	OCCLUDER o;
+	o.positions.assign(positions, positions + numVertices * 3);
+	o.indices.assign(indices, indices + numIndices);
+	occluders.push_back(o);
+	return (int)occluders.size() - 1;
+}
+
+
+void softOcclusionBegin(const float pv[16]) {
+
+	memcpy(viewProj, pv, sizeof(viewProj));
+	triangles.clear();
+	stats.triangles = stats.tested = stats.hidden = 0;
+	stats.rasterMs = stats.testMs = 0.0;
+}
+
+
+// clip space (x, y, z, w) to pixels and NDC depth
+static void toScreen(const float* c, float* s) {
+
+	float invW = 1.0f / c[3];
+	s[0] = (c[0] * invW * 0.5f + 0.5f) * SOFT_OCCLUSION_WIDTH;
+	s[1] = (c[1] * invW * 0.5f + 0.5f) * SOFT_OCCLUSION_HEIGHT;
+	s[2] = c[2] * invW;
+}
+
+
+static void addTriangle(const float* a, const float* b, const float* c) {
+
+	float area = (b[0] - a[0]) * (c[1] - a[1]) - (c[0] - a[0]) * (b[1] - a[1]);
+	if (area <= 0.0f)
+		return;		// back facing or degenerate
+
+	SCREEN_TRIANGLE t;
+	t.minX = std::max(0, (int)floorf(std::min(a[0], std::min(b[0], c[0]))));
+	t.maxX = std::min(SOFT_OCCLUSION_WIDTH, (int)ceilf(std::max(a[0], std::max(b[0], c[0]))));
+	t.minY = std::max(0, (int)floorf(std::min(a[1], std::min(b[1], c[1]))));
+	t.maxY = std::min(SOFT_OCCLUSION_HEIGHT, (int)ceilf(std::max(a[1], std::max(b[1], c[1]))));
+	if (t.minX >= t.maxX || t.minY >= t.maxY)
+		return;
+
+	const float* v[3] = { a, b, c };
+	for (int e = 0; e < 3; e++) {
+		const float* p = v[e];
+		const float* q = v[(e + 1) % 3];
+		t.A[e] = p[1] - q[1];
+		t.B[e] = q[0] - p[0];
+		t.C[e] = -(t.A[e] * p[0] + t.B[e] * p[1]);
+	}
+	t.dzdx = ((b[2] - a[2]) * (c[1] - a[1]) - (c[2] - a[2]) * (b[1] - a[1])) / area;
+	t.dzdy = ((c[2] - a[2]) * (b[0] - a[0]) - (b[2] - a[2]) * (c[0] - a[0])) / area;
+	t.Z0 = a[2] - t.dzdx * a[0] - t.dzdy * a[1];
+	triangles.push_back(t);
+}
+
+
+void softOcclusionOccluder(int occluder, const float model[16]) {
+
+	if (occluder < 0)
+		return;		// its geometry was not available
+
+	const OCCLUDER& o = occluders[occluder];
+	float m[16];
+	memcpy(m, viewProj, sizeof(m));
+	multMatrix(m, (float*)model);
+
+	int numVertices = (int)o.positions.size() / 3;
+	clipSpace.resize(numVertices * 4);
+	for (int i = 0; i < numVertices; i++) {
+		const float* p = &o.positions[i * 3];
+		for (int r = 0; r < 4; r++)
+			clipSpace[i * 4 + r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+	}
+
+	for (size_t i = 0; i + 2 < o.indices.size(); i += 3) {
+		const float* v[3] = { &clipSpace[o.indices[i] * 4], &clipSpace[o.indices[i + 1] * 4], &clipSpace[o.indices[i + 2] * 4] };
+
+		// Sutherland-Hodgman against the near plane, z + w >= 0
+		float poly[4][4], screen[4][3];
+		int n = 0;
+		for (int k = 0; k < 3; k++) {
+			const float* p = v[k];
+			const float* q = v[(k + 1) % 3];
+			float dp = p[2] + p[3], dq = q[2] + q[3];
+			if (dp >= 0.0f)
+				memcpy(poly[n++], p, 4 * sizeof(float));
+			if ((dp >= 0.0f) != (dq >= 0.0f)) {
+				float s = dp / (dp - dq);
+				for (int c = 0; c < 4; c++)
+					poly[n][c] = p[c] + s * (q[c] - p[c]);
+				n++;
+			}
+		}
+		if (n < 3)
+			continue;
+		for (int k = 0; k < n; k++) {
+			if (poly[k][3] < 1e-6f)
+				poly[k][3] = 1e-6f;
+			toScreen(poly[k], screen[k]);
+		}
+		addTriangle(screen[0], screen[1], screen[2]);
+		if (n == 4)
+			addTriangle(screen[0], screen[2], screen[3]);
+	}
+}
+
+
+static void rasterBand(int band) {
+
+	int y0 = band * SOFT_OCCLUSION_BAND;
+	int y1 = std::min(y0 + SOFT_OCCLUSION_BAND, SOFT_OCCLUSION_HEIGHT);
+
+	for (const SCREEN_TRIANGLE& t : triangles) {
+		if (t.maxY <= y0 || t.minY >= y1)
+			continue;
+		int yEnd = std::min(t.maxY, y1);
+		for (int y = std::max(t.minY, y0); y < yEnd; y++) {
+			float fy = y + 0.5f;
+			float* row = depth + y * SOFT_OCCLUSION_WIDTH;
+			float e0 = t.B[0] * fy + t.C[0], e1 = t.B[1] * fy + t.C[1], e2 = t.B[2] * fy + t.C[2];
+			float zRow = t.Z0 + t.dzdy * fy;
+#ifdef SOFT_OCCLUSION_SSE
+			const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 zero = _mm_setzero_ps();
+			for (int x = t.minX & ~3; x < t.maxX; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane);
+				__m128 in0 = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.A[0]), px), _mm_set1_ps(e0)), zero);
+				__m128 in1 = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.A[1]), px), _mm_set1_ps(e1)), zero);
+				__m128 in2 = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.A[2]), px), _mm_set1_ps(e2)), zero);
+				__m128 inside = _mm_and_ps(in0, _mm_and_ps(in1, in2));
+				if (!_mm_movemask_ps(inside))
+					continue;
+				__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.dzdx), px), _mm_set1_ps(zRow));
+				__m128 d = _mm_load_ps(row + x);
+				__m128 nearest = _mm_min_ps(d, z);
+				_mm_store_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, d)));
+			}
+#else
+			for (int x = t.minX; x < t.maxX; x++) {
+				float px = x + 0.5f;
+				if (t.A[0] * px + e0 >= 0.0f && t.A[1] * px + e1 >= 0.0f && t.A[2] * px + e2 >= 0.0f)
+					row[x] = std::min(row[x], t.dzdx * px + zRow);
+			}
+#endif
+		}
+	}
+}
+
+
+void softOcclusionEnd() {
+
+	if (!depth)
+		return;		// not initialized
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point t0 = Clock::now();
+
+	for (int i = 0; i < SOFT_OCCLUSION_WIDTH * SOFT_OCCLUSION_HEIGHT; i++)
+		depth[i] = 1.0f;
+	parallelFor((SOFT_OCCLUSION_HEIGHT + SOFT_OCCLUSION_BAND - 1) / SOFT_OCCLUSION_BAND, rasterBand);
+
+	stats.triangles = (int)triangles.size();
+	stats.rasterMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+
+static bool boxVisible(const SOFT_OCCLUSION_BOUNDS& b) {
+
+	if (!depth)
+		return true;
+
+	float lo[2] = { 1e30f, 1e30f }, hi[2] = { -1e30f, -1e30f }, nearest = 1e30f;
+	for (int k = 0; k < 8; k++) {
+		float p[3] = { (k & 1) ? b.max[0] : b.min[0], (k & 2) ? b.max[1] : b.min[1], (k & 4) ? b.max[2] : b.min[2] };
+		float c[4], s[3];
+		for (int r = 0; r < 4; r++)
+			c[r] = viewProj[r] * p[0] + viewProj[4 + r] * p[1] + viewProj[8 + r] * p[2] + viewProj[12 + r];
+		if (c[3] < 1e-6f || c[2] < -c[3])
+			return true;
+		toScreen(c, s);
+		lo[0] = std::min(lo[0], s[0]); hi[0] = std::max(hi[0], s[0]);
+		lo[1] = std::min(lo[1], s[1]); hi[1] = std::max(hi[1], s[1]);
+		nearest = std::min(nearest, s[2]);
+	}
+
+	int x0 = std::max(0, (int)floorf(lo[0])), x1 = std::min(SOFT_OCCLUSION_WIDTH, (int)ceilf(hi[0]));
+	int y0 = std::max(0, (int)floorf(lo[1])), y1 = std::min(SOFT_OCCLUSION_HEIGHT, (int)ceilf(hi[1]));
+	if (x0 >= x1 || y0 >= y1)
+		return true;
+
+	for (int y = y0; y < y1; y++) {
+		const float* row = depth + y * SOFT_OCCLUSION_WIDTH;
+#ifdef SOFT_OCCLUSION_SSE
+		const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		const __m128 first = _mm_set1_ps((float)x0), last = _mm_set1_ps((float)x1);
+		const __m128 z = _mm_set1_ps(nearest);
+		for (int x = x0 & ~3; x < x1; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane);
+			__m128 inRect = _mm_and_ps(_mm_cmpge_ps(px, first), _mm_cmplt_ps(px, last));
+			if (_mm_movemask_ps(_mm_and_ps(inRect, _mm_cmpge_ps(_mm_load_ps(row + x), z))))
+				return true;
+		}
+#else
+		for (int x = x0; x < x1; x++)
+			if (row[x] >= nearest)
+				return true;
+#endif
+	}
+	return false;
+}
+
+
+void softOcclusionTest(const SOFT_OCCLUSION_BOUNDS* bounds, int count, bool* visible) {
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point t0 = Clock::now();
+
+	parallelFor((count + SOFT_OCCLUSION_BATCH - 1) / SOFT_OCCLUSION_BATCH, [bounds, count, visible](int batch) {
+		int end = std::min(count, (batch + 1) * SOFT_OCCLUSION_BATCH);
+		for (int i = batch * SOFT_OCCLUSION_BATCH; i < end; i++)
+			visible[i] = boxVisible(bounds[i]);
+	});
+
+	stats.tested += count;
+	for (int i = 0; i < count; i++)
+		if (!visible[i])
+			stats.hidden++;
+	stats.testMs += std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+
+const SOFT_OCCLUSION_STATS& softOcclusionStats() {
+
+	return stats;
+}
+
+
+// [-1, 1] cube, counter-clockwise seen from outside
+static void boxGeometry(std::vector<float>& positions, std::vector<unsigned int>& indices) {
+
+	for (int axis = 0; axis < 3; axis++)
+		for (int sign = -1; sign <= 1; sign += 2) {
+			float n[3] = { 0.0f, 0.0f, 0.0f }, u[3] = { 0.0f, 0.0f, 0.0f }, v[3] = { 0.0f, 0.0f, 0.0f };
+			n[axis] = (float)sign;
+			u[(axis + (sign > 0 ? 1 : 2)) % 3] = 1.0f;
+			v[(axis + (sign > 0 ? 2 : 1)) % 3] = 1.0f;
+			unsigned int base = (unsigned int)positions.size() / 3;
+			const float corner[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+			for (int k = 0; k < 4; k++)
+				for (int c = 0; c < 3; c++)
+					positions.push_back(n[c] + corner[k][0] * u[c] + corner[k][1] * v[c]);
+			const unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+			for (int k = 0; k < 6; k++)
+				indices.push_back(base + quad[k]);
+		}
+}
+
+
+void softOcclusionBenchmark(int objects, int frames) {
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	// a wall of boxes in front of the camera, objects scattered behind and around it
+	std::vector<float> positions;
+	std::vector<unsigned int> indices;
+	boxGeometry(positions, indices);
+	int box = softOcclusionAddOccluder(positions.data(), (int)positions.size() / 3, indices.data(), (int)indices.size());
+
+	std::vector<SOFT_OCCLUSION_BOUNDS> bounds(objects);
+	srand(1);
+	for (int i = 0; i < objects; i++) {
+		float c[3] = { 80.0f * rand() / RAND_MAX - 40.0f, 10.0f * rand() / RAND_MAX, -60.0f * rand() / RAND_MAX - 5.0f };
+		float r = 0.2f + 1.0f * rand() / RAND_MAX;
+		for (int k = 0; k < 3; k++) {
+			bounds[i].min[k] = c[k] - r;
+			bounds[i].max[k] = c[k] + r;
+		}
+	}
+	bool* visible = new bool[objects];
+
+	loadIdentity(PROJECTION);
+	perspective(53.13f, 2.0f, 0.1f, 1000.0f);
+	loadIdentity(VIEW);
+	lookAt(0.0f, 2.0f, 20.0f, 0.0f, 2.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+	float pv[16];
+	memcpy(pv, mMatrix[PROJECTION], sizeof(pv));
+	multMatrix(pv, mMatrix[VIEW]);
+
+	int hardware = (int)std::thread::hardware_concurrency();
+	int threadCounts[2] = { 0, hardware > 1 ? hardware - 1 : 0 };
+
+	printf("Software occlusion benchmark: %dx%d depth, %d objects, %d frames, %s\n", SOFT_OCCLUSION_WIDTH,
+		SOFT_OCCLUSION_HEIGHT, objects, frames,
+#ifdef SOFT_OCCLUSION_SSE
+		"SSE");
+#else
+		"scalar");
+#endif
+	for (int run = 0; run < 2; run++) {
+		softOcclusionInit(threadCounts[run]);
+		double rasterMs = 0.0, testMs = 0.0;
+		Clock::time_point t0 = Clock::now();
+		for (int f = 0; f < frames; f++) {
+			softOcclusionBegin(pv);
+			for (int w = 0; w < 24; w++) {
+				float model[16];
+				setIdentityMatrix(model, 4);
+				model[0] = 1.5f; model[5] = 3.0f + (w % 3); model[10] = 0.5f;
+				model[12] = -35.0f + 3.0f * w; model[13] = 0.0f; model[14] = -2.0f - (w % 4);
+				softOcclusionOccluder(box, model);
+			}
+			softOcclusionEnd();
+			softOcclusionTest(bounds.data(), objects, visible);
+			rasterMs += stats.rasterMs;
+			testMs += stats.testMs;
+		}
+		double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+		printf("  %2d threads: raster %.3f ms, test %.3f ms, total %.3f ms/frame; %d triangles, %d of %d objects hidden\n",
+			threadCounts[run] + 1, rasterMs / frames, testMs / frames, totalMs / frames, stats.triangles, stats.hidden, stats.tested);
+		softOcclusionShutdown();
+	}
+
+	delete[] visible;
+	occluders.clear();
+}
@@ -0,0 +1,52 @@
+#ifndef __SOFT_OCCLUSION_H
+#define __SOFT_OCCLUSION_H
+
+/* --- Defines --- */
+
+// resolution of the software depth buffer; the width is a multiple of 4
+#define SOFT_OCCLUSION_WIDTH	256
+#define SOFT_OCCLUSION_HEIGHT	128
+
+/* --- Types --- */
+
+// world space box of an object to test
+typedef struct {
+	float	min[3], max[3];
+} SOFT_OCCLUSION_BOUNDS;
+
+typedef struct {
+	int		triangles;		// occluder triangles rasterized
+	int		tested, hidden;
+	double	rasterMs, testMs;
+} SOFT_OCCLUSION_STATS;
+
+/* --- Functions --- */
+
+// Occlusion culling on the CPU, no GL involved: a few occluders are rasterized
+// into a small depth buffer and object boxes are tested against it, so hidden
+// objects are dropped before anything is submitted. Rasterization (by bands of
+// rows) and the tests (by ranges of boxes) are split over worker threads.
+
+// threads: workers besides the calling thread, 0 to do everything on it
+void softOcclusionInit(int threads);
+// joins the workers; also run at exit, may be called again
+void softOcclusionShutdown();
+
+// occluder geometry kept by the module: xyz positions and a triangle list; returns its id
+int  softOcclusionAddOccluder(const float* positions, int numVertices, const unsigned int* indices, int numIndices);
+
+// clears the depth buffer; viewProj = PROJECTION * VIEW, column major
+void softOcclusionBegin(const float viewProj[16]);
+// queues an occluder with its model matrix, column major
+void softOcclusionOccluder(int occluder, const float model[16]);
+// rasterizes the queued occluders
+void softOcclusionEnd();
+// visible[i] is false only when bounds[i] is hidden behind the occluders
+void softOcclusionTest(const SOFT_OCCLUSION_BOUNDS* bounds, int count, bool* visible);
+
+const SOFT_OCCLUSION_STATS& softOcclusionStats();
+
+// no window or GL context needed
+void softOcclusionBenchmark(int objects, int frames);
+
+#endif
@@ -0,0 +1,144 @@
+/* --------------------------------------------------
+Static geometry batch
+ *
+ * Meshes of the arena (meshArena.h) are drawn from its buffers through a VAO
+ * of their own, which adds the draw index attribute.
+ *
+ * A flush writes one BATCH_DRAW record and one indirect command per queued
+ * draw. The command baseInstance is the draw index, which reaches the vertex
+ * shader through an instanced attribute (GL 4.3 has no gl_DrawID) and selects
+ * the record. Both buffers are orphaned before each upload, since every pass
+ * of a frame reuses them.
+----------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "AVTmathLib.h"
+#include "staticBatch.h"
+#include "geometry.h"
+#include "meshArena.h"
+#include "glStateCache.h"
+
+extern float mCompMatrix[COUNT_COMPUTED_MATRICES][16];
+extern float mNormal3x3[9];
+
+// std430 DrawData of shaders/pointlight_phong.vert
+typedef struct {
+	float	pvm[16];
+	float	vm[16];
+	float	normal[12];		// mat3, columns padded to vec4
+	int		materialId;
+	int		pad[3];
+} BATCH_DRAW;
+
+typedef struct {
+	GLuint	count;
+	GLuint	instanceCount;
+	GLuint	firstIndex;
+	GLint	baseVertex;
+	GLuint	baseInstance;
+} BATCH_COMMAND;
+
+static std::vector<BATCH_DRAW> draws;
+static std::vector<BATCH_COMMAND> commands;
+
+static GLuint batchVAO = 0, drawIdBuffer, drawBuffer, commandBuffer;
+static UniformHandle<int> batched_uniform;
+
+
+bool batchBuild(UniformHandle<int> batchedUniform) {
+
+	batched_uniform = batchedUniform;
+	if (!meshArenaVAO() || !batched_uniform.isActive()) {
+		printf("Batch: not available, static meshes are drawn one by one\n");
+		return false;
+	}
+
+	glGenVertexArrays(1, &batchVAO);
+	stateBindVertexArray(batchVAO);
+	meshArenaAttribs();
+
+	// draw index of every instance; the baseInstance of a command picks its own
+	GLuint ids[BATCH_MAX_DRAWS];
+	for (int i = 0; i < BATCH_MAX_DRAWS; i++)
+		ids[i] = i;
+	glGenBuffers(1, &drawIdBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(ids), ids, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(BATCH_DRAW_ID_ATTRIB);
+	glVertexAttribIPointer(BATCH_DRAW_ID_ATTRIB, 1, GL_UNSIGNED_INT, 0, 0);
+	glVertexAttribDivisor(BATCH_DRAW_ID_ATTRIB, 1);
+
+	stateBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &drawBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, BATCH_MAX_DRAWS * sizeof(BATCH_DRAW), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_DRAW_BINDING, drawBuffer);
+
+	glGenBuffers(1, &commandBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, BATCH_MAX_DRAWS * sizeof(BATCH_COMMAND), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	draws.reserve(BATCH_MAX_DRAWS);
+	commands.reserve(BATCH_MAX_DRAWS);
+	return true;
+}
+
+
+void batchSubmit(const struct MyMesh& mesh, int materialId) {
+
+	if (!batchVAO || mesh.vao != meshArenaVAO() || mesh.type != GL_TRIANGLES)
+		return;
+	if (draws.size() == BATCH_MAX_DRAWS)
+		batchFlush();
+
+	BATCH_DRAW d;
+	computeDerivedMatrix(PROJ_VIEW_MODEL);
+	memcpy(d.vm, mCompMatrix[VIEW_MODEL], 16 * sizeof(float));
+	memcpy(d.pvm, mCompMatrix[PROJ_VIEW_MODEL], 16 * sizeof(float));
+	computeNormalMatrix3x3();
+	for (int c = 0; c < 3; c++) {
+		memcpy(d.normal + 4 * c, mNormal3x3 + 3 * c, 3 * sizeof(float));
+		d.normal[4 * c + 3] = 0.0f;
+	}
+	d.materialId = materialId;
+
+	BATCH_COMMAND cmd = { mesh.numIndexes, 1, mesh.firstIndex, mesh.baseVertex, (GLuint)draws.size() };
+
+	draws.push_back(d);
+	commands.push_back(cmd);
+}
+
+
+int batchFlush() {
+
+	int n = (int)draws.size();
+	if (n == 0)
+		return 0;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, BATCH_MAX_DRAWS * sizeof(BATCH_DRAW), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, n * sizeof(BATCH_DRAW), draws.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, BATCH_MAX_DRAWS * sizeof(BATCH_COMMAND), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, n * sizeof(BATCH_COMMAND), commands.data());
+
+	batched_uniform.set(1);
+	stateBindVertexArray(batchVAO);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, meshArenaIndexType(), 0, n, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	batched_uniform.set(0);
+
+	draws.clear();
+	commands.clear();
+	return n;
+}
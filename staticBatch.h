@@ -0,0 +1,35 @@
+#ifndef __STATIC_BATCH_H
+#define __STATIC_BATCH_H
+
+#include <GL/glew.h>
+
+#include "vsShaderLib.h"
+
+struct MyMesh;	// geometry.h
+
+/* --- Defines --- */
+
+// shader storage binding of the DrawTable buffer in shaders/pointlight_phong.vert
+#define BATCH_DRAW_BINDING 7
+// per instance draw index read by the vertex shader (VERTEX_ATTRIB1 of VertexAttrDef.h)
+#define BATCH_DRAW_ID_ATTRIB 5
+// draws in one glMultiDrawElementsIndirect; a larger batch is split
+#define BATCH_MAX_DRAWS 256
+
+/* --- Functions --- */
+
+// Meshes of the mesh arena drawn with glMultiDrawElementsIndirect. Matrices
+// and material of every draw go to a shader storage buffer indexed by the
+// draw id, so all draws of a flush share the textures and uniforms set by the caller.
+
+// after meshArenaBuild; batchedUniform is the bool telling the shader to read
+// the DrawTable. Returns false if nothing can be drawn batched.
+bool batchBuild(UniformHandle<int> batchedUniform);
+// queues a draw of an arena mesh with the current MODEL/VIEW/PROJECTION;
+// meshes outside the arena are ignored
+void batchSubmit(const struct MyMesh& mesh, int materialId);
+// draws the queued meshes with the shader in use, then empties the queue;
+// returns the number of draws
+int  batchFlush();
+
+#endif
@@ -34,6 +34,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "vsShaderLib.h"
 
@@ -47,7 +48,8 @@ VSShaderLib::spGLShaderTypes[VSShaderLib::COUNT_SHADER_TYPE] = {
 								GL_GEOMETRY_SHADER,
 								GL_TESS_CONTROL_SHADER,
 								GL_TESS_EVALUATION_SHADER,
-								GL_FRAGMENT_SHADER};
+								GL_FRAGMENT_SHADER,
+								GL_COMPUTE_SHADER};
 
 
 std::string 
@@ -56,7 +58,8 @@ VSShaderLib::spStringShaderTypes[VSShaderLib::COUNT_SHADER_TYPE] = {
 								"Geometry Shader",
 								"Tesselation Control Shader",
 								"Tesselation Evaluation Shader",
-								"Fragment Shader"};
+								"Fragment Shader",
+								"Compute Shader"};
 
 
 std::map<std::string, VSShaderLib::UniformBlock> VSShaderLib::spBlocks;
@@ -64,6 +67,8 @@ std::map<std::string, VSShaderLib::UniformBlock> VSShaderLib::spBlocks;
 
 int VSShaderLib::spBlockCount = 1;
 
+int VSShaderLib::spLookupCount = 0;
+
 
 VSShaderLib::VSShaderLib(): pProgram(0), pInited(false) {
 
@@ -78,6 +83,13 @@ VSShaderLib::~VSShaderLib() {
 	if (pProgram)
 		glDeleteProgram(pProgram);
 
+	std::map<unsigned int, GLuint>::iterator it;
+	for (it = pVariants.begin(); it != pVariants.end(); ++it) {
+		if (it->second != pProgram)
+			glDeleteProgram(it->second);
+	}
+	pVariants.clear();
+
 	for (int i = 0; i < VSShaderLib::COUNT_SHADER_TYPE; ++i) {
 		if (pShader[i])
 			glDeleteShader(pShader[i]);
@@ -112,6 +124,7 @@ VSShaderLib::loadShader(VSShaderLib::ShaderType st, std::string fileName) {
 		glAttachShader(pProgram, pShader[st]);
 		glCompileShader(pShader[st]);
 
+		pSource[st] = s;
 		free(s);
 	}
 }
@@ -122,7 +135,183 @@ VSShaderLib::prepareProgram() {
 
 	glLinkProgram(pProgram);
 	addUniforms();
-	//addBlocks();
+	addBlocks();
+}
+
+
+void
+VSShaderLib::setVariantFeatures(const std::vector<std::string> &defines) {
+
+	pVariantDefines = defines;
+}
+
+
+GLuint
+VSShaderLib::getVariant(unsigned int features) {
+
+	std::map<unsigned int, GLuint>::iterator it = pVariants.find(features);
+	if (it != pVariants.end())
+		return it->second;
+
+	GLuint variant = buildVariant(features);
+	if (!variant)
+		variant = pProgram;	// not built again every time it is asked for
+	pVariants[features] = variant;
+	return variant;
+}
+
+
+int
+VSShaderLib::getVariantCount() {
+
+	return (int)pVariants.size();
+}
+
+
+GLuint
+VSShaderLib::buildVariant(unsigned int features) {
+
+	// init and prepareProgram first
+	assert(pInited == true);
+
+	std::string defines = "#define VARIANT\n";
+	for (unsigned int i = 0; i < pVariantDefines.size(); ++i) {
+		if (features & (1u << i))
+			defines += "#define " + pVariantDefines[i] + "\n";
+	}
+
+	GLuint program = glCreateProgram();
+	GLuint shaders[VSShaderLib::COUNT_SHADER_TYPE];
+
+	for (int st = 0; st < VSShaderLib::COUNT_SHADER_TYPE; ++st) {
+		shaders[st] = 0;
+		if (!pShader[st])
+			continue;
+
+		// the defines go right after the #version line
+		std::string source = pSource[st];
+		size_t at = source.find("#version");
+		if (at != std::string::npos)
+			at = source.find('\n', at);
+		at = (at == std::string::npos) ? 0 : at + 1;
+		source.insert(at, defines);
+
+		const char *ss = source.c_str();
+		shaders[st] = glCreateShader(spGLShaderTypes[st]);
+		glShaderSource(shaders[st], 1, &ss, NULL);
+		glCompileShader(shaders[st]);
+		glAttachShader(program, shaders[st]);
+	}
+
+	// same attribute and fragment output locations as this program
+	GLint count;
+	char name[256];
+	glGetProgramInterfaceiv(pProgram, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+	for (int i = 0; i < count; ++i) {
+		glGetProgramResourceName(pProgram, GL_PROGRAM_INPUT, i, sizeof(name), NULL, name);
+		GLint loc = glGetProgramResourceLocation(pProgram, GL_PROGRAM_INPUT, name);
+		if (loc != -1 && strncmp(name, "gl_", 3))
+			glBindAttribLocation(program, loc, name);
+	}
+	glGetProgramInterfaceiv(pProgram, GL_PROGRAM_OUTPUT, GL_ACTIVE_RESOURCES, &count);
+	for (int i = 0; i < count; ++i) {
+		glGetProgramResourceName(pProgram, GL_PROGRAM_OUTPUT, i, sizeof(name), NULL, name);
+		GLint loc = glGetProgramResourceLocation(pProgram, GL_PROGRAM_OUTPUT, name);
+		if (loc != -1 && strncmp(name, "gl_", 3))
+			glBindFragDataLocation(program, loc, name);
+	}
+
+	glLinkProgram(program);
+
+	for (int st = 0; st < VSShaderLib::COUNT_SHADER_TYPE; ++st) {
+		if (shaders[st]) {
+			glDetachShader(program, shaders[st]);
+			glDeleteShader(shaders[st]);
+		}
+	}
+
+	GLint linked;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		GLint length = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+		std::string log(length + 1, '\0');
+		glGetProgramInfoLog(program, length + 1, NULL, &log[0]);
+		printf("Variant %x of program %d failed to link\n%s\n", features, pProgram, log.c_str());
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	// uniform blocks at the binding points given by addBlocks
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	for (int i = 0; i < count; ++i) {
+		glGetActiveUniformBlockName(program, i, sizeof(name), NULL, name);
+		if (spBlocks.count(name))
+			glUniformBlockBinding(program, i, spBlocks[name].bindingIndex);
+	}
+
+	copyUniforms(program);
+	return program;
+}
+
+
+void
+VSShaderLib::copyUniforms(GLuint variant) {
+
+	GLfloat f[16];
+	GLint iv[4];
+	GLuint uv[4];
+
+	std::map<std::string, myUniforms>::iterator it;
+	for (it = pUniforms.begin(); it != pUniforms.end(); ++it) {
+
+		// -1 where the defines of the variant leave it unused
+		GLint loc = glGetUniformLocation(variant, it->first.c_str());
+		if (loc == -1)
+			continue;
+
+		GLint from = it->second.location;
+		switch (it->second.type) {
+			case GL_FLOAT:
+				glGetUniformfv(pProgram, from, f); glProgramUniform1fv(variant, loc, 1, f); break;
+			case GL_FLOAT_VEC2:
+				glGetUniformfv(pProgram, from, f); glProgramUniform2fv(variant, loc, 1, f); break;
+			case GL_FLOAT_VEC3:
+				glGetUniformfv(pProgram, from, f); glProgramUniform3fv(variant, loc, 1, f); break;
+			case GL_FLOAT_VEC4:
+				glGetUniformfv(pProgram, from, f); glProgramUniform4fv(variant, loc, 1, f); break;
+			case GL_FLOAT_MAT2:
+				glGetUniformfv(pProgram, from, f); glProgramUniformMatrix2fv(variant, loc, 1, GL_FALSE, f); break;
+			case GL_FLOAT_MAT3:
+				glGetUniformfv(pProgram, from, f); glProgramUniformMatrix3fv(variant, loc, 1, GL_FALSE, f); break;
+			case GL_FLOAT_MAT4:
+				glGetUniformfv(pProgram, from, f); glProgramUniformMatrix4fv(variant, loc, 1, GL_FALSE, f); break;
+			case GL_UNSIGNED_INT:
+				glGetUniformuiv(pProgram, from, uv); glProgramUniform1uiv(variant, loc, 1, uv); break;
+			case GL_UNSIGNED_INT_VEC2:
+				glGetUniformuiv(pProgram, from, uv); glProgramUniform2uiv(variant, loc, 1, uv); break;
+			case GL_UNSIGNED_INT_VEC3:
+				glGetUniformuiv(pProgram, from, uv); glProgramUniform3uiv(variant, loc, 1, uv); break;
+			case GL_UNSIGNED_INT_VEC4:
+				glGetUniformuiv(pProgram, from, uv); glProgramUniform4uiv(variant, loc, 1, uv); break;
+			case GL_INT_VEC2:
+			case GL_BOOL_VEC2:
+				glGetUniformiv(pProgram, from, iv); glProgramUniform2iv(variant, loc, 1, iv); break;
+			case GL_INT_VEC3:
+			case GL_BOOL_VEC3:
+				glGetUniformiv(pProgram, from, iv); glProgramUniform3iv(variant, loc, 1, iv); break;
+			case GL_INT_VEC4:
+			case GL_BOOL_VEC4:
+				glGetUniformiv(pProgram, from, iv); glProgramUniform4iv(variant, loc, 1, iv); break;
+			default:
+				// int, bool, and the texture unit of a sampler; doubles and
+				// non square matrices are not copied
+				if (typeSize(it->second.type) == sizeof(GLint)) {
+					glGetUniformiv(pProgram, from, iv); glProgramUniform1iv(variant, loc, 1, iv);
+				}
+				break;
+		}
+	}
 }
 
 
@@ -230,11 +419,32 @@ VSShaderLib::setBlockUniformArrayElement(std::string blockName,
 }
 
 
+GLint
+VSShaderLib::getUniformLocation(std::string name) {
+
+	spLookupCount++;
+	std::map<std::string, myUniforms>::iterator it = pUniforms.find(name);
+	if (it == pUniforms.end())
+		return -1;
+	return (GLint)it->second.location;
+}
+
+
+int
+VSShaderLib::resetLookupCount() {
+
+	int count = spLookupCount;
+	spLookupCount = 0;
+	return count;
+}
+
+
 void 
 VSShaderLib::setUniform(std::string name, int value) {
 
 //	assert(pUniforms.count(name) != 0);
 
+	spLookupCount++;
 	int val = value;
 	myUniforms u = pUniforms[name];
 	glProgramUniform1i(pProgram, u.location, val);
@@ -247,6 +457,7 @@ VSShaderLib::setUniform(std::string name, float value) {
 
 //	assert(pUniforms.count(name) != 0);
 
+	spLookupCount++;
 	float val = value;
 	myUniforms u = pUniforms[name];
 	glProgramUniform1f(pProgram, u.location, val);
@@ -258,6 +469,7 @@ VSShaderLib::setUniform(std::string name, void *value) {
 
 //	assert(pUniforms.count(name) != 0);
 
+	spLookupCount++;
 	myUniforms u = pUniforms[name];
 	switch (u.type) {
 	
@@ -669,6 +881,7 @@ VSShaderLib::addBlocks() {
 
 			}
 			free(name2);
+			free(indices);
 
 			block.size = dataSize;
 			block.bindingIndex = spBlockCount;
@@ -678,6 +891,7 @@ VSShaderLib::addBlocks() {
 		else
 			glUniformBlockBinding(pProgram, i, spBlocks[name].bindingIndex);
 
+		free(name);
 	}
 
 }
@@ -700,16 +914,28 @@ VSShaderLib::addUniforms() {
 
 	name = (char *)malloc(sizeof(char) * maxUniLength);
 
-	unsigned int loc;
-	for (int i = 0; i < count; ++i) {
+	pUniforms.clear();
+
+	GLint loc;
+	for (GLuint i = 0; i < (GLuint)count; ++i) {
 
 		glGetActiveUniform(pProgram, i, maxUniLength, &actualLen, &size, &type, name);
 		// -1 indicates that is not an active uniform, although it may be present in a
 		// uniform block
 		loc = glGetUniformLocation(pProgram, name);
-		glGetActiveUniformsiv(pProgram, 1, &loc, GL_UNIFORM_ARRAY_STRIDE, &uniArrayStride);
-		if (loc != -1)
-			addUniform(name, type, size);
+		glGetActiveUniformsiv(pProgram, 1, &i, GL_UNIFORM_ARRAY_STRIDE, &uniArrayStride);
+		if (loc == -1)
+			continue;
+		addUniform(name, type, size);
+
+		// arrays are reported as "name[0]": also store the name alone and every element
+		std::string s = name;
+		if (size > 1 && s.size() > 3 && s.compare(s.size() - 3, 3, "[0]") == 0) {
+			std::string base = s.substr(0, s.size() - 3);
+			addUniform(base, type, size);
+			for (int k = 1; k < size; ++k)
+				addUniform(base + "[" + std::to_string(k) + "]", type, size - k);
+		}
 	}
 	free(name);
 }
@@ -11,7 +11,18 @@
  * This class aims at making life simpler
  * when using shaders and uniforms
  *
- * \version 0.2.1
+ * \version 0.2.4
+ *		Shader variants compiled from #define sets,
+ *			on first use, cached by a feature key
+ *
+ * version 0.2.3
+ *		Uniform locations cached at link time,
+ *			typed UniformHandle to set them
+ *
+ * version 0.2.2
+ *		Added compute shaders
+ *
+ * version 0.2.1
  *		Added more attrib defs, namely
  *			tangents, bi tangents, and 4 custom
  * 
@@ -38,6 +49,86 @@
 #include <map>
 #include <GL/glew.h>
 
+/// tags for the GLSL type of a UniformHandle
+struct vec2;
+struct vec3;
+struct vec4;
+struct mat3;
+struct mat4;
+
+/// how each uniform type is sent to the program in use
+template <typename T> struct UniformType;
+
+template <> struct UniformType<float> {
+	typedef GLfloat component;
+	static const int components = 1;
+	static void set(GLint loc, GLsizei count, const GLfloat *v) { glUniform1fv(loc, count, v); }
+};
+template <> struct UniformType<int> {
+	typedef GLint component;
+	static const int components = 1;
+	static void set(GLint loc, GLsizei count, const GLint *v) { glUniform1iv(loc, count, v); }
+};
+template <> struct UniformType<unsigned int> {
+	typedef GLuint component;
+	static const int components = 1;
+	static void set(GLint loc, GLsizei count, const GLuint *v) { glUniform1uiv(loc, count, v); }
+};
+template <> struct UniformType<vec2> {
+	typedef GLfloat component;
+	static const int components = 2;
+	static void set(GLint loc, GLsizei count, const GLfloat *v) { glUniform2fv(loc, count, v); }
+};
+template <> struct UniformType<vec3> {
+	typedef GLfloat component;
+	static const int components = 3;
+	static void set(GLint loc, GLsizei count, const GLfloat *v) { glUniform3fv(loc, count, v); }
+};
+template <> struct UniformType<vec4> {
+	typedef GLfloat component;
+	static const int components = 4;
+	static void set(GLint loc, GLsizei count, const GLfloat *v) { glUniform4fv(loc, count, v); }
+};
+template <> struct UniformType<mat3> {
+	typedef GLfloat component;
+	static const int components = 9;
+	static void set(GLint loc, GLsizei count, const GLfloat *v) { glUniformMatrix3fv(loc, count, GL_FALSE, v); }
+};
+template <> struct UniformType<mat4> {
+	typedef GLfloat component;
+	static const int components = 16;
+	static void set(GLint loc, GLsizei count, const GLfloat *v) { glUniformMatrix4fv(loc, count, GL_FALSE, v); }
+};
+
+/** Location of a uniform taken from the VSShaderLib cache.
+  * Setters act on the program in use, like glUniform*.
+  * A uniform that is not active gets location -1 and is ignored by GL.
+*/
+template <typename T>
+class UniformHandle {
+public:
+	typedef typename UniformType<T>::component component;
+
+	UniformHandle() : pLocation(-1) {}
+	explicit UniformHandle(GLint location) : pLocation(location) {}
+
+	/// sets count elements (count > 1 for arrays)
+	void set(const component *value, GLsizei count = 1) const {
+		UniformType<T>::set(pLocation, count, value);
+	}
+	/// for float, int and bool uniforms
+	void set(component value) const {
+		static_assert(UniformType<T>::components == 1, "set(value) is for scalar uniforms");
+		UniformType<T>::set(pLocation, 1, &value);
+	}
+
+	GLint location() const { return pLocation; }
+	bool isActive() const { return pLocation != -1; }
+
+private:
+	GLint pLocation;
+};
+
 
 
 class VSShaderLib
@@ -64,6 +155,7 @@ public:
 		TESS_CONTROL_SHADER,
 		TESS_EVAL_SHADER,
 		FRAGMENT_SHADER,
+		COMPUTE_SHADER,
 		COUNT_SHADER_TYPE
 	};
 
@@ -121,6 +213,24 @@ public:
 	*/
 	void prepareProgram();
 
+	/** returns a handle to a uniform, resolved from the cache filled
+	  * by prepareProgram. Meant to be called once, after linking
+	  *
+	  * \param name as in the shader, e.g. "mat.diffuse" or "point_pos[2]"
+	*/
+	template <typename T>
+	UniformHandle<T> getUniform(std::string name) {
+		return UniformHandle<T>(getUniformLocation(name));
+	}
+	/// location of a uniform from the cache, -1 if not active
+	GLint getUniformLocation(std::string name);
+
+	/** debug counter: uniform lookups by name (getUniformLocation and
+	  * setUniform) since the last call. Should be 0 for a frame once the
+	  * handles are resolved.
+	*/
+	static int resetLookupCount();
+
 	/// generic function to set the uniform <name> to value
 	void setUniform(std::string name, void *value);
 	/// For int and bool uniforms. Sets the uniform <name> to the int value
@@ -139,6 +249,22 @@ public:
 								int arrayIndex, 
 								void * value);
 
+	/** Shader variants: the loaded sources compiled again with #defines,
+	  * VARIANT and the one of every bit set in the feature key. A variant is
+	  * built the first time it is asked for and cached by its key. It gets
+	  * the attribute, output and block bindings and the uniform values of
+	  * this program, which must be linked already (prepareProgram).
+	  * Uniforms set afterwards should have explicit locations in the
+	  * shaders, so a location of this program is the same in every variant.
+	  *
+	  * \param defines the define of each feature bit, bit 0 first
+	*/
+	void setVariantFeatures(const std::vector<std::string> &defines);
+	/// program of a variant; this program if the variant fails to build
+	GLuint getVariant(unsigned int features);
+	/// variants built so far
+	int getVariantCount();
+
 	/// returns the program index
 	GLuint getProgramIndex();
 	/// returns a shader index
@@ -198,6 +324,9 @@ protected:
 	bool pInited;
 
 
+	/// uniform lookups by name, see resetLookupCount
+	static int spLookupCount;
+
 	/// blockCount is used to assign binding indexes
 	static int spBlockCount;
 
@@ -219,6 +348,15 @@ protected:
 	/// stores info on the uniforms
 	std::map<std::string, myUniforms> pUniforms;
 
+	/// shader sources, kept to build the variants
+	std::string pSource[VSShaderLib::COUNT_SHADER_TYPE];
+
+	/// define of each feature bit of the variants
+	std::vector<std::string> pVariantDefines;
+
+	/// variant programs by feature key
+	std::map<unsigned int, GLuint> pVariants;
+
 	// AUX FUNCTIONS
 
 	/// aux function to get info on the uniforms referenced by the shaders
@@ -230,6 +368,12 @@ protected:
 	/// aux function to get info on the blocks referenced by the shaders
 	void addBlocks();
 
+	/// aux function to compile and link a variant, 0 if it fails
+	GLuint buildVariant(unsigned int features);
+
+	/// aux function to copy the uniform values of this program to a variant
+	void copyUniforms(GLuint variant);
+
 	/// determines the size in bytes based on the OpenGL type
 	int typeSize(int type);
 